@@ -9,6 +9,20 @@ endif()
 set(CMAKE_CXX_STANDARD 17)
 set(CMAKE_CXX_STANDARD_REQUIRED ON)
 
+# Compile for the host CPU, so that the ray packet code can use AVX/AVX2 (see src/include/simd.h).
+# Turn this off when building binaries that must run on other machines.
+option(LUTERT_NATIVE_ARCH "Optimize for the instruction set of the build machine" ON)
+if(LUTERT_NATIVE_ARCH AND NOT MSVC)
+    add_compile_options(-march=native)
+endif()
+
+# Count rays, intersection tests, BVH nodes and scatter calls during a render (see src/include/stats.h).
+# Off by default, since the counters cost time on the hot paths.
+option(LUTERT_ENABLE_STATS "Compile in the render statistics counters" OFF)
+if(LUTERT_ENABLE_STATS)
+    add_compile_definitions(LUTERT_ENABLE_STATS)
+endif()
+
 # Use the CPM package manager
 # https://github.com/cpm-cmake/CPM.cmake
 include(${CMAKE_CURRENT_LIST_DIR}/get_cpm.cmake)
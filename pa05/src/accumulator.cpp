@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fmt/core.h>
+
+#include "accumulator.h"
+
+namespace {
+    // Checkpoint layout, in native byte order: the header below, then the Pixel
+    // structs of the region row by row.
+    constexpr char CHECKPOINT_MAGIC[8] = {'L', 'U', 'T', 'E', 'R', 'T', 'C', 'K'};
+    constexpr uint32_t CHECKPOINT_VERSION = 2;
+
+    struct CheckpointHeader {
+        char magic[8];
+        uint32_t version;
+        int32_t width, height;              // Size of the region
+        int32_t samples;                    // One past the last sample
+        uint64_t scene_id;
+        int32_t frame_width, frame_height;
+        int32_t region_x, region_y;         // Position of the region in the frame
+        int32_t first_sample;
+    };
+}
+
+Accumulator::Accumulator( const Vec2i & frame_size, const Vec2i & region_min, const Vec2i & region_max, uint64_t scene_id ) :
+    frame_size(frame_size), origin(region_min), size(region_max - region_min), scene_id(scene_id) {
+    if( region_min.x < 0 || region_min.y < 0 || region_max.x > frame_size.x || region_max.y > frame_size.y ||
+        size.x <= 0 || size.y <= 0 ) {
+        throw LutertException( fmt::format("Region [{},{})-[{},{}) is empty or outside the {}x{} frame",
+                                           region_min.x, region_min.y, region_max.x, region_max.y,
+                                           frame_size.x, frame_size.y) );
+    }
+    pixels.resize( size_t(size.x) * size.y );
+}
+
+Image Accumulator::image() const {
+    Image image(size.x, size.y);
+    for( int y = 0; y < size.y; y++ ) {
+        for( int x = 0; x < size.x; x++ ) {
+            const Pixel & p = (*this)(x, y);
+            if( p.count > 0 ) image(x, y) = Color3f( p.sum / double(p.count) );
+        }
+    }
+    return image;
+}
+
+Image Accumulator::spp_map() const {
+    Image image(size.x, size.y);
+    for( int y = 0; y < size.y; y++ ) {
+        for( int x = 0; x < size.x; x++ ) {
+            image(x, y) = Color3f{ float((*this)(x, y).count) };
+        }
+    }
+    return image;
+}
+
+void Accumulator::save( const std::string & filename ) const {
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.width = size.x;
+    header.height = size.y;
+    header.samples = next_sample;
+    header.scene_id = scene_id;
+    header.frame_width = frame_size.x;
+    header.frame_height = frame_size.y;
+    header.region_x = origin.x;
+    header.region_y = origin.y;
+    header.first_sample = start_sample;
+
+    std::string temp_name = filename + ".tmp";
+    {
+        std::ofstream out(temp_name, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(pixels.data()), std::streamsize(pixels.size() * sizeof(Pixel)));
+        if( !out ) throw LutertException( fmt::format("Error writing checkpoint: {}", temp_name) );
+    }
+    if( std::rename(temp_name.c_str(), filename.c_str()) != 0 ) {
+        throw LutertException( fmt::format("Error renaming checkpoint {} to {}", temp_name, filename) );
+    }
+}
+
+Accumulator Accumulator::load( const std::string & filename, uint64_t scene_id ) {
+    Accumulator acc = load(filename);
+    if( acc.scene_id != scene_id ) {
+        throw LutertException( fmt::format("Checkpoint {} was written for a different scene", filename) );
+    }
+    return acc;
+}
+
+Accumulator Accumulator::load( const std::string & filename ) {
+    std::ifstream in(filename, std::ios::binary);
+    if( !in ) throw LutertException( fmt::format("Unable to open checkpoint: {}", filename) );
+
+    CheckpointHeader header{};
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if( !in || std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ) {
+        throw LutertException( fmt::format("Not a checkpoint file: {}", filename) );
+    }
+    if( header.version != CHECKPOINT_VERSION ) {
+        throw LutertException( fmt::format("Unsupported checkpoint version {} in {}", header.version, filename) );
+    }
+    if( header.width <= 0 || header.height <= 0 || header.first_sample < 0 || header.samples < header.first_sample ||
+        header.region_x < 0 || header.region_y < 0 ||
+        header.region_x + header.width > header.frame_width || header.region_y + header.height > header.frame_height ) {
+        throw LutertException( fmt::format("Invalid checkpoint header in {}", filename) );
+    }
+
+    Vec2i region_min{header.region_x, header.region_y};
+    Accumulator acc( Vec2i{header.frame_width, header.frame_height}, region_min,
+                     region_min + Vec2i{header.width, header.height}, header.scene_id );
+    acc.start_sample = header.first_sample;
+    acc.next_sample = header.samples;
+    in.read(reinterpret_cast<char *>(acc.pixels.data()), std::streamsize(acc.pixels.size() * sizeof(Pixel)));
+    if( !in ) throw LutertException( fmt::format("Checkpoint {} is truncated", filename) );
+    return acc;
+}
+
+Accumulator Accumulator::merge( std::vector<Accumulator> partials ) {
+    if( partials.empty() ) throw LutertException("No partial renders to merge");
+    const Accumulator & first = partials.front();
+    for( const auto & p : partials ) {
+        if( p.scene_id != first.scene_id ) throw LutertException("Partial renders are of different scenes");
+        if( p.frame_size != first.frame_size ) throw LutertException("Partial renders are of different frame sizes");
+    }
+
+    // In sample order, so that each pixel adds up its samples in the same order whatever the order of the partials
+    std::stable_sort( partials.begin(), partials.end(), []( const Accumulator & a, const Accumulator & b ) {
+        return a.start_sample < b.start_sample;
+    });
+
+    Accumulator whole( first.frame_size, first.scene_id );
+    // The sample each pixel has been merged up to, -1 for a pixel no partial has covered yet
+    std::vector<int> merged_until( whole.pixels.size(), -1 );
+    for( const auto & p : partials ) {
+        for( int y = 0; y < p.size.y; y++ ) {
+            for( int x = 0; x < p.size.x; x++ ) {
+                Vec2i pos = p.origin + Vec2i{x, y};
+                size_t index = size_t(pos.y) * whole.size.x + pos.x;
+                int until = std::max( merged_until[index], 0 );
+                if( p.start_sample != until ) {
+                    throw LutertException( fmt::format("Partial renders {} at pixel ({}, {}): samples [{}, {}) do not follow sample {}",
+                                                       p.start_sample < until ? "overlap" : "leave a gap",
+                                                       pos.x, pos.y, p.start_sample, p.next_sample, until) );
+                }
+                whole.pixels[index].merge( p(x, y) );
+                merged_until[index] = p.next_sample;
+            }
+        }
+    }
+
+    whole.next_sample = merged_until[0];
+    for( size_t i = 0; i < merged_until.size(); i++ ) {
+        int x = int(i % whole.size.x), y = int(i / whole.size.x);
+        if( merged_until[i] < 0 ) throw LutertException( fmt::format("No partial render covers pixel ({}, {})", x, y) );
+        if( merged_until[i] != whole.next_sample ) {
+            throw LutertException( fmt::format("Pixel ({}, {}) has samples up to {}, but pixel (0, 0) up to {}",
+                                               x, y, merged_until[i], whole.next_sample) );
+        }
+    }
+    return whole;
+}
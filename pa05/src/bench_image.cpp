@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cmath>
+#include <fmt/core.h>
+#include <pcg32.h>
+
+#include "image.h"
+
+/**
+ * Measures the conversion of a linear image to 8-bit sRGB, as done by
+ * Image::save_png, without writing the PNG.
+ *
+ * Usage: bench_image [width height] [repetitions]
+ *
+ * The default size is an 8K frame.  The baseline converts one pixel at a time in
+ * column order with pow, as save_png used to; it is compared to Image::to_srgb8,
+ * which uses one worker thread per hardware thread, with and without dithering.
+ */
+int main( int argc, char ** argv ) {
+    int width = argc > 2 ? std::stoi(argv[1]) : 7680;
+    int height = argc > 2 ? std::stoi(argv[2]) : 4320;
+    int repetitions = argc > 3 ? std::stoi(argv[3]) : 3;
+
+    pcg32 rng;
+    Image image(width, height);
+    for( int y = 0; y < height; y++ ) {
+        for( int x = 0; x < width; x++ ) {
+            image(x, y) = Color3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * 1.1f;
+        }
+    }
+    std::vector<uint8_t> out( size_t(3) * width * height );
+
+    double num_pixels = double(width) * height * repetitions;
+    auto report = [&]( const char * mode, std::chrono::duration<double> elapsed ) {
+        fmt::print("{}x{} ({}): {:.3f}s, {:.1f} Mpixels/s\n", width, height, mode,
+                   elapsed.count(), num_pixels / elapsed.count() * 1e-6);
+    };
+
+    auto start_time = std::chrono::steady_clock::now();
+    for( int i = 0; i < repetitions; i++ ) {
+        for( int x = 0; x < width; x++ ) {
+            for( int y = 0; y < height; y++ ) {
+                Color3f c = image(x, y);
+                if( !std::isfinite(c.x) || !std::isfinite(c.y) || !std::isfinite(c.z) ) c = {1.0f, 0.0f, 1.0f};
+                Color3f srgb = linalg::clamp( to_sRGB(c), 0.0f, 1.0f );
+                uint8_t * p = &out[ 3 * size_t(image.index_1(x, y)) ];
+                p[0] = uint8_t(srgb.x * 255);
+                p[1] = uint8_t(srgb.y * 255);
+                p[2] = uint8_t(srgb.z * 255);
+            }
+        }
+    }
+    report( "baseline", std::chrono::steady_clock::now() - start_time );
+
+    // The conversion tables are built on first use, outside the timed loops
+    image.to_srgb8(out.data());
+
+    for( bool dither : {false, true} ) {
+        start_time = std::chrono::steady_clock::now();
+        for( int i = 0; i < repetitions; i++ ) image.to_srgb8(out.data(), 1.0f, dither);
+        report( dither ? "to_srgb8, dithered" : "to_srgb8", std::chrono::steady_clock::now() - start_time );
+    }
+    return 0;
+}
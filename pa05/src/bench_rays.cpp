@@ -0,0 +1,79 @@
+#include <chrono>
+#include <fstream>
+#include <fmt/core.h>
+#include <nlohmann/json.hpp>
+
+#include "scene.h"
+
+/**
+ * Measures ray-scene intersection throughput for camera rays.
+ *
+ * Usage: bench_rays scene_file [repetitions]
+ *
+ * One jittered camera ray is generated per pixel, then every ray is intersected
+ * with the scene the given number of times on a single thread, first one ray at
+ * a time and then in packets of 4x2 neighbouring pixels as in Scene::render.
+ * Only intersection is timed, no shading is done.
+ */
+int main( int argc, char ** argv ) {
+    if( argc < 2 ) {
+        fmt::print("Usage: {} scene_file [repetitions]\n", argv[0]);
+        return 1;
+    }
+    int repetitions = argc > 2 ? std::stoi(argv[2]) : 5;
+
+    std::ifstream input_file( argv[1] );
+    Scene scn{ json::parse(input_file) };
+    const Camera & camera = scn.get_camera();
+    const Surface & surfaces = scn.get_surfaces();
+
+    std::vector<Ray> rays;
+    Vec2i res = camera.get_resolution();
+    rays.reserve(res.x * res.y);
+    for( int y = 0; y < res.y; y++ ) {
+        for( int x = 0; x < res.x; x++ ) {
+            Sampler sampler( y * res.x + x, 0 );
+            rays.push_back( camera.generate_ray(Vec2f{float(x), float(y)} + sampler.next_2d()) );
+        }
+    }
+
+    // Packets of 4x2 pixels
+    std::vector<RayPacket> packets;
+    for( int y = 0; y < res.y; y += 2 ) {
+        for( int x = 0; x < res.x; x += 4 ) {
+            RayPacket & packet = packets.emplace_back();
+            for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+                int px = x + lane % 4, py = y + lane / 4;
+                if( px < res.x && py < res.y ) packet.set( lane, rays[py * res.x + px] );
+            }
+        }
+    }
+
+    double num_rays = double(rays.size()) * repetitions;
+    auto report = [&]( const char * mode, size_t num_hits, std::chrono::duration<double> elapsed ) {
+        fmt::print("{} ({}): {} rays, {} hits, {:.3f}s, {:.3f} Mrays/s\n", argv[1], mode, num_rays, num_hits,
+                   elapsed.count(), num_rays / elapsed.count() * 1e-6);
+    };
+
+    size_t num_hits = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    for( int i = 0; i < repetitions; i++ ) {
+        for( Ray ray : rays ) {
+            PrimitiveHit hit;
+            if( surfaces.intersect_t(ray, hit) ) num_hits++;
+        }
+    }
+    report( "single", num_hits, std::chrono::steady_clock::now() - start_time );
+
+    num_hits = 0;
+    start_time = std::chrono::steady_clock::now();
+    for( int i = 0; i < repetitions; i++ ) {
+        for( RayPacket packet : packets ) {
+            PrimitiveHit hits[PACKET_SIZE];
+            uint32_t hit_mask = surfaces.intersect_packet(packet, hits);
+            for( ; hit_mask != 0; hit_mask &= hit_mask - 1 ) num_hits++;
+        }
+    }
+    report( "packet", num_hits, std::chrono::steady_clock::now() - start_time );
+    return 0;
+}
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <future>
+#include <memory>
+
+#include "bvh.h"
+#include "scene_cache.h"
+
+namespace {
+    constexpr int NUM_BINS = 16;                ///< Number of SAH bins along each axis
+    constexpr float TRAVERSAL_COST = 0.125f;    ///< Cost of visiting a node relative to a primitive test
+    constexpr int MAX_SAH_DEPTH = 64;           ///< Below this depth, nodes are split at the median
+    constexpr size_t PARALLEL_MIN_SIZE = 16384; ///< Subtrees smaller than this are built serially
+    constexpr int PARALLEL_MAX_DEPTH = 6;       ///< Spawn build tasks only near the root
+
+    struct BuildPrim {
+        Bounds3f bounds;
+        Vec3f centroid;
+        uint32_t index;
+    };
+
+    struct BuildNode {
+        Bounds3f bounds;
+        std::unique_ptr<BuildNode> children[2];
+        uint32_t first = 0, count = 0;  // Range in the BuildPrim array (leaves only)
+        int axis = 0;
+        size_t num_nodes = 1;           // Size of the subtree rooted here
+    };
+
+    struct Builder {
+        std::vector<BuildPrim> & prims;
+        int max_leaf_size;
+        int leaf_width;
+
+        /// SAH cost of testing n primitives, which are tested leaf_width at a time
+        float prim_cost( int n ) const { return float( (n + leaf_width - 1) / leaf_width ); }
+
+        std::unique_ptr<BuildNode> make_leaf( std::unique_ptr<BuildNode> node, size_t begin, size_t end ) {
+            node->first = uint32_t(begin);
+            node->count = uint32_t(end - begin);
+            return node;
+        }
+
+        /// Partition prims[begin, end) around the median centroid on axis, which ends up at mid
+        void median_split( size_t begin, size_t mid, size_t end, int axis ) {
+            std::nth_element( &prims[begin], &prims[mid], &prims[end - 1] + 1,
+                              [axis]( const BuildPrim & a, const BuildPrim & b ) {
+                                  return a.centroid[axis] < b.centroid[axis];
+                              });
+        }
+
+        std::unique_ptr<BuildNode> build( size_t begin, size_t end, int depth ) {
+            auto node = std::make_unique<BuildNode>();
+            Bounds3f centroid_bounds;
+            for( size_t i = begin; i < end; i++ ) {
+                node->bounds.extend( prims[i].bounds );
+                centroid_bounds.extend( prims[i].centroid );
+            }
+
+            size_t n = end - begin;
+            if( n == 1 ) return make_leaf(std::move(node), begin, end);
+
+            int axis = centroid_bounds.max_axis();
+            size_t mid = begin + n / 2;
+
+            if( centroid_bounds.extent()[axis] <= 0.0f ) {
+                // All centroids coincide, any split is as good as another
+                if( int(n) <= max_leaf_size ) return make_leaf(std::move(node), begin, end);
+            } else if( depth >= MAX_SAH_DEPTH ) {
+                // Guard against degenerate SAH splits making the tree too deep
+                median_split(begin, mid, end, axis);
+            } else {
+                // Bin the centroids along each axis and evaluate the SAH at each bin boundary
+                float best_cost = std::numeric_limits<float>::infinity();
+                int best_axis = -1, best_split = 0;
+                Vec3f cmin = centroid_bounds.min;
+                Vec3f scale = float(NUM_BINS) / centroid_bounds.extent();
+
+                for( int a = 0; a < 3; a++ ) {
+                    if( centroid_bounds.extent()[a] <= 0.0f ) continue;
+
+                    Bounds3f bin_bounds[NUM_BINS];
+                    int bin_count[NUM_BINS] = {};
+                    for( size_t i = begin; i < end; i++ ) {
+                        int b = std::min( int((prims[i].centroid[a] - cmin[a]) * scale[a]), NUM_BINS - 1 );
+                        bin_count[b]++;
+                        bin_bounds[b].extend( prims[i].bounds );
+                    }
+
+                    // Sweep from the right to get the area and count to the right of each split
+                    float right_area[NUM_BINS];
+                    int right_count[NUM_BINS];
+                    Bounds3f right;
+                    int count = 0;
+                    for( int b = NUM_BINS - 1; b > 0; b-- ) {
+                        right.extend( bin_bounds[b] );
+                        count += bin_count[b];
+                        right_area[b] = right.surface_area();
+                        right_count[b] = count;
+                    }
+
+                    Bounds3f left;
+                    count = 0;
+                    for( int b = 0; b < NUM_BINS - 1; b++ ) {
+                        left.extend( bin_bounds[b] );
+                        count += bin_count[b];
+                        float cost = left.surface_area() * prim_cost(count) + right_area[b + 1] * prim_cost(right_count[b + 1]);
+                        if( cost < best_cost ) {
+                            best_cost = cost;
+                            best_axis = a;
+                            best_split = b;
+                        }
+                    }
+                }
+
+                if( best_axis < 0 ) {
+                    // No split has a finite cost, e.g. with infinite or NaN bounds
+                    median_split(begin, mid, end, axis);
+                } else {
+                    best_cost = TRAVERSAL_COST + best_cost / node->bounds.surface_area();
+                    if( int(n) <= max_leaf_size && best_cost >= prim_cost(int(n)) ) {
+                        return make_leaf(std::move(node), begin, end);
+                    }
+
+                    axis = best_axis;
+                    float split_min = cmin[axis], split_scale = scale[axis];
+                    BuildPrim * pmid = std::partition( &prims[begin], &prims[end - 1] + 1,
+                        [=]( const BuildPrim & p ) {
+                            int b = std::min( int((p.centroid[axis] - split_min) * split_scale), NUM_BINS - 1 );
+                            return b <= best_split;
+                        });
+                    mid = size_t(pmid - &prims[0]);
+                    if( mid == begin || mid == end ) mid = begin + n / 2;
+                }
+            }
+
+            node->axis = axis;
+            if( n >= PARALLEL_MIN_SIZE && depth < PARALLEL_MAX_DEPTH ) {
+                auto left = std::async( std::launch::async, [this, begin, mid, depth]() {
+                    return build(begin, mid, depth + 1);
+                });
+                node->children[1] = build(mid, end, depth + 1);
+                node->children[0] = left.get();
+            } else {
+                node->children[0] = build(begin, mid, depth + 1);
+                node->children[1] = build(mid, end, depth + 1);
+            }
+            node->num_nodes = 1 + node->children[0]->num_nodes + node->children[1]->num_nodes;
+            return node;
+        }
+    };
+
+    uint32_t flatten( const BuildNode & node, const std::vector<BuildPrim> & prims,
+                      std::vector<BVHNode> & nodes, std::vector<uint32_t> & indices ) {
+        uint32_t id = uint32_t(nodes.size());
+        nodes.emplace_back();
+        nodes[id].bounds = node.bounds;
+        if( node.children[0] ) {
+            nodes[id].axis = uint8_t(node.axis);
+            flatten(*node.children[0], prims, nodes, indices);
+            nodes[id].offset = flatten(*node.children[1], prims, nodes, indices);
+        } else {
+            nodes[id].offset = uint32_t(indices.size());
+            nodes[id].count = uint16_t(node.count);
+            for( uint32_t i = 0; i < node.count; i++ ) {
+                indices.push_back( prims[node.first + i].index );
+            }
+        }
+        return id;
+    }
+}
+
+void BVHTree::build( const std::vector<Bounds3f> & prim_bounds, int max_leaf_size, int leaf_width ) {
+    nodes.clear();
+    indices.clear();
+    if( prim_bounds.empty() ) return;
+
+    std::vector<BuildPrim> prims(prim_bounds.size());
+    for( size_t i = 0; i < prim_bounds.size(); i++ ) {
+        prims[i].bounds = prim_bounds[i];
+        prims[i].centroid = prim_bounds[i].centroid();
+        prims[i].index = uint32_t(i);
+    }
+
+    Builder builder{ prims, std::clamp(max_leaf_size, 1, 255), std::max(leaf_width, 1) };
+    std::unique_ptr<BuildNode> root = builder.build(0, prims.size(), 0);
+
+    nodes.reserve(root->num_nodes);
+    indices.reserve(prims.size());
+    flatten(*root, prims, nodes, indices);
+}
+
+void BVHTree::save( SceneWriter & out ) const {
+    out.write_vector(nodes);
+    out.write_vector(indices);
+}
+
+void BVHTree::load( SceneReader & in, size_t num_prims ) {
+    nodes = in.read_vector<BVHNode>();
+    indices = in.read_vector<uint32_t>();
+    if( nodes.empty() && num_prims > 0 ) throw LutertException("Empty BVH in scene cache");
+    // Check the links, so that a damaged cache cannot send traversal out of bounds, around
+    // a cycle or past the end of its stack.  Both children of an interior node come after
+    // it, and depth[i] bounds the stack size on reaching node i.
+    std::vector<int> depth(nodes.size(), 0);
+    for( size_t i = 0; i < nodes.size(); i++ ) {
+        const BVHNode & node = nodes[i];
+        if( node.is_leaf() ) {
+            if( size_t(node.offset) + node.count > indices.size() ) throw LutertException("Invalid BVH node in scene cache");
+            continue;
+        }
+        bool valid = i + 1 < nodes.size() && node.offset > i && node.offset < nodes.size()
+                     && node.axis < 3 && depth[i] < STACK_SIZE;
+        if( !valid ) throw LutertException("Invalid BVH node in scene cache");
+        depth[i + 1] = std::max( depth[i + 1], depth[i] + 1 );
+        depth[node.offset] = std::max( depth[node.offset], depth[i] + 1 );
+    }
+    for( uint32_t index : indices ) {
+        if( index >= num_prims ) throw LutertException("Invalid BVH primitive index in scene cache");
+    }
+}
+
+void BVH::build() {
+    std::vector<Bounds3f> prim_bounds;
+    prim_bounds.reserve(surfaces.size());
+    for( auto & surf : surfaces ) {
+        prim_bounds.push_back( surf->bounds() );
+    }
+    tree.build(prim_bounds);
+}
+
+bool BVH::intersect_t( Ray & ray, PrimitiveHit & hit ) const {
+    return tree.traverse( ray, [&]( uint32_t i ) {
+        return surfaces[i]->intersect_t(ray, hit);
+    });
+}
+
+bool BVH::occluded( const Ray & ray ) const {
+    return tree.traverse_any( ray, [&]( uint32_t i ) {
+        return surfaces[i]->occluded(ray);
+    });
+}
+
+uint32_t BVH::intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const {
+    uint32_t active = packet.active;
+    return tree.traverse_packet( packet, [&]( uint32_t i, uint32_t lanes ) {
+        // Only the rays that reached this leaf need to be tested
+        packet.active = lanes;
+        uint32_t hit_mask = surfaces[i]->intersect_packet(packet, hits);
+        packet.active = active;
+        return hit_mask;
+    });
+}
+
+void BVH::save( SceneWriter & out ) const {
+    out.write(SceneCache::BVH);
+    out.write( uint64_t(surfaces.size()) );
+    for( const auto & surf : surfaces ) out.write_surface(*surf);
+    tree.save(out);
+}
+
+std::shared_ptr<BVH> BVH::load( SceneReader & in ) {
+    auto bvh = std::make_shared<BVH>();
+    uint64_t count = in.read<uint64_t>();
+    for( uint64_t i = 0; i < count; i++ ) bvh->add( in.read_surface() );
+    bvh->tree.load(in, bvh->surfaces.size());
+    return bvh;
+}
@@ -1,32 +1,166 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 #include <linalg.h>
+#include <cctype>
 #include <cmath>
+#include <cstdlib>
 #include <fmt/core.h>
+#include <cstring>
+#include <fstream>
+#include <limits>
 
 #include "image.h"
+#include "parallel.h"
+#include "simd.h"
 
-void Image::save_png(const std::string & filename, float bias) const {
+namespace {
+    /// @returns the lower case extension of filename, including the dot, or "" if it has none
+    std::string extension( const std::string & filename ) {
+        size_t dot = filename.find_last_of('.');
+        size_t slash = filename.find_last_of("/\\");
+        if( dot == std::string::npos || (slash != std::string::npos && dot < slash) ) return "";
+        std::string ext = filename.substr(dot);
+        for( char & c : ext ) c = char( std::tolower( (unsigned char)c ) );
+        return ext;
+    }
 
-    std::vector<uint8_t> image_out(size.x * size.y * 3, 0);
+    /**
+     * Conversion of linear values in [0, 1] to 8-bit sRGB without calling pow.
+     *
+     * lower[k] is the smallest float whose sRGB value (to_sRGB) is at least k/255,
+     * and mid[k] the smallest whose value is at least (k + 0.5)/255, found by
+     * bisection so that the results agree exactly with to_sRGB.  lut[] holds the
+     * code floor(255 * sRGB) at the start of each range of floats that share their
+     * top 16 bits.  Such a range spans less than one code (at most 0.88 codes, just
+     * below 1.0), so one comparison with lower[] corrects the code for any value in it.
+     */
+    struct SRGBTable {
+        static constexpr uint32_t LUT_SIZE = (0x3f800000u >> 16) + 1;   // Up to the bits of 1.0f
 
-    for( int x = 0; x < size.x; x++ ) {
-        for(int y = 0; y < size.y; y++ ) {
-            Color3f pix_color = image_data[ index_1(x,y) ];
-            pix_color *= bias;
+        float lower[257];
+        float mid[256];
+        uint8_t lut[LUT_SIZE];
 
-            // Make infinite colors stand out as magenta
-            if( !std::isfinite(pix_color.x) || !std::isfinite(pix_color.y) || !std::isfinite(pix_color.z) ) {
-                pix_color = {1.0f, 0.0f, 1.0f};
+        SRGBTable() {
+            auto srgb = []( float v ) { return 255.0f * to_sRGB(Color3f{v}).x; };
+            // Smallest non-negative float v with srgb(v) >= target
+            auto smallest = [&]( float target ) {
+                if( srgb(1.0f) < target ) return std::numeric_limits<float>::infinity();
+                uint32_t lo = 0, hi = 0x3f800000u;
+                while( lo < hi ) {
+                    uint32_t m = lo + (hi - lo) / 2;
+                    float v;
+                    std::memcpy(&v, &m, sizeof(v));
+                    if( srgb(v) >= target ) hi = m; else lo = m + 1;
+                }
+                float v;
+                std::memcpy(&v, &lo, sizeof(v));
+                return v;
+            };
+            for( int k = 0; k <= 256; k++ ) lower[k] = k == 0 ? 0.0f : smallest( float(k) );
+            for( int k = 0; k < 256; k++ ) mid[k] = smallest( float(k) + 0.5f );
+
+            int code = 0;
+            for( uint32_t i = 0; i < LUT_SIZE; i++ ) {
+                uint32_t bits = i << 16;
+                float v;
+                std::memcpy(&v, &bits, sizeof(v));
+                while( code < 255 && v >= lower[code + 1] ) code++;
+                lut[i] = uint8_t(code);
             }
+        }
+
+        /// @returns floor(255 * sRGB(v)) for v in [0, 1]
+        int floor( float v ) const {
+            uint32_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            int code = lut[bits >> 16];
+            return code + (v >= lower[code + 1]);
+        }
+
+        /// @returns the nearest code to 255 * sRGB(v) for v in [0, 1]
+        uint8_t round( float v ) const {
+            int code = floor(v);
+            return uint8_t( std::min(code + (v >= mid[code]), 255) );
+        }
+
+        /**
+         * @returns 255 * sRGB(v) rounded up if its position between two codes (measured
+         *          in linear space) is at least threshold, and down otherwise
+         */
+        uint8_t dither( float v, float threshold ) const {
+            int code = floor(v);
+            if( code == 255 ) return 255;
+            float fraction = (v - lower[code]) / (lower[code + 1] - lower[code]);
+            return uint8_t( code + (fraction >= threshold) );
+        }
+    };
+
+    const SRGBTable & srgb_table() {
+        static const SRGBTable table;
+        return table;
+    }
+
+    /// Ordered dithering thresholds, in units of 1/64
+    constexpr uint8_t BAYER_8X8[8][8] = {
+        {  0, 32,  8, 40,  2, 34, 10, 42 },
+        { 48, 16, 56, 24, 50, 18, 58, 26 },
+        { 12, 44,  4, 36, 14, 46,  6, 38 },
+        { 60, 28, 52, 20, 62, 30, 54, 22 },
+        {  3, 35, 11, 43,  1, 33,  9, 41 },
+        { 51, 19, 59, 27, 49, 17, 57, 25 },
+        { 15, 47,  7, 39, 13, 45,  5, 37 },
+        { 63, 31, 55, 23, 61, 29, 53, 21 }
+    };
 
-            Color3f srgb = linalg::clamp( to_sRGB(pix_color), 0.0f, 1.0f );
-            int offset = 3 * (x + y * size.x);
-            image_out[ offset + 0 ] = static_cast<uint8_t>(srgb.x * 255);
-            image_out[ offset + 1 ] = static_cast<uint8_t>(srgb.y * 255);
-            image_out[ offset + 2 ] = static_cast<uint8_t>(srgb.z * 255);
+    /// Rows of an image converted by one task of Image::to_srgb8
+    constexpr int ROWS_PER_TASK = 16;
+
+    template <class T>
+    void write_binary( std::ostream & out, const T & value ) {
+        out.write( reinterpret_cast<const char *>(&value), sizeof(T) );
+    }
+
+    /// Write an OpenEXR header attribute
+    template <class T>
+    void write_attribute( std::ostream & out, const char * name, const char * type, const T & value ) {
+        out.write( name, std::streamsize(std::strlen(name) + 1) );
+        out.write( type, std::streamsize(std::strlen(type) + 1) );
+        write_binary( out, int32_t(sizeof(T)) );
+        write_binary( out, value );
+    }
+
+    /**
+     * The OpenEXR ZIP predictor: split the bytes into two halves (even and odd
+     * offsets), then replace each byte by its difference to the previous one.
+     * This puts the similar high bytes of neighbouring floats next to each other.
+     */
+    void exr_zip_predictor( const std::vector<uint8_t> & in, std::vector<uint8_t> & out ) {
+        out.resize( in.size() );
+        size_t half = (in.size() + 1) / 2;
+        for( size_t i = 0; i < in.size(); i++ ) {
+            out[ (i % 2 == 0) ? i / 2 : half + i / 2 ] = in[i];
+        }
+        uint8_t prev = out.empty() ? 0 : out[0];
+        for( size_t i = 1; i < out.size(); i++ ) {
+            uint8_t cur = out[i];
+            out[i] = uint8_t( int(cur) - int(prev) + (128 + 256) );
+            prev = cur;
         }
     }
+}
+
+Color3f to_sRGB(const Color3f &c) {
+    return linalg::select(
+            linalg::lequal(c, 0.0031308f),
+            c * 12.92f,
+            (1.0f + 0.055f) * linalg::pow(c, 1.0f / 2.4f) - 0.055f);
+}
+
+void Image::save_png(const std::string & filename, float bias, bool dither) const {
+
+    std::vector<uint8_t> image_out(size.x * size.y * 3, 0);
+    to_srgb8(image_out.data(), bias, dither);
 
     int result = stbi_write_png(filename.c_str(), size.x, size.y, 3,
                    image_out.data(),
@@ -35,4 +169,177 @@ void Image::save_png(const std::string & filename, float bias) const {
     if(result == 0) {
         throw std::runtime_error( fmt::format("Error writing to file: {}", filename) );
     }
-}
\ No newline at end of file
+}
+
+void Image::to_srgb8( uint8_t * out, float bias, bool dither ) const {
+    const SRGBTable & table = srgb_table();
+    int n = 3 * size.x;
+    int num_chunks = (size.y + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+
+    parallel_for( num_chunks, [&]( int chunk ) {
+        std::vector<float> row(n);
+        int y_end = std::min( (chunk + 1) * ROWS_PER_TASK, size.y );
+        for( int y = chunk * ROWS_PER_TASK; y < y_end; y++ ) {
+            // Apply the bias and clamp to [0, 1], eight values at a time
+            const float * src = &image_data[ index_1(0, y) ].x;
+            const simd::vfloat8 vbias(bias), zero(0.0f), one(1.0f), largest(std::numeric_limits<float>::max());
+            uint32_t not_finite = 0;
+            int i = 0;
+            for( ; i + simd::WIDTH <= n; i += simd::WIDTH ) {
+                simd::vfloat8 v = simd::vfloat8::loadu(src + i) * vbias;
+                // False for NaN as well as for infinities
+                not_finite |= ~(simd::abs(v) <= largest).bits() & ((1u << simd::WIDTH) - 1);
+                simd::min( simd::max(v, zero), one ).storeu( row.data() + i );
+            }
+            for( ; i < n; i++ ) {
+                float v = src[i] * bias;
+                if( !std::isfinite(v) ) not_finite = 1;
+                row[i] = std::min( std::max(v, 0.0f), 1.0f );
+            }
+
+            uint8_t * dst = out + size_t(y) * n;
+            if( dither ) {
+                for( int x = 0; x < size.x; x++ ) {
+                    float threshold = (BAYER_8X8[y % 8][x % 8] + 0.5f) / 64.0f;
+                    for( int c = 0; c < 3; c++ ) dst[3 * x + c] = table.dither(row[3 * x + c], threshold);
+                }
+            } else {
+                for( i = 0; i < n; i++ ) dst[i] = table.round(row[i]);
+            }
+
+            // Make infinite colors stand out as magenta
+            if( not_finite ) {
+                for( int x = 0; x < size.x; x++ ) {
+                    Color3f c = image_data[ index_1(x, y) ] * bias;
+                    if( !std::isfinite(c.x) || !std::isfinite(c.y) || !std::isfinite(c.z) ) {
+                        dst[3 * x + 0] = 255;
+                        dst[3 * x + 1] = 0;
+                        dst[3 * x + 2] = 255;
+                    }
+                }
+            }
+        }
+    });
+}
+
+void Image::save( const std::string & filename, float bias ) const {
+    std::string ext = extension(filename);
+    if( ext == ".png" ) {
+        save_png(filename, bias);
+    } else if( ext == ".pfm" ) {
+        save_pfm(filename, bias);
+    } else if( ext == ".exr" ) {
+        save_exr(filename, ExrCompression::Zip, bias);
+    } else {
+        throw std::runtime_error( fmt::format("Unknown image format '{}' for file: {}", ext, filename) );
+    }
+}
+
+void Image::save_pfm( const std::string & filename, float bias ) const {
+    std::ofstream out(filename, std::ios::binary);
+    if( !out ) throw std::runtime_error( fmt::format("Error writing to file: {}", filename) );
+
+    // A negative scale marks little-endian data
+    uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<const uint8_t *>(&probe) == 1;
+    out << "PF\n" << size.x << " " << size.y << "\n" << (little_endian ? "-1.0" : "1.0") << "\n";
+
+    // PFM stores the bottom row first, each row is contiguous in image_data
+    std::vector<Color3f> row(size.x);
+    for( int y = size.y - 1; y >= 0; y-- ) {
+        const Color3f * src = &image_data[ index_1(0, y) ];
+        for( int x = 0; x < size.x; x++ ) row[x] = src[x] * bias;
+        out.write( reinterpret_cast<const char *>(row.data()), std::streamsize(row.size() * sizeof(Color3f)) );
+    }
+    if( !out ) throw std::runtime_error( fmt::format("Error writing to file: {}", filename) );
+}
+
+void Image::save_exr( const std::string & filename, ExrCompression compression, float bias ) const {
+    std::ofstream out(filename, std::ios::binary);
+    if( !out ) throw std::runtime_error( fmt::format("Error writing to file: {}", filename) );
+
+    // Magic number and version 2, single part scan line file
+    const uint8_t magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+    out.write( reinterpret_cast<const char *>(magic), sizeof(magic) );
+
+    // Channels in alphabetical order, 32-bit float
+    std::string chlist;
+    for( const char * name : {"B", "G", "R"} ) {
+        chlist.append( name, 2 );
+        const int32_t pixel_type = 2;   // FLOAT
+        const uint8_t linear_reserved[4] = { 0, 0, 0, 0 };
+        const int32_t sampling[2] = { 1, 1 };
+        chlist.append( reinterpret_cast<const char *>(&pixel_type), 4 );
+        chlist.append( reinterpret_cast<const char *>(linear_reserved), 4 );
+        chlist.append( reinterpret_cast<const char *>(sampling), 8 );
+    }
+    chlist.push_back('\0');
+    out.write( "channels", 9 );
+    out.write( "chlist", 7 );
+    write_binary( out, int32_t(chlist.size()) );
+    out.write( chlist.data(), std::streamsize(chlist.size()) );
+
+    struct Box2i { int32_t xmin, ymin, xmax, ymax; } window{ 0, 0, size.x - 1, size.y - 1 };
+    struct V2f { float x, y; } center{ 0.0f, 0.0f };
+    // ZIP compresses blocks of 16 scan lines
+    int lines_per_block = compression == ExrCompression::Zip ? 16 : 1;
+    write_attribute( out, "compression", "compression", uint8_t(compression == ExrCompression::Zip ? 3 : 0) );
+    write_attribute( out, "dataWindow", "box2i", window );
+    write_attribute( out, "displayWindow", "box2i", window );
+    write_attribute( out, "lineOrder", "lineOrder", uint8_t(0) );   // INCREASING_Y
+    write_attribute( out, "pixelAspectRatio", "float", 1.0f );
+    write_attribute( out, "screenWindowCenter", "v2f", center );
+    write_attribute( out, "screenWindowWidth", "float", 1.0f );
+    out.put('\0');
+
+    // The offset table is filled in once the blocks have been written
+    int num_blocks = (size.y + lines_per_block - 1) / lines_per_block;
+    std::streampos table_pos = out.tellp();
+    std::vector<uint64_t> offsets(num_blocks, 0);
+    out.write( reinterpret_cast<const char *>(offsets.data()), std::streamsize(offsets.size() * sizeof(uint64_t)) );
+
+    // Each block holds its scan lines one after the other, and within a line all
+    // the B values, then G, then R
+    std::vector<uint8_t> block, predicted;
+    std::vector<float> line( 3 * size_t(size.x) );
+    for( int b = 0; b < num_blocks; b++ ) {
+        int y0 = b * lines_per_block;
+        int y1 = std::min(y0 + lines_per_block, size.y);
+        block.clear();
+        for( int y = y0; y < y1; y++ ) {
+            const Color3f * src = &image_data[ index_1(0, y) ];
+            for( int x = 0; x < size.x; x++ ) {
+                line[x] = src[x].z * bias;
+                line[size.x + x] = src[x].y * bias;
+                line[2 * size.x + x] = src[x].x * bias;
+            }
+            const uint8_t * bytes = reinterpret_cast<const uint8_t *>(line.data());
+            block.insert( block.end(), bytes, bytes + line.size() * sizeof(float) );
+        }
+
+        const uint8_t * data = block.data();
+        int data_size = int(block.size());
+        unsigned char * compressed = nullptr;
+        if( compression == ExrCompression::Zip ) {
+            exr_zip_predictor( block, predicted );
+            int compressed_size = 0;
+            // stb_image_write's deflate implementation, defined above with STB_IMAGE_WRITE_IMPLEMENTATION
+            compressed = stbi_zlib_compress( predicted.data(), int(predicted.size()), &compressed_size, 8 );
+            // Blocks that do not shrink are stored uncompressed
+            if( compressed && compressed_size < data_size ) {
+                data = compressed;
+                data_size = compressed_size;
+            }
+        }
+
+        offsets[b] = uint64_t( out.tellp() );
+        write_binary( out, int32_t(y0) );
+        write_binary( out, int32_t(data_size) );
+        out.write( reinterpret_cast<const char *>(data), data_size );
+        free(compressed);
+    }
+
+    out.seekp( table_pos );
+    out.write( reinterpret_cast<const char *>(offsets.data()), std::streamsize(offsets.size() * sizeof(uint64_t)) );
+    if( !out ) throw std::runtime_error( fmt::format("Error writing to file: {}", filename) );
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "image.h"
+
+using Vec3d = linalg::vec<double, 3>;
+
+/**
+ * The state of a render in progress: for every pixel, the sum of its samples and
+ * the statistics used by adaptive sampling.  Samples are accumulated in double
+ * precision, so that a render can be built up over many passes (and resumed from
+ * a checkpoint) without losing precision.
+ *
+ * Each pixel sample s uses random streams that depend only on the pixel and s, so
+ * rendering samples [0, a) and then [a, b) gives the same image as rendering
+ * [0, b) at once.
+ *
+ * An accumulator may also hold part of a render, for splitting a frame over
+ * several processes or machines: a rectangular region of the frame, and/or the
+ * samples [first_sample(), samples()) of each pixel.  Such partials are combined
+ * with merge(...).
+ */
+class Accumulator {
+public:
+    /// The samples taken in one pixel so far
+    struct Pixel {
+        Vec3d sum{0, 0, 0};   ///< Sum of the samples
+        uint32_t count = 0;   ///< Number of samples
+        uint32_t done = 0;    ///< Non-zero once adaptive sampling has stopped sampling this pixel
+        double mean = 0.0;    ///< Mean luminance
+        double m2 = 0.0;      ///< Sum of squared differences from the mean luminance (Welford's algorithm)
+
+        void add( const Color3f & c ) {
+            double lum = dot( Vec3d(c), Vec3d{0.2126, 0.7152, 0.0722} );
+            sum += Vec3d(c);
+            count++;
+            double delta = lum - mean;
+            mean += delta / double(count);
+            m2 += delta * (lum - mean);
+        }
+
+        /**
+         * Add the samples of other, which were taken after the samples of this pixel.
+         * The luminance statistics are combined with Chan et al.'s parallel form of
+         * Welford's algorithm.
+         */
+        void merge( const Pixel & other ) {
+            if( other.count == 0 ) return;
+            double n = double(count), m = double(other.count);
+            double delta = other.mean - mean;
+            sum += other.sum;
+            count += other.count;
+            mean += delta * m / (n + m);
+            m2 += other.m2 + delta * delta * n * m / (n + m);
+            done = other.done;
+        }
+
+        /// @returns true if the standard error of the mean luminance is at most threshold times the mean
+        bool converged( float threshold ) const {
+            if( count < 2 ) return false;
+            double variance = m2 / double(count - 1);
+            double t = threshold;
+            return variance / double(count) <= t * t * (mean * mean + 1e-6);
+        }
+    };
+
+    Accumulator() = default;
+    /// An accumulator for the whole of a frame of the given size
+    explicit Accumulator( const Vec2i & size, uint64_t scene_id = 0 ) :
+        Accumulator(size, {0, 0}, size, scene_id) {}
+    /// An accumulator for the pixels [region_min, region_max) of a frame of the given size
+    Accumulator( const Vec2i & frame_size, const Vec2i & region_min, const Vec2i & region_max, uint64_t scene_id = 0 );
+
+    Pixel & operator()( int x, int y ) { return pixels[size_t(y) * size.x + x]; }
+    const Pixel & operator()( int x, int y ) const { return pixels[size_t(y) * size.x + x]; }
+
+    /// Size of the region, operator() takes coordinates relative to the region
+    int width() const { return size.x; }
+    int height() const { return size.y; }
+
+    /// The pixel of the frame at the top left of the region
+    Vec2i region_min() const { return origin; }
+    Vec2i get_frame_size() const { return frame_size; }
+    uint64_t get_scene_id() const { return scene_id; }
+
+    /// One past the index of the last sample rendered so far (converged pixels may have fewer)
+    int samples() const { return next_sample; }
+    void set_samples( int n ) { next_sample = n; }
+
+    /// The index of the first sample this accumulator holds, 0 unless set with start_at_sample(...)
+    int first_sample() const { return start_sample; }
+
+    /// Make this accumulator hold the samples from s on, before anything is rendered into it
+    void start_at_sample( int s ) { start_sample = next_sample = s; }
+
+    /// @returns the image of the mean of the samples in each pixel
+    Image image() const;
+
+    /// @returns an image holding the number of samples taken in each pixel
+    Image spp_map() const;
+
+    /**
+     * Write a checkpoint.  The file is written under a temporary name and then
+     * renamed, so an interrupted write never replaces a good checkpoint.
+     */
+    void save( const std::string & filename ) const;
+
+    /**
+     * Read a checkpoint written by save(...).
+     * @param scene_id must match the id the checkpoint was written with, so that a
+     *                 checkpoint is not resumed with a different scene
+     */
+    static Accumulator load( const std::string & filename, uint64_t scene_id );
+
+    /// Read a checkpoint written by save(...), whatever scene it was written for.
+    static Accumulator load( const std::string & filename );
+
+    /**
+     * Combine partial renders of the same frame into a whole frame.  Every pixel of
+     * the frame must be covered, by a run of partials whose sample ranges follow on
+     * from each other from sample 0 to the same end for all pixels.  Samples are added
+     * in sample order, so the result does not depend on the order of the partials.
+     *
+     * Because the pixel sums are added in a different grouping than in a single
+     * render, they match a single render to within double rounding.  In practice
+     * this gives the identical float image.
+     *
+     * @throws LutertException if the partials are of different scenes or frames,
+     *         overlap or leave gaps
+     */
+    static Accumulator merge( std::vector<Accumulator> partials );
+
+private:
+    Vec2i frame_size{0, 0};  ///< Size of the whole frame
+    Vec2i origin{0, 0};      ///< Position of the region in the frame
+    Vec2i size{0, 0};        ///< Size of the region
+    uint64_t scene_id = 0;   ///< Identifies the scene being rendered, e.g. a hash of its description
+    int start_sample = 0;
+    int next_sample = 0;
+    std::vector<Pixel> pixels;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <limits>
+#include <utility>
+
+#include "common.h"
+#include "ray.h"
+
+/**
+ * An axis-aligned bounding box.  A default constructed box is empty (min > max)
+ * so that it can be grown by calling extend(...).
+ */
+struct Bounds3f {
+    Vec3f min{ std::numeric_limits<float>::infinity() };  ///< Minimum corner
+    Vec3f max{ -std::numeric_limits<float>::infinity() }; ///< Maximum corner
+
+    Bounds3f() = default;
+    Bounds3f( const Vec3f & min, const Vec3f & max ) : min(min), max(max) {}
+
+    /// Grow the box to include the point p
+    void extend( const Vec3f & p ) {
+        min = linalg::min(min, p);
+        max = linalg::max(max, p);
+    }
+
+    /// Grow the box to include the box b
+    void extend( const Bounds3f & b ) {
+        min = linalg::min(min, b.min);
+        max = linalg::max(max, b.max);
+    }
+
+    bool is_empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+    Vec3f centroid() const { return (min + max) * 0.5f; }
+    Vec3f extent() const { return max - min; }
+
+    /// @returns the index of the axis along which the box is largest
+    int max_axis() const {
+        Vec3f e = extent();
+        return e.x > e.y ? (e.x > e.z ? 0 : 2) : (e.y > e.z ? 1 : 2);
+    }
+
+    float surface_area() const {
+        if( is_empty() ) return 0.0f;
+        Vec3f e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    /**
+     * Slab test of a ray segment against this box.
+     *
+     * @param ray the ray, only the origin and [mint, maxt] are used
+     * @param inv_d the component-wise reciprocal of the ray direction
+     * @return true if the segment overlaps the box
+     */
+    bool intersect( const Ray & ray, const Vec3f & inv_d ) const {
+        float t0 = ray.mint, t1 = ray.maxt;
+        for( int i = 0; i < 3; i++ ) {
+            float t_near = (min[i] - ray.o[i]) * inv_d[i];
+            float t_far  = (max[i] - ray.o[i]) * inv_d[i];
+            if( t_near > t_far ) std::swap(t_near, t_far);
+            // Pad the far distance to be conservative with respect to rounding error
+            t_far *= 1.0f + 3.0f * std::numeric_limits<float>::epsilon();
+            // Written so that a NaN (0 * inf) leaves the interval unchanged
+            t0 = t_near > t0 ? t_near : t0;
+            t1 = t_far < t1 ? t_far : t1;
+            if( t0 > t1 ) return false;
+        }
+        return true;
+    }
+};
+
+/// @returns the smallest box containing both a and b
+inline Bounds3f merge( const Bounds3f & a, const Bounds3f & b ) {
+    return { linalg::min(a.min, b.min), linalg::max(a.max, b.max) };
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "surface.h"
+#include "stats.h"
+
+/**
+ * A node in a flattened bounding volume hierarchy.  The first child of an
+ * interior node is stored directly after it in the node array, the index of
+ * the second child is stored in `offset`.  A leaf refers to `count` entries of
+ * the tree's primitive index array starting at `offset`.
+ */
+struct BVHNode {
+    Bounds3f bounds;      ///< Box containing everything below this node
+    uint32_t offset = 0;  ///< Leaf: first primitive index, interior: second child
+    uint16_t count = 0;   ///< Number of primitives in a leaf, 0 for interior nodes
+    uint8_t axis = 0;     ///< Split axis of an interior node
+
+    bool is_leaf() const { return count > 0; }
+};
+
+/**
+ * A bounding volume hierarchy over a list of primitives that are known only by
+ * their bounding boxes.  The tree is built top down, choosing each split with the
+ * surface area heuristic (SAH) evaluated over a fixed number of bins along each axis.
+ * Large subtrees are built in parallel.
+ *
+ * The tree does not know what the primitives are; traverse(...) calls back into
+ * the owner to intersect them.  This is shared by the BVH surface and anything
+ * else that needs a spatial index over its own primitives.
+ */
+class BVHTree {
+public:
+    /**
+     * Build the tree.
+     * @param prim_bounds world-space bounds of each primitive, the index in this
+     *        vector is the primitive index reported to traverse(...)
+     * @param max_leaf_size the maximum number of primitives in a leaf
+     * @param leaf_width the number of primitives the owner tests at the cost of one,
+     *        e.g. simd::WIDTH if a leaf's primitives are tested with SIMD instructions
+     */
+    void build( const std::vector<Bounds3f> & prim_bounds, int max_leaf_size = 4, int leaf_width = 1 );
+
+    /// @returns the bounds of the whole tree
+    Bounds3f bounds() const { return nodes.empty() ? Bounds3f{} : nodes[0].bounds; }
+
+    /**
+     * Visit the primitives in every leaf that the ray segment overlaps, near
+     * to far.  The callback should intersect the primitive and, if it hits, shorten
+     * ray.maxt to the hit distance and return true, so that farther nodes are culled.
+     *
+     * @param ray the ray segment
+     * @param intersect_prim called as intersect_prim(uint32_t primitive_index)
+     * @return true if any call to intersect_prim returned true
+     */
+    template <class F>
+    bool traverse( Ray & ray, F && intersect_prim ) const;
+
+    /**
+     * Visit the primitives in the leaves that the ray segment overlaps until
+     * one of them blocks the segment.  The order of the visits is unspecified.
+     *
+     * @param ray the ray segment
+     * @param occluded_prim called as occluded_prim(uint32_t primitive_index), returns
+     *        true if the primitive blocks the segment
+     * @return true if any call to occluded_prim returned true
+     */
+    template <class F>
+    bool traverse_any( const Ray & ray, F && occluded_prim ) const;
+
+    /**
+     * Packet version of traverse(...).  A node is visited if any active ray in the
+     * packet overlaps it, and children are ordered by the direction of the first
+     * active ray.  The callback should shorten packet.maxt for the lanes it hits.
+     *
+     * @param packet the rays
+     * @param intersect_prim called as intersect_prim(uint32_t primitive_index, uint32_t lanes),
+     *        where lanes is the bitmask of rays that overlap the leaf, and returns the
+     *        bitmask of lanes that hit the primitive
+     * @return the union of the bitmasks returned by intersect_prim
+     */
+    template <class F>
+    uint32_t traverse_packet( RayPacket & packet, F && intersect_prim ) const;
+
+    /**
+     * Versions of traverse(...), traverse_any(...) and traverse_packet(...) that
+     * call back once per leaf instead of once per primitive, for owners that test
+     * all the primitives of a leaf at once.  The callbacks get the range
+     * [first, first + count) of the indices array instead of a primitive index,
+     * and otherwise behave like the per-primitive callbacks.
+     */
+    template <class F>
+    bool traverse_leaves( Ray & ray, F && intersect_leaf ) const;
+    template <class F>
+    bool traverse_any_leaves( const Ray & ray, F && occluded_leaf ) const;
+    template <class F>
+    uint32_t traverse_packet_leaves( RayPacket & packet, F && intersect_leaf ) const;
+
+    /// Write the nodes and indices to a scene cache
+    void save( SceneWriter & out ) const;
+    /**
+     * Read nodes and indices written by save(...), instead of building the tree.
+     * @param num_prims the number of primitives, the indices are checked against it
+     */
+    void load( SceneReader & in, size_t num_prims );
+
+    static constexpr int STACK_SIZE = 128;  ///< Size of the traversal stack, more than the depth of any tree build(...) makes
+
+    std::vector<BVHNode> nodes;     ///< Nodes in depth first order, the root is nodes[0]
+    std::vector<uint32_t> indices;  ///< Primitive indices, each leaf refers to a contiguous range
+};
+
+template <class F>
+bool BVHTree::traverse( Ray & ray, F && intersect_prim ) const {
+    return traverse_leaves( ray, [&]( uint32_t first, uint32_t count ) {
+        bool hit = false;
+        for( uint32_t i = first; i < first + count; i++ ) {
+            if( intersect_prim( indices[i] ) ) hit = true;
+        }
+        return hit;
+    });
+}
+
+template <class F>
+bool BVHTree::traverse_any( const Ray & ray, F && occluded_prim ) const {
+    return traverse_any_leaves( ray, [&]( uint32_t first, uint32_t count ) {
+        for( uint32_t i = first; i < first + count; i++ ) {
+            if( occluded_prim( indices[i] ) ) return true;
+        }
+        return false;
+    });
+}
+
+template <class F>
+uint32_t BVHTree::traverse_packet( RayPacket & packet, F && intersect_prim ) const {
+    return traverse_packet_leaves( packet, [&]( uint32_t first, uint32_t count, uint32_t lanes ) {
+        uint32_t hit = 0;
+        for( uint32_t i = first; i < first + count; i++ ) {
+            hit |= intersect_prim( indices[i], lanes );
+        }
+        return hit;
+    });
+}
+
+template <class F>
+bool BVHTree::traverse_leaves( Ray & ray, F && intersect_leaf ) const {
+    if( nodes.empty() ) return false;
+
+    Vec3f inv_d = Vec3f{1.0f} / ray.d;
+    bool dir_neg[3] = { inv_d.x < 0.0f, inv_d.y < 0.0f, inv_d.z < 0.0f };
+
+    uint32_t stack[STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit = false;
+    // Counted here and added to the thread's statistics once per traversal
+    [[maybe_unused]] uint64_t nodes_visited = 0, tests = 0;
+
+    while( true ) {
+        const BVHNode & node = nodes[current];
+        LUTERT_STAT( nodes_visited++; stats::touch_node(&node) );
+        if( node.bounds.intersect(ray, inv_d) ) {
+            if( node.is_leaf() ) {
+                LUTERT_STAT( tests += node.count );
+                if( intersect_leaf( node.offset, node.count ) ) hit = true;
+            } else {
+                // Visit the child that is nearer along the split axis first
+                if( dir_neg[node.axis] ) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if( stack_size == 0 ) break;
+        current = stack[--stack_size];
+    }
+    LUTERT_STAT( stats::local().add_traversal(nodes_visited, tests) );
+    return hit;
+}
+
+template <class F>
+bool BVHTree::traverse_any_leaves( const Ray & ray, F && occluded_leaf ) const {
+    if( nodes.empty() ) return false;
+
+    Vec3f inv_d = Vec3f{1.0f} / ray.d;
+    uint32_t stack[STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool occluded = false;
+    [[maybe_unused]] uint64_t nodes_visited = 0, tests = 0;
+
+    while( true ) {
+        const BVHNode & node = nodes[current];
+        LUTERT_STAT( nodes_visited++; stats::touch_node(&node) );
+        if( node.bounds.intersect(ray, inv_d) ) {
+            if( node.is_leaf() ) {
+                LUTERT_STAT( tests += node.count );
+                if( occluded_leaf( node.offset, node.count ) ) {
+                    occluded = true;
+                    break;
+                }
+            } else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if( stack_size == 0 ) break;
+        current = stack[--stack_size];
+    }
+    LUTERT_STAT( stats::local().add_traversal(nodes_visited, tests) );
+    return occluded;
+}
+
+template <class F>
+uint32_t BVHTree::traverse_packet_leaves( RayPacket & packet, F && intersect_leaf ) const {
+    if( nodes.empty() || packet.active == 0 ) return 0;
+
+    int lane = simd::first_lane(packet.active);
+    bool dir_neg[3] = { packet.d[0][lane] < 0.0f, packet.d[1][lane] < 0.0f, packet.d[2][lane] < 0.0f };
+
+    uint32_t stack[STACK_SIZE];
+    int stack_size = 0;
+    uint32_t current = 0;
+    uint32_t hit = 0;
+    [[maybe_unused]] uint64_t nodes_visited = 0, tests = 0;
+
+    while( true ) {
+        const BVHNode & node = nodes[current];
+        LUTERT_STAT( nodes_visited++; stats::touch_node(&node) );
+        uint32_t lanes = packet.intersect(node.bounds);
+        if( lanes != 0 ) {
+            if( node.is_leaf() ) {
+                LUTERT_STAT( tests += uint64_t(node.count) * simd::lane_count(lanes) );
+                hit |= intersect_leaf( node.offset, node.count, lanes );
+            } else {
+                if( dir_neg[node.axis] ) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if( stack_size == 0 ) break;
+        current = stack[--stack_size];
+    }
+    LUTERT_STAT( stats::local().add_traversal(nodes_visited, tests) );
+    return hit;
+}
+
+/**
+ * A collection of surfaces stored in a bounding volume hierarchy.  This
+ * is a drop-in replacement for Group: add the surfaces, then call build()
+ * before intersecting.  A ray costs roughly O(log n) intersection tests instead
+ * of testing every surface.
+ */
+class BVH : public Surface {
+
+public:
+    BVH() = default;
+
+    void add( const std::shared_ptr<Surface> & s ) {
+        surfaces.push_back(s);
+    }
+
+    /// Build the hierarchy over the surfaces added so far.
+    void build();
+
+    bool intersect_t( Ray & ray, PrimitiveHit & hit ) const override;
+    uint32_t intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const override;
+    bool occluded( const Ray & ray ) const override;
+    Bounds3f bounds() const override { return tree.bounds(); }
+    void save( SceneWriter & out ) const override;
+    static std::shared_ptr<BVH> load( SceneReader & in );
+
+    const std::vector<std::shared_ptr<Surface>> & get_surfaces() const { return surfaces; }
+
+private:
+    std::vector<std::shared_ptr<Surface>> surfaces;
+    BVHTree tree;
+};
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
+
 #include "common.h"
 class Material;
+class Surface;
 
 /**
  * This struct stores information about a ray-surface intersection.
@@ -11,7 +14,22 @@ struct HitRecord {
     Vec3f p;            ///< The world-space intersection point
     Vec3f gn;           ///< The geometric normal at the intersection point
     Vec3f sn;           ///< The shading normal at the intersection point
-    std::shared_ptr<Material> material; ///< The material of the intersected surface
+    const Material * material = nullptr; ///< The material of the intersected surface (owned by MaterialLib)
+    const Surface * surface = nullptr;   ///< The primitive surface that was hit
 
     HitRecord() = default;
+};
+
+/**
+ * The minimal result of a ray-surface hit test: just enough to identify the
+ * primitive that was hit, so that the full HitRecord can be built later by
+ * Surface::shade(...).
+ */
+struct PrimitiveHit {
+    float t = 0.0f;                     ///< Ray distance for the hit
+    const Surface * surface = nullptr;  ///< The primitive surface that was hit
+    uint32_t prim_id = 0;               ///< Surface-specific primitive id, e.g. a triangle index
+    Vec2f uv{0.0f, 0.0f};               ///< Surface-specific parametric coordinates of the hit
+    /// The primitive within the prototype when surface is an Instance, see Instance::shade(...)
+    const Surface * instanced = nullptr;
 };
\ No newline at end of file
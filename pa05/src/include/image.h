@@ -10,7 +10,9 @@
  * point values (0-1).
  * To write to a pixel in the image, use the overloaded () operator.  Example:
  *    my_image(x,y) = Color3f(1, 0, 1);
- * To write image to a file in PNG format use save_png(...)
+ * To write image to a file in PNG format use save_png(...), for linear float
+ * PFM or OpenEXR use save_pfm(...) or save_exr(...), or save(...) to choose
+ * the format by file extension.
  *
  */
 class Image {
@@ -37,8 +39,49 @@ public:
      * Write this image to a file in PNG format.
      * @param filename output file path
      * @param bias an optional bias to apply (multiply) to each pixel
+     * @param dither use ordered dithering when quantizing to 8 bits, see to_srgb8(...)
      */
-    void save_png(const std::string & filename, float bias = 1.0f) const;
+    void save_png(const std::string & filename, float bias = 1.0f, bool dither = false) const;
+
+    /**
+     * Convert this image to 8-bit sRGB, row by row, with the rows split between
+     * worker threads.  Values are multiplied by bias, clamped to [0, 1] and rounded
+     * to the nearest code, or with dither, rounded up or down following an 8x8
+     * ordered dither pattern.  Pixels with infinite or NaN values become magenta.
+     * @param out width() * height() * 3 bytes, RGB in row-major order
+     * @param bias an optional bias to apply (multiply) to each pixel
+     * @param dither use ordered dithering instead of rounding
+     */
+    void to_srgb8(uint8_t * out, float bias = 1.0f, bool dither = false) const;
+
+    /// Compression of OpenEXR files
+    enum class ExrCompression {
+        None,   ///< Uncompressed scan lines
+        Zip     ///< Blocks of 16 scan lines compressed with zlib
+    };
+
+    /**
+     * Write this image to a file, in the format given by the file name's extension:
+     * .png (8-bit sRGB), .pfm or .exr (linear 32-bit float).
+     * @param filename output file path
+     * @param bias an optional bias to apply (multiply) to each pixel
+     */
+    void save(const std::string & filename, float bias = 1.0f) const;
+
+    /**
+     * Write this image to a file in Portable Float Map format, with linear float values.
+     * @param filename output file path
+     * @param bias an optional bias to apply (multiply) to each pixel
+     */
+    void save_pfm(const std::string & filename, float bias = 1.0f) const;
+
+    /**
+     * Write this image to a scan line OpenEXR file, with linear float values.
+     * @param filename output file path
+     * @param compression ExrCompression::Zip, or ExrCompression::None for no compression
+     * @param bias an optional bias to apply (multiply) to each pixel
+     */
+    void save_exr(const std::string & filename, ExrCompression compression = ExrCompression::Zip, float bias = 1.0f) const;
 
 private:
     std::vector<Color3f> image_data;
@@ -49,10 +92,8 @@ inline Color3f & Image::operator()(int x, int y ) {
     return image_data[index_1(x,y)];
 }
 
-/// Convert from linear RGB to sRGB
-inline Color3f to_sRGB(const Color3f &c) {
-    return linalg::select(
-            linalg::lequal(c, 0.0031308f),
-            c * 12.92f,
-            (1.0f + 0.055f) * linalg::pow(c, 1.0f / 2.4f) - 0.055f);
-}
\ No newline at end of file
+/**
+ * Convert from linear RGB to sRGB.  Defined in image.cpp, which is built without FMA
+ * contraction, so that it rounds the same in every caller as in Image::to_srgb8.
+ */
+Color3f to_sRGB(const Color3f &c);
\ No newline at end of file
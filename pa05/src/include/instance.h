@@ -0,0 +1,41 @@
+#pragma once
+
+#include "surface.h"
+#include "transform.h"
+
+/**
+ * A placement of shared geometry: a prototype surface (usually a BVH built once
+ * for all its instances) seen through the instance's own transform.  Any number of
+ * instances can refer to the same prototype, so memory grows with the unique
+ * geometry rather than with the number of copies.
+ *
+ * A ray is taken into the prototype's space once, at the instance boundary, and
+ * the prototype is intersected there.  The direction is not normalized, so the
+ * ray distances are the same in both spaces.  With the instances in the scene's
+ * BVH and the prototypes' own hierarchies below them, the scene is a two-level BVH.
+ *
+ * Instancing has two levels: a prototype must not contain instances, see
+ * PrimitiveHit::instanced.  Prototypes cannot contain area lights either, since
+ * only top-level surfaces are sampled as lights.
+ */
+class Instance : public Surface {
+
+public:
+    Instance( std::shared_ptr<const Surface> prototype, const Transform & t );
+
+    bool intersect_t( Ray & ray, PrimitiveHit & hit ) const override;
+    uint32_t intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const override;
+    bool occluded( const Ray & ray ) const override;
+    HitRecord shade( const Ray & ray, const PrimitiveHit & hit ) const override;
+    Bounds3f bounds() const override { return world_bounds; }
+
+    void save( SceneWriter & out ) const override;
+    static std::shared_ptr<Instance> load( SceneReader & in );
+
+    const std::shared_ptr<const Surface> & get_prototype() const { return prototype; }
+
+private:
+    std::shared_ptr<const Surface> prototype;
+    Transform xform;       ///< From prototype space to world space
+    Bounds3f world_bounds; ///< The prototype's bounds, transformed
+};
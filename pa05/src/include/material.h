@@ -3,6 +3,7 @@
 #include "common.h"
 #include "hitrecord.h"
 #include "json.h"
+#include "random.h"
 
 class Ray;
 
@@ -18,26 +19,63 @@ struct ScatterInfo {
 
 /**
  * Base class for materials.
+ *
+ * The material types are a closed set, so instead of virtual functions each
+ * material carries a Type tag, and the functions below switch on it and call the
+ * concrete type's function directly.  The switch is inline, so the trivial cases
+ * (is_emissive(), is_specular(), emitted(...)) compile down to a test of the tag,
+ * and the others to a direct call instead of an indirect one through a vtable.
+ * The concrete types hide these functions with their own, which are not virtual, so
+ * code that knows the type calls them without any dispatch at all.
+ *
+ * MaterialLib stores the materials of each type together, see materiallib.h.
+ * Adding a material type means adding it to Type and to each switch.
  */
 class Material {
 public:
-    virtual ~Material() = default;
+    enum class Type : uint8_t { Lambertian, Metal, Dielectric, Light };
+
+    Type get_type() const { return type; }
 
     /**
      * Compute the scattered direction at a given hitpoint.
      *
      * @param r the incoming ray
      * @param hit information about the intersection
+     * @param sampler source of random numbers for the current path
      * @return true if the light is scattered
      */
-    virtual std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit ) const {
-        return {};
-    }
+    inline std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const;
+
+    /**
+     * Evaluate the scattering function for a given direction, for light sampling.
+     * This is the BSDF times the cosine of the angle between dir and the normal,
+     * so that eval(...) / pdf(...) is the attenuation that scatter(...) would return
+     * for that direction.
+     *
+     * @param r the incoming ray
+     * @param hit information about the intersection
+     * @param dir the (normalized) scattered direction
+     */
+    inline Color3f eval( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const;
+
+    /**
+     * @param dir a normalized direction
+     * @returns the solid angle density with which scatter(...) chooses dir
+     */
+    inline float pdf( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const;
+
+    /**
+     * @returns true if scatter(...) chooses directions that cannot be reached by
+     *          light sampling, such as mirror reflection or refraction.  eval(...) and
+     *          pdf(...) are not used for such materials.
+     */
+    bool is_specular() const { return type == Type::Metal || type == Type::Dielectric; }
 
     /**
      * @returns whether this material emits light
     */
-    virtual bool is_emissive() const { return false; }
+    bool is_emissive() const { return type == Type::Light; }
 
     /**
      * Returns the color emitted by this material, if it is emissive.
@@ -45,28 +83,40 @@ public:
      * @param ray the Ray that intersected the surface
      * @param hit information about the intersection
     */
-    virtual Color3f emitted(const Ray & ray, const HitRecord & hit ) const { return {0,0,0}; }
+    inline Color3f emitted( const Ray & ray, const HitRecord & hit ) const;
+
+protected:
+    explicit Material( Type type ) : type(type) {}
+
+private:
+    Type type;
 };
 
 class Lambertian : public Material {
 public:
-    explicit Lambertian( const json & j = json::object() ) {
+    static constexpr Type TYPE = Type::Lambertian;  ///< The tag of this class
+
+    explicit Lambertian( const json & j = json::object() ) : Material(TYPE) {
         albedo = j.value("albedo", albedo);
     }
 
-    std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit ) const override;
+    std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const;
+    Color3f eval( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const;
+    float pdf( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const;
 
     Vec3f albedo = Vec3f{1,1,1}; ///< Base reflective color (fraction of reflected light)
 };
 
 class Metal : public Material {
 public:
-    explicit Metal( const json &j = json::object() ) {
+    static constexpr Type TYPE = Type::Metal;  ///< The tag of this class
+
+    explicit Metal( const json &j = json::object() ) : Material(TYPE) {
         albedo = j.value("albedo", albedo);
         roughness = j.value("roughness", roughness);
     }
 
-    std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit ) const override;
+    std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const;
 
     Vec3f albedo = Vec3f{1,1,1}; ///< Base reflective color (fraction of reflected light)
     float roughness = 0.0;       ///< Surface roughness
@@ -74,23 +124,25 @@ public:
 
 class Dielectric : public Material {
 public:
-    explicit Dielectric( const json &j = json::object() ) {
+    static constexpr Type TYPE = Type::Dielectric;  ///< The tag of this class
+
+    explicit Dielectric( const json &j = json::object() ) : Material(TYPE) {
         ior = j.value("ior", ior);
     }
 
-    std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit ) const override;
+    std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const;
 
     float ior = 1.0f;   ///< Index of refraction
 };
 
 class Light : public Material {
 public:
-    explicit Light( const json & j = json::object() ) {
+    static constexpr Type TYPE = Type::Light;  ///< The tag of this class
+
+    explicit Light( const json & j = json::object() ) : Material(TYPE) {
         power = j.value("power", power);
     }
 
-    bool is_emissive() const { return true; }
-    
     Color3f emitted(const Ray & ray, const HitRecord & hit) const {
         // Only emit from the outward facing side
         if( dot(ray.d, hit.sn) < 0 ) return power;
@@ -98,4 +150,29 @@ public:
     }
 
     Color3f power = {1,1,1};
-};
\ No newline at end of file
+};
+
+std::optional<ScatterInfo> Material::scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const {
+    switch( type ) {
+        case Type::Lambertian: return static_cast<const Lambertian *>(this)->scatter(r, hit, sampler);
+        case Type::Metal: return static_cast<const Metal *>(this)->scatter(r, hit, sampler);
+        case Type::Dielectric: return static_cast<const Dielectric *>(this)->scatter(r, hit, sampler);
+        case Type::Light: break;
+    }
+    return {};
+}
+
+Color3f Material::eval( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const {
+    if( type == Type::Lambertian ) return static_cast<const Lambertian *>(this)->eval(r, hit, dir);
+    return {0,0,0};
+}
+
+float Material::pdf( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const {
+    if( type == Type::Lambertian ) return static_cast<const Lambertian *>(this)->pdf(r, hit, dir);
+    return 0.0f;
+}
+
+Color3f Material::emitted( const Ray & ray, const HitRecord & hit ) const {
+    if( type == Type::Light ) return static_cast<const Light *>(this)->emitted(ray, hit);
+    return {0,0,0};
+}
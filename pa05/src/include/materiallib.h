@@ -4,9 +4,22 @@
 #include "json.h"
 
 /**
- * Library of materials indexed by name
+ * Library of materials indexed by name.  The library owns every material it
+ * loads, stored together with the other materials of its type, and they live
+ * until the program exits.  Surfaces and hit records refer
+ * to them with plain pointers, so intersecting a ray never touches a reference count.
  */
 namespace MaterialLib {
     void load(const json & j = json::object());
-    std::shared_ptr<Material> find( const std::string & name );
-};
\ No newline at end of file
+    const Material * find( const std::string & name );
+
+    /// @returns the name material was loaded with
+    std::string name_of( const Material * material );
+
+    /**
+     * Forget the names of the loaded materials, so that another scene with the same
+     * material names can be loaded in the same process.  The materials themselves
+     * stay alive, since surfaces of earlier scenes may still point to them.
+     */
+    void clear_names();
+};
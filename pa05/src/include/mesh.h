@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "surface.h"
+#include "transform.h"
+#include "json.h"
+#include "bvh.h"
+
+/**
+ * Flat vertex and index arrays for a triangle mesh.  Positions and normals
+ * are stored in world space.  Triangle i uses the vertices at indices[3*i],
+ * indices[3*i+1] and indices[3*i+2].
+ */
+struct MeshData {
+    std::vector<Vec3f> positions;   ///< Vertex positions
+    std::vector<Vec3f> normals;     ///< Vertex normals, empty if the mesh has none
+    std::vector<uint32_t> indices;  ///< Three vertex indices per triangle
+
+    size_t num_triangles() const { return indices.size() / 3; }
+};
+
+/**
+ * A triangle mesh.  All triangles share one set of flat arrays (there is no
+ * Surface object per triangle), and the mesh has its own internal BVH over the
+ * triangles.
+ *
+ * Triangles are intersected with the watertight algorithm from Woop, Benthin and
+ * Wald, "Watertight Ray/Triangle Intersection" (JCGT 2013), so rays cannot slip
+ * through the shared edges between neighbouring triangles.
+ */
+class Mesh : public Surface {
+
+public:
+    /**
+     * @param data the triangles, in world space
+     * @param material the material used by all triangles
+     */
+    explicit Mesh( std::shared_ptr<const MeshData> data, const Material * material = nullptr );
+    explicit Mesh( const json & j );
+
+    /**
+     * Load a Wavefront OBJ file.  Polygons are triangulated, and positions and
+     * normals are transformed to world space by t.
+     */
+    static std::shared_ptr<MeshData> load_obj( const std::string & filename, const Transform & t = Transform() );
+
+    /// Records the triangle index in hit.prim_id and the barycentric coordinates of p1 and p2 in hit.uv
+    bool intersect_t( Ray & ray, PrimitiveHit & hit ) const override;
+    uint32_t intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const override;
+    bool occluded( const Ray & ray ) const override;
+    HitRecord shade( const Ray & ray, const PrimitiveHit & hit ) const override;
+    Bounds3f bounds() const override { return tree.bounds(); }
+    void save( SceneWriter & out ) const override;
+    static std::shared_ptr<Mesh> load( SceneReader & in );
+
+    size_t num_triangles() const { return data->num_triangles(); }
+
+private:
+    Mesh() = default;
+    void build();
+
+    std::shared_ptr<const MeshData> data;
+    const Material * material = nullptr;  ///< Not owned, see MaterialLib
+    BVHTree tree;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "ray.h"
+#include "bounds.h"
+#include "simd.h"
+
+constexpr int PACKET_SIZE = simd::WIDTH;   ///< Number of rays in a RayPacket
+
+/**
+ * A group of rays that are traced together, stored as a structure of arrays so
+ * that one SIMD instruction works on the same component of every ray.  Lanes
+ * whose bit is clear in `active` are ignored (e.g. pixels past the edge of a tile).
+ *
+ * Packets pay off for coherent rays, such as camera rays through neighbouring
+ * pixels, which visit nearly the same BVH nodes and primitives.
+ */
+struct alignas(32) RayPacket {
+    float o[3][PACKET_SIZE];      ///< Origins, o[axis][lane]
+    float d[3][PACKET_SIZE];      ///< Directions, d[axis][lane]
+    float inv_d[3][PACKET_SIZE];  ///< Component-wise reciprocal of the directions
+    float mint[PACKET_SIZE];      ///< Minimum distance along each ray
+    float maxt[PACKET_SIZE];      ///< Maximum distance along each ray, narrowed by hits
+    uint32_t active = 0;          ///< Bit i is set if lane i holds a ray
+
+    /// Store ray in the given lane and mark the lane active
+    void set( int lane, const Ray & ray ) {
+        for( int i = 0; i < 3; i++ ) {
+            o[i][lane] = ray.o[i];
+            d[i][lane] = ray.d[i];
+            inv_d[i][lane] = 1.0f / ray.d[i];
+        }
+        mint[lane] = ray.mint;
+        maxt[lane] = ray.maxt;
+        active |= 1u << lane;
+    }
+
+    /// @returns the ray in the given lane
+    Ray get( int lane ) const {
+        return { Vec3f{o[0][lane], o[1][lane], o[2][lane]},
+                 Vec3f{d[0][lane], d[1][lane], d[2][lane]},
+                 mint[lane], maxt[lane] };
+    }
+
+    /// @returns the bitmask of the active lanes whose ray segment overlaps the box
+    uint32_t intersect( const Bounds3f & b ) const {
+        using simd::vfloat8;
+        vfloat8 t0 = vfloat8::load(mint), t1 = vfloat8::load(maxt);
+        const vfloat8 pad( 1.0f + 3.0f * std::numeric_limits<float>::epsilon() );
+        for( int i = 0; i < 3; i++ ) {
+            vfloat8 oi = vfloat8::load(o[i]), inv = vfloat8::load(inv_d[i]);
+            vfloat8 ta = (vfloat8(b.min[i]) - oi) * inv;
+            vfloat8 tb = (vfloat8(b.max[i]) - oi) * inv;
+            simd::vmask8 swap = ta > tb;
+            vfloat8 t_near = simd::select(swap, tb, ta);
+            vfloat8 t_far = simd::select(swap, ta, tb) * pad;
+            // Same NaN behaviour as Bounds3f::intersect: a NaN leaves the interval unchanged
+            t0 = simd::select(t_near > t0, t_near, t0);
+            t1 = simd::select(t_far < t1, t_far, t1);
+        }
+        return (t0 <= t1).bits() & active;
+    }
+};
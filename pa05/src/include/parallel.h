@@ -0,0 +1,25 @@
+#pragma once
+
+#include <functional>
+
+/**
+ * @returns the number of worker threads to use when the user does not specify one.
+ */
+int default_thread_count();
+
+/**
+ * Call func(i) for each i in [0, count) using a pool of worker threads.
+ *
+ * The work items are dealt round-robin into one queue per worker.  Each worker
+ * takes items from the front of its own queue, and when that runs dry it steals
+ * from the back of another worker's queue, so uneven work (e.g. image tiles that
+ * contain expensive glass objects) stays balanced across threads.
+ *
+ * If any call throws, the remaining items are abandoned and the first exception
+ * is rethrown on the calling thread.
+ *
+ * @param count the number of work items
+ * @param func the function to call for each item
+ * @param num_threads the number of threads to use, if <= 0 default_thread_count() is used
+ */
+void parallel_for( int count, const std::function<void(int)> & func, int num_threads = 0 );
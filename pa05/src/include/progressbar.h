@@ -2,6 +2,8 @@
 
 #include <thread>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 /**
  * A convenient way to create and display a progress bar in the console.
@@ -25,6 +27,12 @@ public:
 
     void set_done() {
         current_count = target_count;
+        {
+            // Wake the worker thread, so that finishing does not wait for its next update
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        wake.notify_all();
         if( worker_thread.joinable() ) worker_thread.join();
     }
 
@@ -36,4 +44,7 @@ private:
     std::thread worker_thread;
     uint64_t target_count;
     std::atomic_uint64_t current_count;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool done = false;   ///< Set by set_done(), guarded by mutex
 };
\ No newline at end of file
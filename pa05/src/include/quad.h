@@ -6,19 +6,44 @@
 
 /**
  * A quad defined in the x-y plane, centered at the origin with size defined by size.x and size.y.
+ *
+ * The rows of the inverse matrix and the world-space normal are cached at
+ * construction, so a ray is tested directly in world space: the local x, y and z
+ * coordinates it needs are each a single dot product.
  */
 class Quad : public Surface {
 
 public:
     explicit Quad(Vec2f size = {1,1}, const Transform & t = Transform(),
-                    const std::shared_ptr<Material> & material = nullptr) :
-            size(size), xform(t), material(material) {}
+                    const Material * material = nullptr) :
+            size(size), xform(t), material(material) { init(); }
     explicit Quad( const json & j );
 
-    std::optional<HitRecord> intersect(Ray &ray) const override;
+    bool intersect_t(Ray &ray, PrimitiveHit &hit) const override;
+    uint32_t intersect_packet(RayPacket &packet, PrimitiveHit *hits) const override;
+    bool occluded(const Ray &ray) const override;
+    HitRecord shade(const Ray &ray, const PrimitiveHit &hit) const override;
+    Bounds3f bounds() const override;
+
+    void save(SceneWriter &out) const override;
+    static std::shared_ptr<Quad> load(SceneReader &in);
+
+    bool is_area_light() const override;
+    AreaSample sample_area(const Vec2f &u) const override;
+    float pdf_area(const Vec3f &p) const override;
 
 private:
+    /// Precompute the world-space form of the quad from xform
+    void init();
+
+    /// Intersect the ray with the quad, giving the ray distance t and the local coordinates xy of the hit
+    bool hit_local(const Ray &ray, float &t, Vec2f &xy) const;
+
     Vec2f size = {1.0f, 1.0f};
     Transform xform;
-    std::shared_ptr<Material> material = nullptr;
+    const Material * material = nullptr;  ///< Not owned, see MaterialLib
+
+    Vec4f inv_rows[3];  ///< Rows of the inverse matrix, local coordinate i = dot(inv_rows[i], (p, 1))
+    Vec3f normal;       ///< World-space normal
+    float inv_area = 1.0f;  ///< One over the world-space area
 };
\ No newline at end of file
@@ -4,23 +4,77 @@
 #include "common.h"
 
 /**
- * @returns the next random float in the range [0, 1)
-*/
-inline float next_float() {
-    // Using a constant seed, change these to get a different RNG stream
-    static pcg32 rng{42u, 54u};
-    return rng.nextFloat();
-}
+ * Source of random numbers for a single camera path.
+ *
+ * Every (pixel, sample, bounce) triple selects its own random stream, so the
+ * numbers a path sees do not depend on which thread traces it or on the order
+ * in which pixels are rendered.  There is no shared state, so each thread can
+ * own its samplers without any locking.
+ *
+ * Usage: construct one Sampler per pixel sample, and call start_bounce(depth)
+ * before drawing the random numbers for each bounce along the path.
+ */
+class Sampler {
+public:
+    /**
+     * @param pixel the linear index of the pixel being rendered
+     * @param sample the index of the sample within the pixel
+     */
+    explicit Sampler( uint64_t pixel = 0, uint32_t sample = 0 ) : pixel(pixel), sample(sample) {
+        start_bounce(0);
+    }
+
+    /**
+     * Restart the random stream for the given bounce of the current path.
+     * @param bounce the path depth (0 for the camera ray)
+     */
+    void start_bounce( int bounce ) {
+        uint64_t key = mix( mix( pixel ) ^ ( uint64_t(sample) << 32 | uint32_t(bounce) ) );
+        rng.seed( key, pixel );
+    }
+
+    /**
+     * @returns the next random float in the range [0, 1)
+     */
+    float next_float() { return rng.nextFloat(); }
+
+    /**
+     * @returns a pair of random floats in the range [0, 1)
+     */
+    Vec2f next_2d() {
+        float x = rng.nextFloat();
+        return {x, rng.nextFloat()};
+    }
+
+private:
+    /// SplitMix64 finalizer, used to scramble the stream key
+    static uint64_t mix( uint64_t z ) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    pcg32 rng;
+    uint64_t pixel;
+    uint32_t sample;
+};
 
 /**
- * @returns a random point on the unit sphere centered at the origin.
+ * Map a point in [0,1)^2 to the unit sphere centered at the origin, uniformly by area.
 */
-inline Vec3f random_on_unit_sphere() {
-    float z1 = next_float();
-    float z2 = next_float();
+inline Vec3f square_to_unit_sphere( const Vec2f & u ) {
+    float z1 = u.x;
+    float z2 = u.y;
 
     float z = 1 - 2 * z1;
     float r = sqrtf(std::max( 0.f, 1.f - z * z) );
     float phi = 2 * M_PI * z2;
-    return {r * std::cosf(phi), r * std::sinf(phi), z};
-}
\ No newline at end of file
+    return {r * std::cos(phi), r * std::sin(phi), z};
+}
+
+/**
+ * @returns a random point on the unit sphere centered at the origin.
+*/
+inline Vec3f random_on_unit_sphere( Sampler & sampler ) {
+    return square_to_unit_sphere( sampler.next_2d() );
+}
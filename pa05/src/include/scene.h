@@ -1,24 +1,188 @@
 #pragma once
 
+#include <functional>
+#include <map>
 #include <memory>
+#include <string>
 
 #include "surface.h"
 #include "camera.h"
 #include "image.h"
+#include "accumulator.h"
+#include "random.h"
+
+class BVH;
+
+/**
+ * How the color of a camera path is computed.
+ */
+enum class Integrator {
+    Recursive,  ///< recursive_color(...): recurse until the path is absorbed or reaches MAX_DEPTH
+    Path,       ///< path_color(...): iterative, with Russian roulette termination after rr_depth bounces
+                ///< and optionally next-event estimation
+    Wavefront   ///< The Path estimate, computed for a batch of paths at a time, see render_tile_wavefront(...)
+};
 
 class Scene {
 public:
     Scene() = default;
     explicit Scene( const json & j ) { parse_scene(j); }
-    Image render() const;
+
+    /**
+     * Write the scene to a binary scene cache, see scene_cache.h.
+     * @param j the description the scene was made from
+     * @param scene_id identifies the description, it is stored for load_cache(...)
+     */
+    void save_cache( const std::string & filename, const json & j, uint64_t scene_id ) const;
+
+    /**
+     * Load a scene written by save_cache(...), which needs no JSON parsing or BVH
+     * building.  The materials are added to MaterialLib.
+     * @param scene_id if not null, set to the id the cache was written with
+     */
+    static Scene load_cache( const std::string & filename, uint64_t * scene_id = nullptr );
+    /**
+     * Render the scene.  The image is split into square tiles that are
+     * distributed over a pool of worker threads.  Within a tile, the camera rays
+     * of each block of PACKET_W x PACKET_H pixels are traced as one RayPacket.
+     *
+     * With adaptive sampling, each pixel takes at least min_samples samples and then
+     * stops once the standard error of its mean luminance falls below
+     * adaptive_threshold times the mean, or after num_samples samples.
+     *
+     * @param num_threads number of worker threads, if <= 0 one per hardware thread is used
+     * @param spp_map if not null, set to an image holding the number of samples taken in each pixel
+     * @return the rendered image
+     */
+    Image render( int num_threads = 0, Image * spp_map = nullptr ) const;
+
+    /**
+     * Render samples [acc.samples(), end_sample) of every pixel into acc, which lets
+     * a render be split into passes over the whole frame.  Pixels that adaptive
+     * sampling has already stopped are skipped.  Afterwards acc.samples() is
+     * end_sample (at most num_samples).
+     *
+     * Only the pixels of acc's region are rendered.  With adaptive sampling, acc must
+     * hold the samples of its pixels from the first, see Accumulator::first_sample().
+     *
+     * @param acc the render so far, its frame size must match the camera resolution
+     * @param end_sample one past the last sample index to render
+     * @param num_threads number of worker threads, if <= 0 one per hardware thread is used
+     */
+    void render_samples( Accumulator & acc, int end_sample, int num_threads = 0 ) const;
+
+    /**
+     * Render samples [acc.samples(), end_sample) like render_samples(...), in passes of
+     * pass_samples samples.  The last pass stops at end_sample, so that a render of a
+     * range of samples never takes samples beyond the range.
+     *
+     * @param after_pass if set, called after every pass but the last, e.g. to write a checkpoint
+     */
+    void render_passes( Accumulator & acc, int end_sample, int pass_samples, int num_threads,
+                        const std::function<void( const Accumulator & )> & after_pass = {} ) const;
     int samples() { return num_samples; }
+    bool is_adaptive() const { return min_samples > 0; }
+
+    const Camera & get_camera() const { return *camera; }
+    const Surface & get_surfaces() const { return *surfaces; }
 
 private:
+    static constexpr int TILE_SIZE = 16; ///< Width and height of a render tile in pixels
+    static constexpr int PACKET_W = 4;   ///< Width of the pixel block traced as one packet
+    static constexpr int PACKET_H = PACKET_SIZE / PACKET_W;  ///< Height of the pixel block
+    static constexpr int MAX_DEPTH = 64;  ///< Maximum number of bounces along a path
+    static constexpr size_t MIN_SPHERE_SET_SIZE = 8;  ///< Fewer world-space spheres than this stay separate Spheres
+    static constexpr int ADAPTIVE_INTERVAL = 8;  ///< With adaptive sampling, pixels are tested for convergence after every this many samples
+    static constexpr size_t WAVE_SIZE = 4 * TILE_SIZE * TILE_SIZE;  ///< Paths the wavefront integrator traces together: four samples of each pixel of the one tile a wave covers
+
     void parse_scene( const json & j );
-    Color3f recursive_color( Ray & ray, int depth ) const;
+    /**
+     * Parse a list of surfaces into a BVH, gathering world-space spheres into a SphereSet.
+     * @param prototypes the prototypes that instances may refer to, or null where
+     *        instances are not allowed
+     */
+    static std::shared_ptr<BVH> parse_surfaces( const json & jsurfaces,
+                                                const std::map<std::string, std::shared_ptr<const Surface>> * prototypes );
+    /// Everything but the surfaces: camera, sampling and integrator settings, materials
+    void parse_settings( const json & j );
+    /// Use bvh as the scene's surfaces, and take its top-level area lights as the lights
+    void set_surfaces( const std::shared_ptr<BVH> & bvh );
+    Color3f recursive_color( Ray & ray, int depth, Sampler & sampler ) const;
+    /// The color of a path that has hit the scene at hit, computed with the scene's integrator
+    Color3f hit_color( const Ray & ray, const HitRecord & hit, int depth, Sampler & sampler ) const;
+    /// The recursive integrator, continues the path from hit
+    Color3f recursive_hit_color( const Ray & ray, const HitRecord & hit, int depth, Sampler & sampler ) const;
+    /**
+     * The iterative path tracing integrator.  The path is followed in a loop that
+     * carries the product of the attenuations so far (the throughput) and the
+     * radiance gathered so far.  After rr_depth bounces, a path survives each further
+     * bounce with probability equal to its largest throughput component (at most
+     * 0.95), and survivors are scaled up to keep the estimate unbiased.
+     *
+     * With next-event estimation (nee), each non-specular hit also samples a point on
+     * one of the lights and traces a shadow ray to it.  Light found this way and
+     * light found by a scattered ray are combined with multiple importance sampling
+     * (the power heuristic), so neither strategy's noise dominates.
+     */
+    Color3f path_color( const Ray & ray, const HitRecord & hit, int depth, Sampler & sampler ) const;
+
+    /**
+     * The wavefront integrator: render samples [first_sample, end_sample) of the
+     * pixels of a tile that adaptive sampling has not stopped.
+     *
+     * Instead of following one path to its end before starting the next, the paths of
+     * many pixel samples (up to WAVE_SIZE) advance together one bounce at a time, each
+     * stage running over the whole batch: trace the rays, add the emitted light at the
+     * hits, sort the hits by material type, scatter each material's queue with direct
+     * calls to that material's code, trace the shadow rays, then trace the scattered
+     * rays.  The path state is kept in arrays indexed by path.
+     *
+     * Each path consumes its random numbers and sums its radiance in the same order
+     * as path_color(...), so the image is the same as with the Path integrator.
+     *
+     * With sort_rays, the scattered rays of each bounce are traced in the order of a
+     * key made of their direction octant, then a Morton code of the origin within
+     * the scene bounds, then a Morton code of the direction, so that consecutive
+     * rays tend to visit the same BVH nodes.  The order does not change the image.
+     * This is experimental: on the scenes measured so far the BVHs fit in the cache
+     * and sorting only adds work, so it is off by default.
+     */
+    void render_tile_wavefront( Accumulator & acc, const Vec2i & tile_min, const Vec2i & tile_max,
+                                int first_sample, int end_sample ) const;
+
+    /// The light emitted at hit towards the start of ray, weighted for MIS if the previous bounce sampled the lights
+    Color3f emitted_light( const Ray & ray, const HitRecord & hit, float scatter_pdf ) const;
+
+    /**
+     * Next-event estimation: the light arriving at hit directly from a randomly
+     * chosen point on a light, times the scattering function, weighted for MIS.
+     */
+    Color3f sample_lights( const Ray & ray, const HitRecord & hit, Sampler & sampler ) const;
+
+    /**
+     * The part of sample_lights(...) before the shadow ray: choose the point on a light.
+     * @param shadow_ray set to the segment from hit to the light
+     * @param contribution set to the result of sample_lights(...) if the segment is not occluded
+     * @return false if the light contributes nothing, whether occluded or not
+     */
+    bool sample_light_ray( const Ray & ray, const HitRecord & hit, Sampler & sampler,
+                           Ray & shadow_ray, Color3f & contribution ) const;
+
+    /**
+     * @returns the solid angle density with which sample_lights(...) would choose the
+     *          direction of ray, which starts at the shading point and hits the light at light_hit
+     */
+    float light_pdf( const Ray & ray, const HitRecord & light_hit ) const;
 
-    std::shared_ptr<Group> surfaces;
+    std::shared_ptr<Surface> surfaces;
     std::shared_ptr<Camera> camera;
-    int num_samples = 1;
+    int num_samples = 1;      ///< Samples per pixel, or the maximum per pixel with adaptive sampling
+    int min_samples = 0;      ///< Adaptive sampling: samples taken before a pixel may stop, 0 for no adaptive sampling
+    float adaptive_threshold = 0.01f;  ///< Adaptive sampling: relative standard error at which a pixel stops
     Color3f background = {0,0,0};
+    Integrator integrator = Integrator::Recursive;
+    int rr_depth = 5;  ///< Number of bounces before Russian roulette starts (Path integrator only)
+    bool nee = true;   ///< Use next-event estimation (Path integrator only)
+    bool sort_rays = false;  ///< Sort the scattered rays of each bounce by octant, origin and direction (experimental, Wavefront integrator only)
+    std::vector<const Surface *> lights;  ///< Emissive surfaces that can be sampled, owned by surfaces
 };
\ No newline at end of file
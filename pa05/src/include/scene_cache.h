@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "common.h"
+
+class Material;
+class Surface;
+
+/**
+ * The binary scene cache: a scene in a form that loads without parsing JSON or
+ * building acceleration structures.  The file holds
+ *
+ *  - a header: magic, version, a layout check and the scene id (see SceneCache::Header),
+ *  - the files the scene was made from besides its JSON file (e.g. OBJ meshes),
+ *  - the scene description without its surfaces, as JSON text (camera, settings
+ *    and materials, which are small),
+ *  - the surfaces, flattened: each is a SurfaceTag followed by its arrays, including
+ *    the nodes of its prebuilt BVHTree.  The prototype of instances is written once,
+ *    at its first instance, and referred to by number after that.
+ *
+ * Everything is in native byte order, so a cache is only read on the kind of machine
+ * that wrote it.  Materials are referred to by name in MaterialLib.
+ *
+ * The file is memory mapped for reading, and the arrays are copied straight from
+ * the mapping into the surfaces.
+ */
+namespace SceneCache {
+    constexpr uint32_t VERSION = 1;
+
+    /// Identifies the type of each surface in the file
+    enum SurfaceTag : uint32_t { SPHERE = 1, QUAD, MESH, SPHERE_SET, BVH, INSTANCE };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t node_size;   ///< sizeof(BVHNode), guards against reading a cache written by a different build
+        uint64_t scene_id;    ///< Identifies the scene description, as used for checkpoints
+    };
+
+    /**
+     * @returns true if cache_file is a readable cache, written after json_file and
+     *          after every other file the scene was made from
+     */
+    bool is_fresh( const std::string & cache_file, const std::string & json_file );
+
+    /// @returns the name of the cache file for a scene file, e.g. scenes/box.lsc for scenes/box.json
+    std::string cache_name( const std::string & json_file );
+}
+
+/**
+ * Writes a scene cache.  The file is written under a temporary name and renamed
+ * by finish(), so an interrupted write never leaves a truncated cache behind.
+ */
+class SceneWriter {
+public:
+    explicit SceneWriter( const std::string & filename );
+
+    /// Write a trivially copyable value
+    template <class T>
+    void write( const T & value ) {
+        static_assert( std::is_trivially_copyable_v<T> );
+        out.write( reinterpret_cast<const char *>(&value), sizeof(T) );
+    }
+
+    /// Write the size of a vector, then its elements
+    template <class T>
+    void write_vector( const std::vector<T> & values ) {
+        static_assert( std::is_trivially_copyable_v<T> );
+        write( uint64_t(values.size()) );
+        out.write( reinterpret_cast<const char *>(values.data()), std::streamsize(values.size() * sizeof(T)) );
+    }
+
+    void write_string( const std::string & s );
+
+    /// Write a reference to a material of MaterialLib, by name
+    void write_material( const Material * material );
+
+    /// Write the header and the list of files the scene was made from
+    void write_header( uint64_t scene_id, const std::vector<std::string> & dependencies );
+
+    /// Write a surface with its tag, see Surface::save(...)
+    void write_surface( const Surface & surface );
+
+    /**
+     * Write a surface that may be shared, such as the prototype of instances: the
+     * first time it is written in full, after that only its number.
+     */
+    void write_shared_surface( const Surface & surface );
+
+    /// Close the file and move it into place
+    void finish();
+
+private:
+    std::string filename, temp_name;
+    std::ofstream out;
+    std::map<const Surface *, uint32_t> shared_ids;  ///< Numbers of the shared surfaces written so far
+};
+
+/**
+ * Reads a scene cache from a memory mapping of the file.  Reading past the end of
+ * the file throws a LutertException.
+ */
+class SceneReader {
+public:
+    explicit SceneReader( const std::string & filename );
+    ~SceneReader();
+    SceneReader( const SceneReader & ) = delete;
+    SceneReader & operator=( const SceneReader & ) = delete;
+
+    template <class T>
+    T read() {
+        static_assert( std::is_trivially_copyable_v<T> );
+        T value;
+        std::memcpy( &value, take(sizeof(T)), sizeof(T) );
+        return value;
+    }
+
+    template <class T>
+    std::vector<T> read_vector() {
+        static_assert( std::is_trivially_copyable_v<T> );
+        uint64_t count = read<uint64_t>();
+        if( count > remaining() / sizeof(T) ) fail();
+        std::vector<T> values(count);
+        std::memcpy( values.data(), take(count * sizeof(T)), count * sizeof(T) );
+        return values;
+    }
+
+    std::string read_string();
+
+    /**
+     * Read the header and the list of files the scene was made from.
+     * @returns the scene id
+     */
+    uint64_t read_header( std::vector<std::string> * dependencies = nullptr );
+
+    /// Read a material reference written by SceneWriter::write_material(...)
+    const Material * read_material();
+
+    /// Read a surface written by SceneWriter::write_surface(...)
+    std::shared_ptr<Surface> read_surface();
+
+    /// Read a surface written by SceneWriter::write_shared_surface(...), each shared surface is loaded once
+    std::shared_ptr<Surface> read_shared_surface();
+
+private:
+    const char * take( size_t n );
+    size_t remaining() const { return size - pos; }
+    [[noreturn]] void fail() const;
+
+    std::string filename;
+    const char * data = nullptr;
+    size_t size = 0, pos = 0;
+    std::vector<char> buffer;  ///< The file contents where memory mapping is not available
+    std::vector<std::shared_ptr<Surface>> shared;  ///< The shared surfaces read so far, by number
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define LUTERT_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LUTERT_SIMD_SSE
+#endif
+
+/**
+ * Minimal 8-wide float vectors for ray packets.
+ *
+ * With AVX each vector is one 256-bit register, with SSE it is a pair of 128-bit
+ * registers, and otherwise a plain array that the compiler may or may not
+ * vectorize.  Only the operations needed by the packet intersection and image
+ * conversion code are provided.  Comparisons produce a vmask8, which converts to
+ * a bitmask with one bit per lane (lane i is bit i).
+ */
+namespace simd {
+
+constexpr int WIDTH = 8;
+
+/// @returns the index of the lowest set bit of a non-zero lane mask
+inline int first_lane( uint32_t mask ) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/// @returns the number of set bits of a lane mask
+inline int lane_count( uint32_t mask ) {
+#if defined(_MSC_VER)
+    return int(__popcnt(mask));
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+#if defined(LUTERT_SIMD_AVX)
+
+struct vmask8 {
+    __m256 m;
+    uint32_t bits() const { return uint32_t(_mm256_movemask_ps(m)); }
+};
+
+struct vfloat8 {
+    __m256 v;
+
+    vfloat8() = default;
+    vfloat8( __m256 v ) : v(v) {}
+    explicit vfloat8( float f ) : v(_mm256_set1_ps(f)) {}
+
+    static vfloat8 load( const float * p ) { return _mm256_load_ps(p); }
+    static vfloat8 loadu( const float * p ) { return _mm256_loadu_ps(p); }
+    void store( float * p ) const { _mm256_store_ps(p, v); }
+    void storeu( float * p ) const { _mm256_storeu_ps(p, v); }
+};
+
+inline vfloat8 operator+( vfloat8 a, vfloat8 b ) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat8 operator-( vfloat8 a, vfloat8 b ) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat8 operator*( vfloat8 a, vfloat8 b ) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat8 operator/( vfloat8 a, vfloat8 b ) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat8 sqrt( vfloat8 a ) { return _mm256_sqrt_ps(a.v); }
+inline vfloat8 abs( vfloat8 a ) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline vfloat8 min( vfloat8 a, vfloat8 b ) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat8 max( vfloat8 a, vfloat8 b ) { return _mm256_max_ps(a.v, b.v); }
+
+inline vmask8 operator<( vfloat8 a, vfloat8 b ) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline vmask8 operator>( vfloat8 a, vfloat8 b ) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline vmask8 operator<=( vfloat8 a, vfloat8 b ) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline vmask8 operator>=( vfloat8 a, vfloat8 b ) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline vmask8 operator&( vmask8 a, vmask8 b ) { return { _mm256_and_ps(a.m, b.m) }; }
+inline vmask8 operator|( vmask8 a, vmask8 b ) { return { _mm256_or_ps(a.m, b.m) }; }
+
+/// @returns a where mask is set and b elsewhere
+inline vfloat8 select( vmask8 mask, vfloat8 a, vfloat8 b ) { return _mm256_blendv_ps(b.v, a.v, mask.m); }
+
+#elif defined(LUTERT_SIMD_SSE)
+
+struct vmask8 {
+    __m128 lo, hi;
+    uint32_t bits() const { return uint32_t(_mm_movemask_ps(lo) | (_mm_movemask_ps(hi) << 4)); }
+};
+
+struct vfloat8 {
+    __m128 lo, hi;
+
+    vfloat8() = default;
+    vfloat8( __m128 lo, __m128 hi ) : lo(lo), hi(hi) {}
+    explicit vfloat8( float f ) : lo(_mm_set1_ps(f)), hi(lo) {}
+
+    static vfloat8 load( const float * p ) { return { _mm_load_ps(p), _mm_load_ps(p + 4) }; }
+    static vfloat8 loadu( const float * p ) { return { _mm_loadu_ps(p), _mm_loadu_ps(p + 4) }; }
+    void store( float * p ) const { _mm_store_ps(p, lo); _mm_store_ps(p + 4, hi); }
+    void storeu( float * p ) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+};
+
+inline vfloat8 operator+( vfloat8 a, vfloat8 b ) { return { _mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi) }; }
+inline vfloat8 operator-( vfloat8 a, vfloat8 b ) { return { _mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi) }; }
+inline vfloat8 operator*( vfloat8 a, vfloat8 b ) { return { _mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi) }; }
+inline vfloat8 operator/( vfloat8 a, vfloat8 b ) { return { _mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi) }; }
+inline vfloat8 sqrt( vfloat8 a ) { return { _mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi) }; }
+inline vfloat8 abs( vfloat8 a ) {
+    __m128 sign = _mm_set1_ps(-0.0f);
+    return { _mm_andnot_ps(sign, a.lo), _mm_andnot_ps(sign, a.hi) };
+}
+inline vfloat8 min( vfloat8 a, vfloat8 b ) { return { _mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi) }; }
+inline vfloat8 max( vfloat8 a, vfloat8 b ) { return { _mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi) }; }
+
+inline vmask8 operator<( vfloat8 a, vfloat8 b ) { return { _mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi) }; }
+inline vmask8 operator>( vfloat8 a, vfloat8 b ) { return { _mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi) }; }
+inline vmask8 operator<=( vfloat8 a, vfloat8 b ) { return { _mm_cmple_ps(a.lo, b.lo), _mm_cmple_ps(a.hi, b.hi) }; }
+inline vmask8 operator>=( vfloat8 a, vfloat8 b ) { return { _mm_cmpge_ps(a.lo, b.lo), _mm_cmpge_ps(a.hi, b.hi) }; }
+inline vmask8 operator&( vmask8 a, vmask8 b ) { return { _mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi) }; }
+inline vmask8 operator|( vmask8 a, vmask8 b ) { return { _mm_or_ps(a.lo, b.lo), _mm_or_ps(a.hi, b.hi) }; }
+
+/// @returns a where mask is set and b elsewhere
+inline vfloat8 select( vmask8 mask, vfloat8 a, vfloat8 b ) {
+    return { _mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo)),
+             _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi)) };
+}
+
+#else
+
+struct vmask8 {
+    uint32_t m;
+    uint32_t bits() const { return m; }
+};
+
+struct vfloat8 {
+    float v[WIDTH];
+
+    vfloat8() = default;
+    explicit vfloat8( float f ) { for( int i = 0; i < WIDTH; i++ ) v[i] = f; }
+
+    static vfloat8 load( const float * p ) {
+        vfloat8 r;
+        for( int i = 0; i < WIDTH; i++ ) r.v[i] = p[i];
+        return r;
+    }
+    static vfloat8 loadu( const float * p ) { return load(p); }
+    void store( float * p ) const { for( int i = 0; i < WIDTH; i++ ) p[i] = v[i]; }
+    void storeu( float * p ) const { store(p); }
+};
+
+namespace detail {
+    template <class Op>
+    inline vfloat8 map( vfloat8 a, vfloat8 b, Op op ) {
+        vfloat8 r;
+        for( int i = 0; i < WIDTH; i++ ) r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+
+    template <class Op>
+    inline vmask8 compare( vfloat8 a, vfloat8 b, Op op ) {
+        uint32_t m = 0;
+        for( int i = 0; i < WIDTH; i++ ) m |= uint32_t(op(a.v[i], b.v[i])) << i;
+        return {m};
+    }
+}
+
+inline vfloat8 operator+( vfloat8 a, vfloat8 b ) { return detail::map(a, b, []( float x, float y ) { return x + y; }); }
+inline vfloat8 operator-( vfloat8 a, vfloat8 b ) { return detail::map(a, b, []( float x, float y ) { return x - y; }); }
+inline vfloat8 operator*( vfloat8 a, vfloat8 b ) { return detail::map(a, b, []( float x, float y ) { return x * y; }); }
+inline vfloat8 operator/( vfloat8 a, vfloat8 b ) { return detail::map(a, b, []( float x, float y ) { return x / y; }); }
+inline vfloat8 sqrt( vfloat8 a ) { return detail::map(a, a, []( float x, float ) { return std::sqrt(x); }); }
+inline vfloat8 abs( vfloat8 a ) { return detail::map(a, a, []( float x, float ) { return std::fabs(x); }); }
+inline vfloat8 min( vfloat8 a, vfloat8 b ) { return detail::map(a, b, []( float x, float y ) { return x < y ? x : y; }); }
+inline vfloat8 max( vfloat8 a, vfloat8 b ) { return detail::map(a, b, []( float x, float y ) { return x > y ? x : y; }); }
+
+inline vmask8 operator<( vfloat8 a, vfloat8 b ) { return detail::compare(a, b, []( float x, float y ) { return x < y; }); }
+inline vmask8 operator>( vfloat8 a, vfloat8 b ) { return detail::compare(a, b, []( float x, float y ) { return x > y; }); }
+inline vmask8 operator<=( vfloat8 a, vfloat8 b ) { return detail::compare(a, b, []( float x, float y ) { return x <= y; }); }
+inline vmask8 operator>=( vfloat8 a, vfloat8 b ) { return detail::compare(a, b, []( float x, float y ) { return x >= y; }); }
+inline vmask8 operator&( vmask8 a, vmask8 b ) { return {a.m & b.m}; }
+inline vmask8 operator|( vmask8 a, vmask8 b ) { return {a.m | b.m}; }
+
+/// @returns a where mask is set and b elsewhere
+inline vfloat8 select( vmask8 mask, vfloat8 a, vfloat8 b ) {
+    vfloat8 r;
+    for( int i = 0; i < WIDTH; i++ ) r.v[i] = (mask.m >> i) & 1 ? a.v[i] : b.v[i];
+    return r;
+}
+
+#endif
+
+}
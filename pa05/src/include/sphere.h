@@ -8,19 +8,62 @@ using nlohmann::json;
 
 /**
  * A sphere centered at the origin with given radius.
+ *
+ * When the transform is only a translation and a uniform scale (as for nearly
+ * every sphere in practice), the sphere is intersected directly in world space
+ * using a precomputed center and radius, with no per-ray matrix work.  Otherwise
+ * the ray is taken to local space using the stored inverse matrix.
  */
 class Sphere : public Surface {
 
 public:
     explicit Sphere(float radius = 1.0f, const Transform & t = Transform(),
-                    const std::shared_ptr<Material> & material = nullptr) :
-                    radius(radius), xform(t), material(material) {}
+                    const Material * material = nullptr) :
+                    radius(radius), xform(t), material(material) { init(); }
     explicit Sphere( const json & j );
 
-    std::optional<HitRecord> intersect(Ray &ray) const override;
+    bool intersect_t(Ray &ray, PrimitiveHit &hit) const override;
+    uint32_t intersect_packet(RayPacket &packet, PrimitiveHit *hits) const override;
+    bool occluded(const Ray &ray) const override;
+    HitRecord shade(const Ray &ray, const PrimitiveHit &hit) const override;
+    Bounds3f bounds() const override;
+
+    void save(SceneWriter &out) const override;
+    static std::shared_ptr<Sphere> load(SceneReader &in);
+
+    bool is_area_light() const override;
+    AreaSample sample_area(const Vec2f &u) const override;
+    float pdf_area(const Vec3f &p) const override;
+
+    /// True if the transform is only a translation and a uniform scale, see get_center() and get_world_radius()
+    bool is_world_space() const { return world_space; }
+    const Vec3f & get_center() const { return center; }
+    float get_world_radius() const { return world_radius; }
+    const Material * get_material() const { return material; }
 
 private:
+    /// Precompute the world-space form of the sphere, if the transform allows
+    void init();
+
+    /// @returns the distance to the nearest intersection within [ray.mint, ray.maxt], if any
+    std::optional<float> hit_distance(const Ray &ray) const;
+
     float radius = 1.0f;
     Transform xform = Transform();
-    std::shared_ptr<Material> material = nullptr;
-};
\ No newline at end of file
+    const Material * material = nullptr;  ///< Not owned, see MaterialLib
+
+    bool world_space = false;   ///< True if center and world_radius describe the sphere
+    Vec3f center{0, 0, 0};      ///< World-space center
+    float world_radius = 1.0f;  ///< World-space radius
+    float inv_local_area = 1.0f;  ///< One over the area of the untransformed sphere
+};
+
+/**
+ * Intersect the rays of a packet with a sphere given in world space.
+ * @param lanes the lanes to test
+ * @param t_lanes set to the distance of the nearest hit within [mint, maxt] for
+ *        each lane hit, must be 32-byte aligned with PACKET_SIZE entries
+ * @return the bitmask of the lanes that hit the sphere
+ */
+uint32_t intersect_sphere_packet( const RayPacket &packet, uint32_t lanes, const Vec3f &center, float radius,
+                                  float *t_lanes );
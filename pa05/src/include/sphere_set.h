@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include "surface.h"
+#include "bvh.h"
+
+/**
+ * Many spheres in world space (translated and uniformly scaled, see Sphere),
+ * stored as a structure of arrays: centers, radii and material ids each in
+ * their own contiguous array, with the materials themselves in a small table.
+ * A sphere costs 20 bytes, instead of a heap-allocated Sphere with its two
+ * matrices and a virtual call per test.
+ *
+ * The spheres are indexed by a BVHTree with up to simd::WIDTH spheres per leaf.
+ * After building, the arrays are sorted in the tree's leaf order, so each leaf is a
+ * contiguous run of spheres that one ray is tested against with a single pass of
+ * SIMD instructions.
+ *
+ * Scene parsing gathers the eligible spheres of a scene into a SphereSet.  Emissive
+ * spheres stay separate Sphere objects so that they can be sampled as lights.
+ */
+class SphereSet : public Surface {
+
+public:
+    SphereSet() = default;
+
+    /// Add a sphere, call build() after the last one
+    void add( const Vec3f & center, float radius, const Material * material );
+
+    /// Build the hierarchy over the spheres added so far.
+    void build();
+
+    /// @returns the number of spheres
+    size_t size() const { return num_spheres; }
+
+    bool intersect_t( Ray & ray, PrimitiveHit & hit ) const override;
+    uint32_t intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const override;
+    bool occluded( const Ray & ray ) const override;
+    HitRecord shade( const Ray & ray, const PrimitiveHit & hit ) const override;
+    Bounds3f bounds() const override { return tree.bounds(); }
+    void save( SceneWriter & out ) const override;
+    static std::shared_ptr<SphereSet> load( SceneReader & in );
+
+private:
+    /**
+     * Intersect ray with the spheres [first, first + count), count <= simd::WIDTH.
+     * @param t set to the distance of the nearest hit within [ray.mint, ray.maxt]
+     * @return the index of the nearest sphere hit, or -1 if there is none
+     */
+    int intersect_leaf( const Ray & ray, uint32_t first, uint32_t count, float & t ) const;
+
+    size_t num_spheres = 0;
+    // One entry per sphere, followed by simd::WIDTH - 1 entries of padding after build()
+    std::vector<float> cx, cy, cz;          ///< Centers
+    std::vector<float> radius;              ///< Radii
+    std::vector<uint32_t> material_ids;     ///< Index of each sphere's material in materials
+    std::vector<const Material *> materials;  ///< The distinct materials, not owned, see MaterialLib
+    BVHTree tree;
+};
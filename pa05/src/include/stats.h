@@ -0,0 +1,128 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "json.h"
+
+/**
+ * Render statistics.
+ *
+ * Hot-path counters (rays per bounce, intersection tests, BVH nodes, scatter calls,
+ * how paths end) are only compiled in when LUTERT_ENABLE_STATS is defined, see the
+ * CMake option of the same name.  Code that updates a counter wraps the update in
+ * LUTERT_STAT(...), which expands to nothing otherwise, so a normal build pays
+ * nothing for them.
+ *
+ * Each thread counts into its own thread_local Counters, which are added to the
+ * global totals when the thread exits (the worker threads of parallel_for(...) exit
+ * at the end of each call) or when the calling thread asks for the totals.
+ *
+ * Phase wall times (parse, build, render, write) cost a clock read per phase and
+ * are always recorded.
+ */
+namespace stats {
+
+#ifdef LUTERT_ENABLE_STATS
+    constexpr bool ENABLED = true;
+#else
+    constexpr bool ENABLED = false;
+#endif
+
+    /// Rays at this bounce depth or deeper are counted together
+    constexpr int MAX_COUNTED_DEPTH = 16;
+
+    /// Material types that scatter, for Counters::scatter_calls
+    enum MaterialType { LAMBERTIAN, METAL, DIELECTRIC, NUM_MATERIAL_TYPES };
+
+    /// Names of the MaterialType values
+    extern const char * const MATERIAL_TYPE_NAMES[NUM_MATERIAL_TYPES];
+
+    struct Counters {
+        uint64_t rays[MAX_COUNTED_DEPTH + 1] = {};   ///< Rays traced, by bounce depth (0 for camera rays)
+        uint64_t shadow_rays = 0;                    ///< Visibility rays towards lights
+        uint64_t intersection_tests = 0;             ///< Ray-primitive tests, at every level of the hierarchy
+        uint64_t bvh_nodes_visited = 0;              ///< BVH nodes tested, a packet counts once per node
+        uint64_t bvh_node_misses = 0;                ///< Node visits that missed the simulated node cache, see touch_node(...)
+        uint64_t scatter_calls[NUM_MATERIAL_TYPES] = {};
+        uint64_t escaped = 0;    ///< Paths that left the scene
+        uint64_t absorbed = 0;   ///< Paths whose scatter(...) returned nothing, including lights
+        uint64_t roulette = 0;   ///< Paths ended by Russian roulette
+        uint64_t max_depth = 0;  ///< Paths cut off at the maximum depth
+
+        /// Count n rays at bounce depth
+        void add_rays( int depth, uint64_t n = 1 ) {
+            rays[ depth < MAX_COUNTED_DEPTH ? depth : MAX_COUNTED_DEPTH ] += n;
+        }
+
+        /// Count one traversal of a BVHTree
+        void add_traversal( uint64_t nodes, uint64_t tests ) {
+            bvh_nodes_visited += nodes;
+            intersection_tests += tests;
+        }
+
+        /// @returns the total over all depths of rays
+        uint64_t total_rays() const;
+
+        Counters & operator+=( const Counters & other );
+    };
+
+    /// @returns this thread's counters
+    Counters & local();
+
+    /**
+     * Count a visit to the BVH node at the given address in a simulated cache: 32 KiB,
+     * direct mapped, with 64-byte lines, one per thread like a core's L1 data cache.
+     * A miss is counted in bvh_node_misses.  This measures the memory locality of
+     * traversal where hardware performance counters are not available.
+     */
+    void touch_node( const void * node );
+
+    /// @returns the counters of all threads so far
+    Counters totals();
+
+    /// Set all counters and phase times to zero
+    void reset();
+
+    /// Wall time spent in a phase of the program
+    struct PhaseTime {
+        std::string name;
+        double seconds;
+    };
+
+    /**
+     * Times a phase from construction to destruction.  Phases may nest; the
+     * time of a nested phase is not included in the phase that encloses it, so
+     * the phase times add up to the total.  Phases with the same name are added.
+     */
+    class ScopedPhase {
+    public:
+        explicit ScopedPhase( std::string name );
+        ~ScopedPhase();
+        ScopedPhase( const ScopedPhase & ) = delete;
+        ScopedPhase & operator=( const ScopedPhase & ) = delete;
+
+    private:
+        std::string name;
+        std::chrono::steady_clock::time_point start;
+        double nested_seconds = 0.0;
+        ScopedPhase * parent;
+    };
+
+    /// @returns the phase times, in the order the phases were first entered
+    std::vector<PhaseTime> phases();
+
+    /// Print the phase times, and the counters if they are enabled
+    void print_summary();
+
+    /// @returns the phase times and counters, with "counters_enabled" telling whether the counters were compiled in
+    json to_json();
+}
+
+#ifdef LUTERT_ENABLE_STATS
+    #define LUTERT_STAT(statement) do { statement; } while( false )
+#else
+    #define LUTERT_STAT(statement) do {} while( false )
+#endif
@@ -2,6 +2,21 @@
 
 #include "hitrecord.h"
 #include "ray.h"
+#include "bounds.h"
+#include "packet.h"
+
+class SceneWriter;
+class SceneReader;
+
+/**
+ * A point sampled on the area of a surface, see Surface::sample_area(...).
+ */
+struct AreaSample {
+    Vec3f p;          ///< World-space point on the surface
+    Vec3f n;          ///< Surface normal at p
+    float pdf = 0.0f; ///< Probability density of choosing p, with respect to world-space area
+    const Material * material = nullptr;  ///< The material at p
+};
 
 /**
  * Base class for surfaces.
@@ -14,10 +29,97 @@ class Surface {
 public:
     virtual ~Surface() = default;
 
+    /**
+     * Find the closest hit along the ray.  This is the two phases below combined:
+     * the hit test narrows the ray, then the record is built for the final hit only.
+     *
+     * @param ray the ray, ray.maxt is set to the hit distance on a hit
+     */
     virtual std::optional<HitRecord> intersect( Ray & ray ) const {
+        PrimitiveHit hit;
+        if( !intersect_t(ray, hit) ) return {};
+        return hit.surface->shade(ray, hit);
+    }
+
+    /**
+     * Hit test only.  If the surface is hit within [ray.mint, ray.maxt], set
+     * ray.maxt to the hit distance, fill in hit and return true.  Otherwise leave
+     * both unchanged and return false.  No points or normals are computed, so this
+     * is cheap for candidate hits that are later replaced by closer ones.
+     */
+    virtual bool intersect_t( Ray & ray, PrimitiveHit & hit ) const {
         throw LutertException("Intersection is not supported for this surface.");
     }
 
+    /**
+     * Visibility test: is there any hit within [ray.mint, ray.maxt]?  Unlike
+     * intersect_t(...) this may stop at the first hit found rather than the closest,
+     * and computes no hit data at all.  Use it for shadow rays.
+     */
+    virtual bool occluded( const Ray & ray ) const {
+        Ray r = ray;
+        PrimitiveHit hit;
+        return intersect_t(r, hit);
+    }
+
+    /**
+     * Hit test for a packet of rays: intersect_t(...) for each active lane, where
+     * hits[i] belongs to lane i.  The default tests the lanes one at a time;
+     * surfaces override it to test all lanes at once with SIMD.
+     *
+     * @return the bitmask of lanes whose hit was updated
+     */
+    virtual uint32_t intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const;
+
+    /**
+     * Build the full hit record for a hit found by intersect_t(...).  Only called
+     * on the surface stored in hit.surface.
+     *
+     * @param ray the ray that was passed to intersect_t(...)
+     */
+    virtual HitRecord shade( const Ray & ray, const PrimitiveHit & hit ) const {
+        throw LutertException("Shading is not supported for this surface.");
+    }
+
+    /**
+     * @returns true if this surface has an emissive material and implements
+     *          sample_area(...) and pdf_area(...), so that it can be sampled as a light
+     */
+    virtual bool is_area_light() const { return false; }
+
+    /**
+     * Choose a point on the surface.
+     * @param u a uniform random point in [0,1)^2
+     */
+    virtual AreaSample sample_area( const Vec2f & u ) const {
+        throw LutertException("Area sampling is not supported for this surface.");
+    }
+
+    /**
+     * @param p a point on the surface
+     * @returns the density with which sample_area(...) chooses p, with respect to world-space area
+     */
+    virtual float pdf_area( const Vec3f & p ) const {
+        throw LutertException("Area sampling is not supported for this surface.");
+    }
+
+    /**
+     * @returns an axis-aligned box in world space that contains this surface.
+     *          Acceleration structures rely on this box, so it must be conservative,
+     *          and it should be as tight as reasonably possible.
+     */
+    virtual Bounds3f bounds() const {
+        throw LutertException("Bounds are not supported for this surface.");
+    }
+
+    /**
+     * Write the surface to a binary scene cache: its SceneCache::SurfaceTag, then
+     * everything its static load(SceneReader &) needs to rebuild it, see scene_cache.h.
+     */
+    virtual void save( SceneWriter & out ) const {
+        throw LutertException("Saving to a scene cache is not supported for this surface.");
+    }
+
 };
 
 class Group : public Surface {
@@ -29,7 +131,12 @@ public:
         surfaces.push_back(s);
     }
 
-    virtual std::optional<HitRecord> intersect( Ray & ray ) const override;
+    bool intersect_t( Ray & ray, PrimitiveHit & hit ) const override;
+    uint32_t intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const override;
+    bool occluded( const Ray & ray ) const override;
+
+    /// @returns the union of the bounds of all surfaces in the group
+    Bounds3f bounds() const override;
 
 private:
     std::vector<std::shared_ptr<Surface>> surfaces;
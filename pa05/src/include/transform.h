@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+
 #include "common.h"
 #include "ray.h"
+#include "bounds.h"
 
 using linalg::mul;
 
@@ -26,40 +29,82 @@ public:
         return Transform(m_inv, m);
     }
 
+    /// Transform a point, points are affected by translation
     Vec3f transform_point( const Vec3f point ) const {
-        // ========================== TASK 3 ===========================================================
-        // TODO: Transform the point by this matrix.  Points can be affected by translations,
-        //   use a 1.0 in the 4th homogeneous coordinate when multiplying.  Return a 3-component vector.
-        //   To get the first three components of a Vec4f v use v.xyz().
-
-        return {};  // Replace this
+        return mul(m, Vec4f(point, 1.0f)).xyz();
     }
 
+    /// Transform a direction vector, vectors are not affected by translation
     Vec3f transform_vector( const Vec3f & vector ) const {
-        // ========================== TASK 3 ===========================================================
-        // TODO: Transform the vector by this matrix.  Vectors should not be affected by translations,
-        //   use a 0.0 in the 4th homogeneous coordinate to support this.  Return a 3-component vector.
-        //   To get the first three components of a Vec4f v use v.xyz().
-        
-        return {};  // Replace this
+        return mul(m, Vec4f(vector, 0.0f)).xyz();
     }
 
+    /// Transform a normal by the inverse transpose, the result is normalized
     Vec3f transform_normal( const Vec3f & normal ) const {
-        // ========================== TASK 3 ===========================================================
-        // TODO: Return a Vec3f that is transformed by this Transform.  Normals are
-        //   transformed differently than other vectors, you must use the inverse transpose of the
-        //   matrix.  The inverse is available in m_inv.  As with vectors, use a 0.0 in the 4th
-        //   homogeneous coordinate to avoid translation.  Make sure to return a normalized unit vector.
-
-        return {};  // Replace this
+        return normalize(mul(linalg::transpose(m_inv), Vec4f(normal, 0.0f)).xyz());
     }
 
+    /// Transform the ray's origin and direction, mint and maxt are unchanged
     Ray transform_ray( const Ray & ray ) const  {
-        // ========================== TASK 3 ===========================================================
-        // TODO: Transform the ray's origin and direction and return a new Ray with the transformed
-        //   values.  You can use the above methods to transform the origin and direction.  Make sure
-        //   that you maintain the Ray's mint and maxt values.
-        
-        return {};  // Replace this
+        return { transform_point(ray.o), transform_vector(ray.d), ray.mint, ray.maxt };
+    }
+
+    /// Transform a ray by the inverse of this transform, without building an inverse Transform
+    Ray inverse_transform_ray( const Ray & ray ) const {
+        return { mul(m_inv, Vec4f(ray.o, 1.0f)).xyz(), mul(m_inv, Vec4f(ray.d, 0.0f)).xyz(), ray.mint, ray.maxt };
+    }
+
+    /// @returns row i of the inverse matrix, i.e. the coefficients that give local coordinate i
+    Vec4f inverse_row( int i ) const {
+        return { m_inv[0][i], m_inv[1][i], m_inv[2][i], m_inv[3][i] };
+    }
+
+    /**
+     * @returns the scale factor s if this transform is a translation combined with
+     *          a uniform scale by s > 0 (no rotation, shear or mirroring), or empty otherwise
+     */
+    std::optional<float> uniform_scale() const {
+        float s = m[0][0];
+        float tolerance = 1e-6f * std::fabs(s);
+        for( int j = 0; j < 3; j++ ) {
+            for( int i = 0; i < 3; i++ ) {
+                float expected = (i == j) ? s : 0.0f;
+                if( std::fabs(m[j][i] - expected) > tolerance ) return {};
+            }
+        }
+        if( s <= 0.0f ) return {};
+        return s;
+    }
+
+    /**
+     * @returns the factor by which this transform scales the area of a small surface
+     *          patch with unit normal n, i.e. |det(M)| * |M^-T n| for the linear part M
+     */
+    float area_scale( const Vec3f & n ) const {
+        float det = dot( m[0].xyz(), cross(m[1].xyz(), m[2].xyz()) );
+        return std::fabs(det) * length( mul(linalg::transpose(m_inv), Vec4f(n, 0.0f)).xyz() );
+    }
+
+    /**
+     * Transform an axis-aligned box.  Uses Arvo's method: each row of the matrix
+     * is applied to the box's extents independently, which gives the same (tight)
+     * result as transforming all 8 corners at a fraction of the cost.
+     *
+     * @returns the smallest axis-aligned box that contains the transformed box b
+     */
+    Bounds3f transform_bounds( const Bounds3f & b ) const {
+        if( b.is_empty() ) return b;
+
+        Vec3f t = m[3].xyz();
+        Bounds3f result{ t, t };
+        for( int i = 0; i < 3; i++ ) {
+            for( int j = 0; j < 3; j++ ) {
+                float lo = m[j][i] * b.min[j];
+                float hi = m[j][i] * b.max[j];
+                result.min[i] += std::min(lo, hi);
+                result.max[i] += std::max(lo, hi);
+            }
+        }
+        return result;
     }
 };
\ No newline at end of file
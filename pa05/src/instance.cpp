@@ -0,0 +1,68 @@
+#include "instance.h"
+#include "scene_cache.h"
+
+Instance::Instance( std::shared_ptr<const Surface> prototype, const Transform & t ) :
+    prototype(std::move(prototype)), xform(t) {
+    world_bounds = xform.transform_bounds( this->prototype->bounds() );
+}
+
+bool Instance::intersect_t( Ray & ray, PrimitiveHit & hit ) const {
+    Ray local = xform.inverse_transform_ray(ray);
+    PrimitiveHit local_hit;
+    if( !prototype->intersect_t(local, local_hit) ) return false;
+
+    ray.maxt = local.maxt;
+    hit = local_hit;
+    hit.instanced = local_hit.surface;
+    hit.surface = this;
+    return true;
+}
+
+bool Instance::occluded( const Ray & ray ) const {
+    return prototype->occluded( xform.inverse_transform_ray(ray) );
+}
+
+uint32_t Instance::intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const {
+    RayPacket local;
+    for( uint32_t lanes = packet.active; lanes != 0; lanes &= lanes - 1 ) {
+        int lane = simd::first_lane(lanes);
+        local.set( lane, xform.inverse_transform_ray( packet.get(lane) ) );
+    }
+
+    PrimitiveHit local_hits[PACKET_SIZE];
+    uint32_t hit_mask = prototype->intersect_packet(local, local_hits);
+    for( uint32_t lanes = hit_mask; lanes != 0; lanes &= lanes - 1 ) {
+        int lane = simd::first_lane(lanes);
+        packet.maxt[lane] = local.maxt[lane];
+        hits[lane] = local_hits[lane];
+        hits[lane].instanced = local_hits[lane].surface;
+        hits[lane].surface = this;
+    }
+    return hit_mask;
+}
+
+HitRecord Instance::shade( const Ray & ray, const PrimitiveHit & hit ) const {
+    PrimitiveHit local_hit = hit;
+    local_hit.surface = hit.instanced;
+    local_hit.instanced = nullptr;
+    HitRecord record = hit.instanced->shade( xform.inverse_transform_ray(ray), local_hit );
+
+    record.p = xform.transform_point(record.p);
+    record.gn = xform.transform_normal(record.gn);
+    record.sn = xform.transform_normal(record.sn);
+    record.surface = this;
+    return record;
+}
+
+void Instance::save( SceneWriter & out ) const {
+    out.write(SceneCache::INSTANCE);
+    out.write(xform.m);
+    out.write(xform.m_inv);
+    out.write_shared_surface(*prototype);
+}
+
+std::shared_ptr<Instance> Instance::load( SceneReader & in ) {
+    Mat4 m = in.read<Mat4>();
+    Mat4 m_inv = in.read<Mat4>();
+    return std::make_shared<Instance>( in.read_shared_surface(), Transform(m, m_inv) );
+}
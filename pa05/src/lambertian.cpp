@@ -1,21 +1,32 @@
 #include "material.h"
 #include "random.h"
+#include "stats.h"
 
 /**
- * ==================================== TASK 6 ===========================================================
- * Implement Lambertian scattering.  Scatter the incoming ray in a random direction (cosine weighted) in 
- * the hemisphere oriented along the normal, and return a ScatterInfo struct containing the scattered ray
- * in the `scattered` field of the ScatterInfo struct.  The origin of the ray should be the intersection
- * point (hit.p), and select the direction by adding a random unit vector to the shading normal (available 
- * in the HitRecord object), then normalizing.
- * 
- * You can generate a random unit vector by calling the random_on_unit_sphere() function from "random.h".
- * The origin of the outgoing ray should be the hit point (hit.p).  Set `attenuation` in the ScatterInfo
- * struct to the value of this material's `albedo`.  
- * 
- * There is a small chance that the scattered direction will be close to (0,0,0).
- * In this case, set the scattered ray's direction to the shading normal (hit.sn).
+ * Lambertian scattering.  The incoming ray is scattered in a random, cosine weighted direction in
+ * the hemisphere around the shading normal.  The direction is chosen by adding a random unit vector
+ * to the shading normal and normalizing.  If that sum is close to (0,0,0), the shading normal itself
+ * is used.  The attenuation is the material's `albedo`.
  */
-std::optional<ScatterInfo> Lambertian::scatter( const Ray & r, const HitRecord & hit ) const {
-    return {};  // replace this
+std::optional<ScatterInfo> Lambertian::scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const {
+    LUTERT_STAT( stats::local().scatter_calls[stats::LAMBERTIAN]++ );
+    Vec3f dir = hit.sn + random_on_unit_sphere(sampler);
+    if( length2(dir) < 1e-8f ) dir = hit.sn;
+
+    ScatterInfo info;
+    info.attenuation = albedo;
+    info.scattered = Ray(hit.p, normalize(dir));
+    return info;
+}
+
+/**
+ * The Lambertian BSDF is albedo / pi, and scatter(...) chooses directions with density
+ * cos(theta) / pi, where theta is measured from the shading normal.
+ */
+Color3f Lambertian::eval( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const {
+    return albedo * (std::max(0.0f, dot(hit.sn, dir)) * INV_PI);
+}
+
+float Lambertian::pdf( const Ray & r, const HitRecord & hit, const Vec3f & dir ) const {
+    return std::max(0.0f, dot(hit.sn, dir)) * INV_PI;
 }
@@ -0,0 +1,283 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <pcg32.h>
+
+#include "scene.h"
+#include "sphere.h"
+#include "quad.h"
+#include "bvh.h"
+#include "material.h"
+#include "materiallib.h"
+
+/*
+ * Microbenchmarks, run with Catch2's benchmarking support.
+ *
+ * The primitive benchmarks each time a batch of BATCH_SIZE rays, so divide the
+ * reported times by BATCH_SIZE for the time per ray.  The render benchmarks time a
+ * full frame of each scene in LUTERT_SCENE_DIR at one sample per pixel, on all
+ * hardware threads.
+ *
+ * Select benchmarks by tag ([primitive], [transform], [material], [camera], [bvh],
+ * [render], [sort]), and use a reporter for machine-readable results, e.g.
+ *
+ *     lutert_bench "[render]" --benchmark-samples 10 --reporter xml::out=bench.xml --reporter console
+ *
+ * The renders draw a progress bar on stdout, so write XML or JUnit results to a file
+ * with ::out= as above rather than to stdout.
+ */
+namespace {
+    constexpr int BATCH_SIZE = 1024;
+
+    Vec3f random_vec( pcg32 & rng, float lo, float hi ) {
+        return Vec3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * (hi - lo) + lo;
+    }
+
+    /// Rays from random points on a sphere of radius 5 towards random points in [-1, 1]^3, about half of which hit a unit sphere
+    std::vector<Ray> random_rays( int count, uint64_t seed = 1 ) {
+        pcg32 rng( seed );
+        std::vector<Ray> rays;
+        for( int i = 0; i < count; i++ ) {
+            Vec3f o = 5.0f * normalize( random_vec(rng, -1.f, 1.f) + Vec3f{1e-3f, 0.f, 0.f} );
+            rays.emplace_back( o, normalize( random_vec(rng, -1.f, 1.f) - o ) );
+        }
+        return rays;
+    }
+
+    /// Intersect every ray with surface, returning the number of hits
+    int intersect_all( const Surface & surface, const std::vector<Ray> & rays ) {
+        int hits = 0;
+        for( const Ray & r : rays ) {
+            Ray ray = r;
+            PrimitiveHit hit;
+            if( surface.intersect_t(ray, hit) ) hits++;
+        }
+        return hits;
+    }
+
+    /**
+     * Material dispatch through virtual functions, as Material had before it switched
+     * on a type tag.  The [material] benchmarks use it as the baseline.
+     */
+    struct VirtualMaterial {
+        virtual ~VirtualMaterial() = default;
+        virtual std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const = 0;
+        virtual Color3f emitted( const Ray & ray, const HitRecord & hit ) const { return {0, 0, 0}; }
+    };
+
+    template <class M>
+    struct VirtualWrapper : VirtualMaterial {
+        explicit VirtualWrapper( const M & m ) : m(m) {}
+        std::optional<ScatterInfo> scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const override {
+            return m.scatter(r, hit, sampler);
+        }
+        M m;
+    };
+
+    std::shared_ptr<Surface> random_quad( pcg32 & rng ) {
+        Vec3f axis = normalize( random_vec(rng, -1.f, 1.f) + Vec3f{0.f, 0.f, 1e-3f} );
+        Mat4 m = mul( linalg::translation_matrix( random_vec(rng, -10.f, 10.f) ),
+                      linalg::rotation_matrix( linalg::rotation_quat(axis, rng.nextFloat() * 2 * M_PI) ) );
+        Vec2f size{ 0.1f + rng.nextFloat(), 0.1f + rng.nextFloat() };
+        return std::make_shared<Quad>( size, Transform(m) );
+    }
+}
+
+TEST_CASE( "Primitive intersection", "[primitive]" ) {
+    std::vector<Ray> rays = random_rays(BATCH_SIZE);
+    Sphere sphere;
+    Sphere ellipsoid( 1.0f, Transform( linalg::scaling_matrix(Vec3f{1.0f, 0.5f, 2.0f}) ) );
+    Quad quad( Vec2f{2, 2}, Transform( linalg::rotation_matrix( linalg::rotation_quat(Vec3f{1, 0, 0}, 0.5f) ) ) );
+
+    BENCHMARK( "Sphere::intersect_t" ) { return intersect_all(sphere, rays); };
+    BENCHMARK( "Sphere::intersect_t (non-uniform scale)" ) { return intersect_all(ellipsoid, rays); };
+    BENCHMARK( "Quad::intersect_t" ) { return intersect_all(quad, rays); };
+    BENCHMARK( "Sphere::intersect (with shading)" ) {
+        int hits = 0;
+        for( const Ray & r : rays ) {
+            Ray ray = r;
+            if( sphere.intersect(ray) ) hits++;
+        }
+        return hits;
+    };
+}
+
+TEST_CASE( "Transform", "[transform]" ) {
+    std::vector<Ray> rays = random_rays(BATCH_SIZE);
+    Mat4 m = mul( linalg::translation_matrix(Vec3f{1, 2, 3}),
+                  linalg::rotation_matrix( linalg::rotation_quat(normalize(Vec3f{1, 1, 0}), 0.3f) ) );
+    Transform xform(m);
+
+    BENCHMARK( "Transform::transform_ray" ) {
+        Vec3f sum{0, 0, 0};
+        for( const Ray & ray : rays ) sum += xform.transform_ray(ray).d;
+        return sum;
+    };
+    BENCHMARK( "Transform::inverse_transform_ray" ) {
+        Vec3f sum{0, 0, 0};
+        for( const Ray & ray : rays ) sum += xform.inverse_transform_ray(ray).d;
+        return sum;
+    };
+}
+
+TEST_CASE( "Material scatter", "[material]" ) {
+    std::vector<Ray> rays = random_rays(BATCH_SIZE);
+    // A hit on a sphere for each ray, so that the materials see a spread of angles
+    Sphere sphere;
+    std::vector<HitRecord> hits;
+    std::vector<Ray> hit_rays;
+    for( const Ray & r : random_rays(4 * BATCH_SIZE) ) {
+        Ray ray = r;
+        if( auto hit = sphere.intersect(ray) ) {
+            hits.push_back(*hit);
+            hit_rays.push_back(ray);
+            if( hits.size() == BATCH_SIZE ) break;
+        }
+    }
+
+    Lambertian lambertian( json{ {"albedo", {0.5f, 0.5f, 0.5f}} } );
+    Metal metal( json{ {"albedo", {0.9f, 0.9f, 0.9f}}, {"roughness", 0.2f} } );
+    Dielectric dielectric( json{ {"ior", 1.5f} } );
+    const std::pair<const char *, const Material *> materials[] = {
+        { "Lambertian::scatter", &lambertian },
+        { "Metal::scatter", &metal },
+        { "Dielectric::scatter", &dielectric },
+    };
+
+    for( const auto & named : materials ) {
+        const Material * material = named.second;
+        BENCHMARK( std::string(named.first) ) {
+            Sampler sampler;
+            Vec3f sum{0, 0, 0};
+            for( size_t i = 0; i < hits.size(); i++ ) {
+                if( auto scatter = material->scatter(hit_rays[i], hits[i], sampler) ) sum += scatter->scattered.d;
+            }
+            return sum;
+        };
+    }
+
+    // A random material at each hit, as in a scene with many materials, so that the
+    // dispatch cannot be predicted.  Each hit makes the calls of one bounce of the
+    // recursive integrator, emitted(...) and scatter(...).
+    const VirtualWrapper<Lambertian> virtual_lambertian(lambertian);
+    const VirtualWrapper<Metal> virtual_metal(metal);
+    const VirtualWrapper<Dielectric> virtual_dielectric(dielectric);
+    const VirtualMaterial * virtual_materials[] = { &virtual_lambertian, &virtual_metal, &virtual_dielectric };
+    std::vector<const Material *> mixed;
+    std::vector<const VirtualMaterial *> virtual_mixed;
+    pcg32 rng;
+    for( size_t i = 0; i < hits.size(); i++ ) {
+        uint32_t k = rng.nextUInt(3);
+        mixed.push_back( materials[k].second );
+        virtual_mixed.push_back( virtual_materials[k] );
+    }
+
+    BENCHMARK( "Material::scatter, mixed materials (type tag)" ) {
+        Sampler sampler;
+        Vec3f sum{0, 0, 0};
+        for( size_t i = 0; i < hits.size(); i++ ) {
+            sum += mixed[i]->emitted(hit_rays[i], hits[i]);
+            if( auto scatter = mixed[i]->scatter(hit_rays[i], hits[i], sampler) ) sum += scatter->scattered.d;
+        }
+        return sum;
+    };
+    BENCHMARK( "Material::scatter, mixed materials (virtual)" ) {
+        Sampler sampler;
+        Vec3f sum{0, 0, 0};
+        for( size_t i = 0; i < hits.size(); i++ ) {
+            sum += virtual_mixed[i]->emitted(hit_rays[i], hits[i]);
+            if( auto scatter = virtual_mixed[i]->scatter(hit_rays[i], hits[i], sampler) ) sum += scatter->scattered.d;
+        }
+        return sum;
+    };
+}
+
+TEST_CASE( "Camera", "[camera]" ) {
+    Camera camera( json{ {"resolution", {32, 32}}, {"vfov", 45.0f},
+                         {"transform", { {"from", {1, 2, 3}}, {"at", {0, 0, 0}}, {"up", {0, 1, 0}} }} } );
+
+    BENCHMARK( "Camera::generate_ray" ) {
+        Vec3f sum{0, 0, 0};
+        for( int y = 0; y < 32; y++ ) {
+            for( int x = 0; x < 32; x++ ) sum += camera.generate_ray( Vec2f{x + 0.5f, y + 0.5f} ).d;
+        }
+        return sum;
+    };
+}
+
+TEST_CASE( "Group versus BVH", "[bvh]" ) {
+    for( int num_quads : {16, 256, 4096} ) {
+        pcg32 rng;
+        std::vector<std::shared_ptr<Surface>> quads;
+        Group group;
+        BVH bvh;
+        for( int i = 0; i < num_quads; i++ ) {
+            quads.push_back( random_quad(rng) );
+            group.add( quads.back() );
+            bvh.add( quads.back() );
+        }
+        bvh.build();
+
+        // Rays through the cube the quads are scattered in
+        std::vector<Ray> rays;
+        for( int i = 0; i < BATCH_SIZE; i++ ) {
+            Vec3f o = random_vec(rng, -15.f, 15.f);
+            rays.emplace_back( o, normalize( random_vec(rng, -10.f, 10.f) - o ) );
+        }
+
+        BENCHMARK( fmt::format("Group::intersect_t, {} quads", num_quads) ) { return intersect_all(group, rays); };
+        BENCHMARK( fmt::format("BVH::intersect_t, {} quads", num_quads) ) { return intersect_all(bvh, rays); };
+        BENCHMARK( fmt::format("BVH::build, {} quads", num_quads) ) {
+            BVH rebuilt;
+            for( const auto & quad : quads ) rebuilt.add(quad);
+            rebuilt.build();
+            return rebuilt.bounds();
+        };
+    }
+}
+
+TEST_CASE( "Render", "[render]" ) {
+    std::vector<std::filesystem::path> scene_files;
+    for( const auto & entry : std::filesystem::directory_iterator(LUTERT_SCENE_DIR) ) {
+        if( entry.path().extension() == ".json" ) scene_files.push_back( entry.path() );
+    }
+    std::sort( scene_files.begin(), scene_files.end() );
+    REQUIRE( !scene_files.empty() );
+
+    for( const auto & path : scene_files ) {
+        std::ifstream input_file( path );
+        json j = json::parse(input_file);
+        j["num_samples"] = 1;
+        j.erase("adaptive");
+        // The scenes reuse material names
+        MaterialLib::clear_names();
+        Scene scene{j};
+
+        BENCHMARK( fmt::format("render {} (1 spp)", path.filename().string()) ) { return scene.render(); };
+    }
+}
+
+TEST_CASE( "Wavefront ray sorting", "[sort]" ) {
+    // The wavefront integrator with its secondary rays traced as they come and sorted.
+    // Build with LUTERT_ENABLE_STATS and render with --stats-json for the BVH node
+    // cache misses of each mode.
+    for( const char * name : { "cornell_box.json", "book_cover.json" } ) {
+        std::ifstream input_file( std::filesystem::path(LUTERT_SCENE_DIR) / name );
+        json j = json::parse(input_file);
+        j["num_samples"] = 4;
+        j.erase("adaptive");
+        json integrator = j.value("integrator", json::object());
+        integrator["type"] = "wavefront";
+        for( bool sort_rays : {false, true} ) {
+            integrator["sort_rays"] = sort_rays;
+            j["integrator"] = integrator;
+            MaterialLib::clear_names();
+            Scene scene{j};
+            BENCHMARK( fmt::format("render {} (4 spp, wavefront{})", name, sort_rays ? ", sorted rays" : "") ) {
+                return scene.render();
+            };
+        }
+    }
+}
@@ -1,57 +1,355 @@
 #include <fmt/core.h>
 #include <fmt/chrono.h>
 #include <fmt/color.h>
+#include <cstdio>
 #include <fstream>
 #include <nlohmann/json.hpp>
 
 #include "scene.h"
+#include "parallel.h"
+#include "heatmap.h"
+#include "stats.h"
+#include "scene_cache.h"
+#include "materiallib.h"
 
 using json = nlohmann::json;
 
-int main(int argc, char** argv) {
-    
-    fmt::print("\n================================================\n");
-    fmt::print("      LuteRT - PLU Educational Ray Tracer\n");
-    fmt::print("================================================\n");
-    
-    if( argc < 2 ) {
-        fmt::print("\nUsage: {} scene_file\n", argv[0] );
-        return 1;
-    }
+namespace {
+    /// Samples per pass when checkpointing without an explicit --progressive
+    constexpr int DEFAULT_PASS_SAMPLES = 8;
 
-    std::string input_path = argv[1];
-    if( input_path.size() >= 5 && input_path.substr( input_path.size() - 5, 5) != ".json" ) {
-        throw LutertException("Input file must have '.json' extension");
+    /// 64-bit FNV-1a hash, identifies a scene description in its checkpoints
+    uint64_t fnv1a( const std::string & s ) {
+        uint64_t h = 14695981039346656037ull;
+        for( unsigned char c : s ) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        return h;
     }
 
-    // Read scene file and parse
-    fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nReading scene file: {}\n", input_path);
-    std::ifstream input_file( argv[1] );
-    json j = json::parse(input_file);
+    /// Parse option's value, count integers separated by commas, e.g. "0,0,64,64"
+    std::vector<int> parse_ints( const std::string & value, size_t count, const std::string & option ) {
+        std::vector<int> ints;
+        size_t start = 0;
+        while( true ) {
+            size_t comma = value.find(',', start);
+            std::string part = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+            size_t used = 0;
+            try {
+                ints.push_back( std::stoi(part, &used) );
+            } catch( const std::logic_error & ) {
+                used = 0;
+            }
+            if( used == 0 || used != part.size() ) {
+                throw LutertException( fmt::format("Invalid value '{}' for {}", value, option) );
+            }
+            if( comma == std::string::npos ) break;
+            start = comma + 1;
+        }
+        if( ints.size() != count ) {
+            throw LutertException( fmt::format("{} takes {} comma separated integers, got '{}'", option, count, value) );
+        }
+        return ints;
+    }
 
-    Scene scn{j};
+    /**
+     * lutert merge: combine partial renders, written with --region and/or
+     * --sample-range, into the final image.
+     */
+    int merge_main( int argc, char ** argv ) {
+        std::string output_path;
+        std::string hdr_format;
+        std::vector<std::string> partial_paths;
+        for( int i = 2; i < argc; i++ ) {
+            std::string arg = argv[i];
+            if( arg == "--hdr" && i + 1 < argc ) {
+                hdr_format = argv[++i];
+                if( hdr_format != "exr" && hdr_format != "pfm" ) {
+                    throw LutertException( fmt::format("Unknown HDR format '{}', expected exr or pfm", hdr_format) );
+                }
+            } else if( output_path.empty() ) {
+                output_path = arg;
+            } else {
+                partial_paths.push_back(arg);
+            }
+        }
+        if( partial_paths.empty() ) {
+            fmt::print("\nUsage: {} merge [--hdr exr|pfm] output.png partial_file...\n", argv[0]);
+            fmt::print("  --hdr exr|pfm                  also write the linear float image in OpenEXR or PFM format\n");
+            return 1;
+        }
+        if( output_path.size() < 4 || output_path.substr(output_path.size() - 4) != ".png" ) {
+            throw LutertException("Output file must have '.png' extension");
+        }
 
-    // GO!
-    fmt::print("\nRendering with {} samples per pixel...\n", scn.samples());
-    Image image = scn.render();
+        std::vector<Accumulator> partials;
+        for( const auto & path : partial_paths ) {
+            partials.push_back( Accumulator::load(path) );
+            const Accumulator & p = partials.back();
+            fmt::print("Read {}: pixels ({}, {}) to ({}, {}), samples {} to {}\n", path,
+                       p.region_min().x, p.region_min().y, p.region_min().x + p.width(), p.region_min().y + p.height(),
+                       p.first_sample(), p.samples());
+        }
+        Image image = Accumulator::merge( std::move(partials) ).image();
 
-    // File name
-    std::string file_name = input_path;
-    size_t idx = input_path.find_last_of("/\\");
-    if( idx != -1 ) {
-        file_name = file_name.substr(idx + 1);
+        fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nWriting image to {}\n", output_path);
+        image.save_png(output_path);
+        if( !hdr_format.empty() ) {
+            std::string hdr_path = output_path.substr(0, output_path.size() - 3) + hdr_format;
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"Writing linear image to {}\n", hdr_path);
+            image.save(hdr_path);
+        }
+        return 0;
     }
-    // Remove .json extension
-    std::string input_file_base = file_name.substr(0, file_name.size() - 5);
 
-    // Get current date
-    auto now = std::chrono::system_clock::now();
-    auto local_time = fmt::localtime(std::chrono::system_clock::to_time_t(now));
-    std::string date_str = fmt::format("{:%Y%m%d_%H%M%S}", local_time);
+    /// lutert [options] scene_file: render a scene, or a part of it
+    int render_main( int argc, char ** argv ) {
+        // Parse command line
+        std::string input_path;
+        int num_threads = 0;
+        int pass_samples = 0;             // Samples per progressive pass, 0 to render in one pass
+        double checkpoint_interval = 0.0; // Minimum number of seconds between checkpoints
+        bool resume = false;
+        std::string hdr_format;           // Extension of a linear float image to write with the PNG, e.g. "exr"
+        std::string stats_json_path;      // Where to write the render statistics as JSON, empty for none
+        std::vector<int> region;          // x0, y0, x1, y1 of the part of the frame to render, empty for all of it
+        std::vector<int> sample_range;    // s0, s1 of the samples to render, empty for all of them
+        bool compile = false;             // Write the scene cache and exit, instead of rendering
+        for( int i = 1; i < argc; i++ ) {
+            std::string arg = argv[i];
+            if( arg == "--threads" && i + 1 < argc ) {
+                num_threads = std::stoi(argv[++i]);
+            } else if( arg == "--progressive" && i + 1 < argc ) {
+                pass_samples = std::stoi(argv[++i]);
+            } else if( arg == "--checkpoint-interval" && i + 1 < argc ) {
+                checkpoint_interval = std::stod(argv[++i]);
+            } else if( arg == "--resume" ) {
+                resume = true;
+            } else if( arg == "--hdr" && i + 1 < argc ) {
+                hdr_format = argv[++i];
+                if( hdr_format != "exr" && hdr_format != "pfm" ) {
+                    throw LutertException( fmt::format("Unknown HDR format '{}', expected exr or pfm", hdr_format) );
+                }
+            } else if( arg == "--region" && i + 1 < argc ) {
+                region = parse_ints(argv[++i], 4, arg);
+            } else if( arg == "--sample-range" && i + 1 < argc ) {
+                sample_range = parse_ints(argv[++i], 2, arg);
+            } else if( arg == "--compile" ) {
+                compile = true;
+            } else if( arg == "--stats-json" && i + 1 < argc ) {
+                stats_json_path = argv[++i];
+            } else {
+                input_path = arg;
+            }
+        }
+
+        if( input_path.empty() ) {
+            fmt::print("\nUsage: {} [--threads N] [--progressive SPP] [--checkpoint-interval SECONDS] [--resume] [--hdr exr|pfm] [--stats-json FILE]\n"
+                       "          [--region X0,Y0,X1,Y1] [--sample-range S0,S1] scene_file\n"
+                       "       {} --compile scene_file\n"
+                       "       {} merge [--hdr exr|pfm] output.png partial_file...\n", argv[0], argv[0], argv[0] );
+            fmt::print("  --progressive SPP              render in passes of SPP samples, writing a checkpoint after each pass\n");
+            fmt::print("  --checkpoint-interval SECONDS  write checkpoints at most this often (implies --progressive {})\n", DEFAULT_PASS_SAMPLES);
+            fmt::print("  --resume                       continue from the scene's last checkpoint\n");
+            fmt::print("  --hdr exr|pfm                  also write the linear float image in OpenEXR or PFM format\n");
+            fmt::print("  --stats-json FILE              write the render statistics to FILE as JSON\n");
+            fmt::print("  --region X0,Y0,X1,Y1           render only the pixels [X0, X1) x [Y0, Y1) to a partial file\n");
+            fmt::print("  --sample-range S0,S1           render only the samples [S0, S1) of each pixel to a partial file\n");
+            fmt::print("  --compile                      write the scene's binary cache (scene.lsc next to scene.json) and exit;\n"
+                       "                                 a render reads the cache instead of the JSON while the cache is up to date\n");
+            fmt::print("  merge                          combine partial files into the final image\n");
+            return 1;
+        }
+        // Checkpointing and resuming need a progressive render
+        if( pass_samples <= 0 && (checkpoint_interval > 0.0 || resume) ) pass_samples = DEFAULT_PASS_SAMPLES;
+
+        if( input_path.size() >= 5 && input_path.substr( input_path.size() - 5, 5) != ".json" ) {
+            throw LutertException("Input file must have '.json' extension");
+        }
+
+        // Read the scene from its cache if that is up to date, otherwise parse the scene file
+        std::string cache_path = SceneCache::cache_name(input_path);
+        uint64_t scene_id = 0;
+        // The phase of the program being timed for the statistics
+        std::optional<stats::ScopedPhase> phase;
+        phase.emplace("parse");
+        Scene scn = [&]() {
+            if( !compile && SceneCache::is_fresh(cache_path, input_path) ) {
+                fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nReading scene cache: {}\n", cache_path);
+                try {
+                    return Scene::load_cache( cache_path, &scene_id );
+                } catch( const LutertException & e ) {
+                    fmt::print("{}, reading the scene file instead\n", e.what());
+                    MaterialLib::clear_names();
+                }
+            }
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nReading scene file: {}\n", input_path);
+            std::ifstream input_file( input_path );
+            json j = json::parse(input_file);
+            scene_id = fnv1a( j.dump() );
+            Scene scene{j};
+            if( compile ) {
+                scene.save_cache( cache_path, j, scene_id );
+                fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nScene cache written to {}\n", cache_path);
+            }
+            return scene;
+        }();
+        phase.reset();
+        if( compile ) return 0;
+
+        // File name
+        std::string file_name = input_path;
+        size_t idx = input_path.find_last_of("/\\");
+        if( idx != -1 ) {
+            file_name = file_name.substr(idx + 1);
+        }
+        // Remove .json extension
+        std::string input_file_base = file_name.substr(0, file_name.size() - 5);
+
+        // Get current date
+        auto now = std::chrono::system_clock::now();
+        auto local_time = fmt::localtime(std::chrono::system_clock::to_time_t(now));
+        std::string date_str = fmt::format("{:%Y%m%d_%H%M%S}", local_time);
+
+        // A part of the frame or of the samples is written to a partial file, for lutert merge
+        Vec2i resolution = scn.get_camera().get_resolution();
+        bool partial = !region.empty() || !sample_range.empty();
+        Vec2i region_min{0, 0}, region_max = resolution;
+        if( !region.empty() ) {
+            region_min = { region[0], region[1] };
+            region_max = { region[2], region[3] };
+        }
+        int first_sample = 0, end_sample = scn.samples();
+        if( !sample_range.empty() ) {
+            first_sample = sample_range[0];
+            end_sample = std::min( sample_range[1], scn.samples() );
+            if( first_sample < 0 || first_sample >= end_sample ) {
+                throw LutertException( fmt::format("Sample range [{}, {}) is empty or outside [0, {})",
+                                                   sample_range[0], sample_range[1], scn.samples()) );
+            }
+        }
+        // Each partial job gets its own checkpoint and preview
+        std::string job_name = input_file_base;
+        if( partial ) {
+            job_name = fmt::format("{}-{}_{}_{}_{}-s{}_{}", input_file_base, region_min.x, region_min.y,
+                                   region_max.x, region_max.y, first_sample, end_sample);
+        }
+
+        std::string output_file_name = fmt::format("report/renders/{}-{}spp-{}.png", input_file_base, scn.samples(), date_str);
+        std::string partial_file_name = fmt::format("report/renders/{}.partial", job_name);
+        std::string checkpoint_file_name = fmt::format("report/renders/{}.checkpoint", job_name);
+        std::string progress_file_name = fmt::format("report/renders/{}-progress.png", job_name);
 
-    std::string output_file_name = fmt::format("report/renders/{}-{}spp-{}.png", input_file_base, scn.samples(), date_str);
+        // GO!
+        if( num_threads <= 0 ) num_threads = default_thread_count();
+        Accumulator acc( resolution, region_min, region_max, scene_id );
+        acc.start_at_sample(first_sample);
+        if( resume ) {
+            // A job that is restarted with the same command line may not have written a checkpoint yet
+            if( std::ifstream(checkpoint_file_name) ) {
+                acc = Accumulator::load( checkpoint_file_name, scene_id );
+                fmt::print("\nResuming from {} at {} samples per pixel\n", checkpoint_file_name, acc.samples());
+            } else {
+                fmt::print("\nNo checkpoint {} found, starting from the beginning\n", checkpoint_file_name);
+            }
+        }
 
-    // Write output
-    fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nWriting image to {}\n", output_file_name);
-    image.save_png(output_file_name);
+        if( partial ) {
+            fmt::print("\nRendering pixels ({}, {}) to ({}, {}), samples {} to {}, on {} threads...\n",
+                       region_min.x, region_min.y, region_max.x, region_max.y, first_sample, end_sample, num_threads);
+        } else {
+            fmt::print("\nRendering with {} samples per pixel on {} threads...\n", scn.samples(), num_threads);
+        }
+        phase.emplace("render");
+        if( pass_samples <= 0 ) {
+            scn.render_samples( acc, end_sample, num_threads );
+        } else {
+            // Progressive: passes over the whole frame, with a checkpoint and a preview image
+            // after each pass that ends at least checkpoint_interval seconds after the previous
+            // checkpoint.  The last pass is followed by the final image instead.
+            auto last_checkpoint = std::chrono::steady_clock::now();
+            scn.render_passes( acc, end_sample, pass_samples, num_threads, [&]( const Accumulator & acc ) {
+                auto now = std::chrono::steady_clock::now();
+                if( std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval ) {
+                    acc.save( checkpoint_file_name );
+                    acc.image().save_png( progress_file_name );
+                    last_checkpoint = now;
+                    fmt::print("Checkpoint at {} samples per pixel written to {}\n", acc.samples(), checkpoint_file_name);
+                }
+            });
+        }
+        phase.emplace("write");
+        if( partial ) {
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nWriting partial render to {}\n", partial_file_name);
+            acc.save( partial_file_name );
+        } else {
+            Image image = acc.image();
+            Image spp_map = acc.spp_map();
+
+            // Write output
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"\nWriting image to {}\n", output_file_name);
+            image.save_png(output_file_name);
+            if( !hdr_format.empty() ) {
+                std::string hdr_file_name = fmt::format("report/renders/{}-{}spp-{}.{}", input_file_base, scn.samples(), date_str, hdr_format);
+                fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"Writing linear image to {}\n", hdr_file_name);
+                image.save(hdr_file_name);
+            }
+
+            // With adaptive sampling, also write where the samples went
+            if( scn.is_adaptive() ) {
+                double total = 0.0;
+                float min_spp = spp_map(0, 0).x, max_spp = min_spp;
+                Image heatmap( spp_map.width(), spp_map.height() );
+                for( int y = 0; y < spp_map.height(); y++ ) {
+                    for( int x = 0; x < spp_map.width(); x++ ) {
+                        float spp = spp_map(x, y).x;
+                        total += spp;
+                        min_spp = std::min(min_spp, spp);
+                        max_spp = std::max(max_spp, spp);
+                        heatmap(x, y) = InfernoHeatmap::heatmap( spp / float(scn.samples()) );
+                    }
+                }
+                fmt::print("Samples per pixel: average {:.1f}, min {}, max {}\n",
+                           total / (double(spp_map.width()) * spp_map.height()), min_spp, max_spp);
+
+                std::string spp_file_name = fmt::format("report/renders/{}-{}spp-{}-spp.png", input_file_base, scn.samples(), date_str);
+                fmt::print(fmt::emphasis::bold | fg(fmt::color::light_green),"Writing samples per pixel heatmap to {}\n", spp_file_name);
+                heatmap.save_png(spp_file_name);
+            }
+        }
+
+        // The render is complete, so its checkpoint and preview are no longer needed
+        if( pass_samples > 0 ) {
+            std::remove( checkpoint_file_name.c_str() );
+            std::remove( progress_file_name.c_str() );
+        }
+        phase.reset();
+
+        stats::print_summary();
+        if( !stats_json_path.empty() ) {
+            std::ofstream out( stats_json_path );
+            out << stats::to_json().dump(4) << "\n";
+            if( !out ) throw LutertException( fmt::format("Error writing statistics to {}", stats_json_path) );
+            fmt::print("Statistics written to {}\n", stats_json_path);
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    
+    fmt::print("\n================================================\n");
+    fmt::print("      LuteRT - PLU Educational Ray Tracer\n");
+    fmt::print("================================================\n");
+
+    try {
+        if( argc > 1 && std::string(argv[1]) == "merge" ) return merge_main(argc, argv);
+        return render_main(argc, argv);
+    } catch( const LutertException & e ) {
+        fmt::print(stderr, "\nError: {}\n", e.what());
+    } catch( const LutertParseException & e ) {
+        fmt::print(stderr, "\nError in the scene file: {}\n", e.what());
+    }
+    return 1;
 }
@@ -1,7 +1,15 @@
+#include <deque>
+
 #include "materiallib.h"
 
 namespace MaterialLib {
-    std::unordered_map<std::string, std::shared_ptr<Material>> materials;
+    // Every loaded material, stored by type.  A deque never moves its elements, so
+    // the pointers handed out stay valid as more materials are loaded.
+    std::deque<Lambertian> lambertians;
+    std::deque<Metal> metals;
+    std::deque<Dielectric> dielectrics;
+    std::deque<Light> lights;
+    std::unordered_map<std::string, const Material *> materials;  ///< Name lookup into the storage above
 
     void load(const json & j) {
         if( ! j.is_array() ) throw LutertParseException("materials property must be an array");
@@ -16,15 +24,15 @@ namespace MaterialLib {
             }
 
             std::string type = jmat["type"];
-            std::shared_ptr<Material> mat = nullptr;
+            const Material * mat = nullptr;
             if( type == "lambertian" ) {
-                mat = std::make_shared<Lambertian>(jmat);
+                mat = &lambertians.emplace_back(jmat);
             } else if( type == "metal") {
-                mat = std::make_shared<Metal>(jmat);
+                mat = &metals.emplace_back(jmat);
             } else if( type == "dielectric" ) {
-                mat = std::make_shared<Dielectric>(jmat);
+                mat = &dielectrics.emplace_back(jmat);
             } else if( type == "light" ) {
-                mat = std::make_shared<Light>(jmat);
+                mat = &lights.emplace_back(jmat);
             } else {
                 throw LutertParseException(fmt::format("Unrecognized material type: {}", type));
             }
@@ -33,10 +41,21 @@ namespace MaterialLib {
         }
     }
 
-    std::shared_ptr<Material> find( const std::string & name ) {
+    const Material * find( const std::string & name ) {
         auto value = materials.find(name);
         if( value == materials.end() )
             throw LutertException(fmt::format("No material named '{}'", name));
         return value->second;
     }
+
+    std::string name_of( const Material * material ) {
+        for( const auto & [name, m] : materials ) {
+            if( m == material ) return name;
+        }
+        throw LutertException("Material is not in the material library");
+    }
+
+    void clear_names() {
+        materials.clear();
+    }
 }
\ No newline at end of file
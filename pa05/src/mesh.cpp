@@ -0,0 +1,271 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+#include <unordered_map>
+
+#include "mesh.h"
+#include "materiallib.h"
+#include "scene_cache.h"
+
+namespace {
+    /**
+     * The per-ray part of the watertight triangle test.  The ray direction's largest
+     * axis becomes z, and the shear that maps the direction to +z is computed once per
+     * ray, instead of once per triangle.
+     */
+    struct WatertightRay {
+        int kx, ky, kz;
+        float sx, sy, sz;
+
+        WatertightRay() = default;
+        explicit WatertightRay( const Ray & ray ) {
+            Vec3f ad = linalg::abs(ray.d);
+            kz = ad.x > ad.y ? (ad.x > ad.z ? 0 : 2) : (ad.y > ad.z ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            // Swap to preserve the winding direction of the triangles
+            if( ray.d[kz] < 0.0f ) std::swap(kx, ky);
+
+            sx = ray.d[kx] / ray.d[kz];
+            sy = ray.d[ky] / ray.d[kz];
+            sz = 1.0f / ray.d[kz];
+        }
+    };
+
+    /**
+     * Watertight ray-triangle intersection.
+     *
+     * @param t set to the ray distance on a hit
+     * @param bary set to the barycentric coordinates of p0, p1 and p2 on a hit
+     * @return true if the ray hits the triangle within [ray.mint, ray.maxt]
+     */
+    bool intersect_triangle( const Ray & ray, const WatertightRay & wr,
+                             const Vec3f & p0, const Vec3f & p1, const Vec3f & p2,
+                             float & t, Vec3f & bary ) {
+        // Vertices relative to the ray origin
+        Vec3f a = p0 - ray.o;
+        Vec3f b = p1 - ray.o;
+        Vec3f c = p2 - ray.o;
+
+        // Shear so that the ray direction is +z
+        float ax = a[wr.kx] - wr.sx * a[wr.kz];
+        float ay = a[wr.ky] - wr.sy * a[wr.kz];
+        float bx = b[wr.kx] - wr.sx * b[wr.kz];
+        float by = b[wr.ky] - wr.sy * b[wr.kz];
+        float cx = c[wr.kx] - wr.sx * c[wr.kz];
+        float cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+        // Scaled barycentric coordinates (2D edge functions)
+        float u = cx * by - cy * bx;
+        float v = ax * cy - ay * cx;
+        float w = bx * ay - by * ax;
+
+        // On an edge, recompute in double precision so neighbouring triangles agree
+        if( u == 0.0f || v == 0.0f || w == 0.0f ) {
+            u = float( double(cx) * double(by) - double(cy) * double(bx) );
+            v = float( double(ax) * double(cy) - double(ay) * double(cx) );
+            w = float( double(bx) * double(ay) - double(by) * double(ax) );
+        }
+
+        if( (u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f) ) return false;
+
+        float det = u + v + w;
+        if( det == 0.0f ) return false;
+
+        float az = wr.sz * a[wr.kz];
+        float bz = wr.sz * b[wr.kz];
+        float cz = wr.sz * c[wr.kz];
+        float inv_det = 1.0f / det;
+        t = (u * az + v * bz + w * cz) * inv_det;
+        if( !(t >= ray.mint && t <= ray.maxt) ) return false;
+
+        bary = Vec3f{u, v, w} * inv_det;
+        return true;
+    }
+}
+
+Mesh::Mesh( std::shared_ptr<const MeshData> data, const Material * material ) :
+    data(std::move(data)), material(material) {
+    build();
+}
+
+Mesh::Mesh( const json & j ) {
+    if( !j.contains("filename") ) throw LutertParseException("Mesh found without filename");
+    Transform xform = j.value("transform", Transform());
+    data = load_obj( j["filename"].get<std::string>(), xform );
+    if( j.contains("material") ) {
+        material = MaterialLib::find(j.value("material", std::string("")));
+    }
+    build();
+}
+
+std::shared_ptr<MeshData> Mesh::load_obj( const std::string & filename, const Transform & t ) {
+    tinyobj::ObjReaderConfig config;
+    config.triangulate = true;
+    tinyobj::ObjReader reader;
+    if( !reader.ParseFromFile(filename, config) ) {
+        throw LutertParseException( fmt::format("Unable to read OBJ file '{}': {}", filename, reader.Error()) );
+    }
+
+    const tinyobj::attrib_t & attrib = reader.GetAttrib();
+
+    // Only use normals if every vertex has one
+    bool has_normals = !attrib.normals.empty();
+    size_t num_indices = 0;
+    for( const auto & shape : reader.GetShapes() ) {
+        num_indices += shape.mesh.indices.size();
+        for( const auto & idx : shape.mesh.indices ) {
+            if( idx.normal_index < 0 ) has_normals = false;
+        }
+    }
+
+    // OBJ indexes positions and normals separately, so each distinct
+    // (position, normal) pair becomes one vertex.
+    auto mesh = std::make_shared<MeshData>();
+    mesh->indices.reserve(num_indices);
+    std::unordered_map<uint64_t, uint32_t> vertex_ids;
+    for( const auto & shape : reader.GetShapes() ) {
+        for( const auto & idx : shape.mesh.indices ) {
+            int normal_index = has_normals ? idx.normal_index : 0;
+            uint64_t key = (uint64_t(uint32_t(idx.vertex_index)) << 32) | uint32_t(normal_index);
+            auto found = vertex_ids.find(key);
+            if( found != vertex_ids.end() ) {
+                mesh->indices.push_back(found->second);
+                continue;
+            }
+
+            uint32_t id = uint32_t(mesh->positions.size());
+            vertex_ids[key] = id;
+            mesh->indices.push_back(id);
+
+            const float * p = &attrib.vertices[3 * size_t(idx.vertex_index)];
+            mesh->positions.push_back( t.transform_point({p[0], p[1], p[2]}) );
+            if( has_normals ) {
+                const float * n = &attrib.normals[3 * size_t(normal_index)];
+                mesh->normals.push_back( t.transform_normal({n[0], n[1], n[2]}) );
+            }
+        }
+    }
+    return mesh;
+}
+
+void Mesh::build() {
+    const auto & p = data->positions;
+    const auto & idx = data->indices;
+    std::vector<Bounds3f> tri_bounds( data->num_triangles() );
+    for( size_t i = 0; i < tri_bounds.size(); i++ ) {
+        tri_bounds[i].extend( p[idx[3 * i + 0]] );
+        tri_bounds[i].extend( p[idx[3 * i + 1]] );
+        tri_bounds[i].extend( p[idx[3 * i + 2]] );
+    }
+    tree.build(tri_bounds);
+}
+
+bool Mesh::intersect_t( Ray & ray, PrimitiveHit & hit ) const {
+    const auto & p = data->positions;
+    const auto & idx = data->indices;
+
+    WatertightRay wr(ray);
+    return tree.traverse( ray, [&]( uint32_t tri ) {
+        float t;
+        Vec3f bary;
+        if( !intersect_triangle(ray, wr, p[idx[3 * tri]], p[idx[3 * tri + 1]], p[idx[3 * tri + 2]], t, bary) ) {
+            return false;
+        }
+        ray.maxt = t;
+        hit = { t, this, tri, {bary.y, bary.z} };
+        return true;
+    });
+}
+
+bool Mesh::occluded( const Ray & ray ) const {
+    const auto & p = data->positions;
+    const auto & idx = data->indices;
+
+    WatertightRay wr(ray);
+    return tree.traverse_any( ray, [&]( uint32_t tri ) {
+        float t;
+        Vec3f bary;
+        return intersect_triangle(ray, wr, p[idx[3 * tri]], p[idx[3 * tri + 1]], p[idx[3 * tri + 2]], t, bary);
+    });
+}
+
+uint32_t Mesh::intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const {
+    const auto & p = data->positions;
+    const auto & idx = data->indices;
+
+    // The tree is traversed once for the whole packet, the triangles are tested one ray at a time
+    Ray rays[PACKET_SIZE];
+    WatertightRay wr[PACKET_SIZE];
+    for( uint32_t lanes = packet.active; lanes != 0; lanes &= lanes - 1 ) {
+        int lane = simd::first_lane(lanes);
+        rays[lane] = packet.get(lane);
+        wr[lane] = WatertightRay(rays[lane]);
+    }
+
+    return tree.traverse_packet( packet, [&]( uint32_t tri, uint32_t lanes ) {
+        uint32_t hit_mask = 0;
+        for( ; lanes != 0; lanes &= lanes - 1 ) {
+            int lane = simd::first_lane(lanes);
+            float t;
+            Vec3f bary;
+            if( !intersect_triangle(rays[lane], wr[lane], p[idx[3 * tri]], p[idx[3 * tri + 1]], p[idx[3 * tri + 2]], t, bary) ) {
+                continue;
+            }
+            rays[lane].maxt = packet.maxt[lane] = t;
+            hits[lane] = { t, this, tri, {bary.y, bary.z} };
+            hit_mask |= 1u << lane;
+        }
+        return hit_mask;
+    });
+}
+
+HitRecord Mesh::shade( const Ray & ray, const PrimitiveHit & prim ) const {
+    const auto & p = data->positions;
+    const auto & idx = data->indices;
+    uint32_t i0 = idx[3 * prim.prim_id], i1 = idx[3 * prim.prim_id + 1], i2 = idx[3 * prim.prim_id + 2];
+    Vec3f hit_bary{ 1.0f - prim.uv.x - prim.uv.y, prim.uv.x, prim.uv.y };
+
+    HitRecord hit;
+    hit.t = prim.t;
+    hit.p = hit_bary.x * p[i0] + hit_bary.y * p[i1] + hit_bary.z * p[i2];
+    hit.gn = normalize( cross(p[i1] - p[i0], p[i2] - p[i0]) );
+    hit.sn = hit.gn;
+    if( !data->normals.empty() ) {
+        const auto & n = data->normals;
+        hit.sn = normalize( hit_bary.x * n[i0] + hit_bary.y * n[i1] + hit_bary.z * n[i2] );
+        // Keep the geometric normal on the same side as the shading normal
+        if( dot(hit.gn, hit.sn) < 0.0f ) hit.gn = -hit.gn;
+    }
+    hit.material = material;
+    hit.surface = this;
+    return hit;
+}
+
+void Mesh::save( SceneWriter & out ) const {
+    out.write(SceneCache::MESH);
+    out.write_vector(data->positions);
+    out.write_vector(data->normals);
+    out.write_vector(data->indices);
+    out.write_material(material);
+    tree.save(out);
+}
+
+std::shared_ptr<Mesh> Mesh::load( SceneReader & in ) {
+    auto loaded = std::make_shared<MeshData>();
+    loaded->positions = in.read_vector<Vec3f>();
+    loaded->normals = in.read_vector<Vec3f>();
+    loaded->indices = in.read_vector<uint32_t>();
+    if( loaded->indices.size() % 3 != 0 ||
+        (!loaded->normals.empty() && loaded->normals.size() != loaded->positions.size()) ) {
+        throw LutertException("Invalid mesh in scene cache");
+    }
+    for( uint32_t index : loaded->indices ) {
+        if( index >= loaded->positions.size() ) throw LutertException("Invalid mesh in scene cache");
+    }
+
+    std::shared_ptr<Mesh> mesh( new Mesh() );
+    mesh->data = std::move(loaded);
+    mesh->material = in.read_material();
+    mesh->tree.load(in, mesh->data->num_triangles());
+    return mesh;
+}
@@ -1,21 +1,20 @@
 #include "material.h"
 #include "random.h"
+#include "stats.h"
 
 /**
- * ==================================== TASK 6 =========================================================== 
- * Implement scattering from a metal material.  If the scatter is successful, return a ScatterInfo struct
- * with the `scattered` field containing the scattered Ray and the value of this material's `albedo` in
- * the `attenuation` field.  
- * 
- * The scattered ray's origin should be set to the intersection point (hit.p). To compute the scattered 
- * ray's direction, use the `reflect` function to calculate the reflected
- * direction, and add a random vector on the unit sphere (function `random_on_unit_sphere`) scaled 
- * by `roughness`.
- * 
- * It is possible that the scattered direction may be below the surface.  Check for this with the
- * dot product of the scattered direction and the shading normal.  If it is below the surface,
- * return false.  Otherwise, return {} (empty).
+ * Scattering from a metal material.  The incoming direction is reflected about the shading normal,
+ * and perturbed by a random vector on the unit sphere scaled by `roughness`.  If the perturbed
+ * direction ends up below the surface the ray is absorbed and {} (empty) is returned.  The
+ * attenuation is the material's `albedo`.
  */
-std::optional<ScatterInfo> Metal::scatter( const Ray & r, const HitRecord & hit ) const {
-    return {};  // replace this
+std::optional<ScatterInfo> Metal::scatter( const Ray & r, const HitRecord & hit, Sampler & sampler ) const {
+    LUTERT_STAT( stats::local().scatter_calls[stats::METAL]++ );
+    Vec3f dir = reflect(normalize(r.d), hit.sn) + roughness * random_on_unit_sphere(sampler);
+    if( dot(dir, hit.sn) <= 0.0f ) return {};
+
+    ScatterInfo info;
+    info.attenuation = albedo;
+    info.scattered = Ray(hit.p, dir);
+    return info;
 }
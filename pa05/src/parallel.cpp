@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+namespace {
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<int> items;
+
+        bool pop_front( int & item ) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if( items.empty() ) return false;
+            item = items.front();
+            items.pop_front();
+            return true;
+        }
+
+        bool pop_back( int & item ) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if( items.empty() ) return false;
+            item = items.back();
+            items.pop_back();
+            return true;
+        }
+    };
+}
+
+int default_thread_count() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : int(n);
+}
+
+void parallel_for( int count, const std::function<void(int)> & func, int num_threads ) {
+    if( count <= 0 ) return;
+    if( num_threads <= 0 ) num_threads = default_thread_count();
+    num_threads = std::min(num_threads, count);
+
+    if( num_threads == 1 ) {
+        for( int i = 0; i < count; i++ ) func(i);
+        return;
+    }
+
+    std::vector<WorkQueue> queues(num_threads);
+    for( int i = 0; i < count; i++ ) {
+        queues[i % num_threads].items.push_back(i);
+    }
+
+    std::atomic_bool failed{false};
+    std::exception_ptr error = nullptr;
+    std::mutex error_mutex;
+
+    auto worker = [&]( int id ) {
+        int item;
+        while( !failed ) {
+            bool found = queues[id].pop_front(item);
+            for( int k = 1; !found && k < num_threads; k++ ) {
+                found = queues[(id + k) % num_threads].pop_back(item);
+            }
+            // No new work is ever added, so empty queues everywhere means we are done.
+            if( !found ) return;
+
+            try {
+                func(item);
+            } catch( ... ) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if( !error ) error = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for( int id = 1; id < num_threads; id++ ) {
+        threads.emplace_back(worker, id);
+    }
+    worker(0);
+    for( auto & t : threads ) t.join();
+
+    if( error ) std::rethrow_exception(error);
+}
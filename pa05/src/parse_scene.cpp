@@ -1,40 +1,137 @@
 #include "scene.h"
 #include "materiallib.h"
 #include "sphere.h"
+#include "sphere_set.h"
 #include "quad.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "instance.h"
+#include "stats.h"
 
 void Scene::parse_scene( const json & j ) {
+    parse_settings(j);
+
+    // Prototypes: named geometry that "instance" surfaces place with their own transform
+    std::map<std::string, std::shared_ptr<const Surface>> prototypes;
+    if( j.contains("prototypes") ) {
+        if( !j["prototypes"].is_array() ) throw LutertParseException("prototypes should be an array");
+        for( const auto & jproto : j["prototypes"] ) {
+            if( !jproto.contains("name") ) throw LutertParseException("Prototype found without name");
+            std::string name = jproto["name"];
+            if( prototypes.count(name) ) throw LutertParseException(fmt::format("Prototype name '{}' used more than once", name));
+            auto proto = parse_surfaces( jproto.value("surfaces", json::array()), nullptr );
+            for( const auto & surf : proto->get_surfaces() ) {
+                // Only top-level surfaces are sampled as lights
+                if( surf->is_area_light() ) {
+                    throw LutertParseException(fmt::format("Prototype '{}' contains a light, lights cannot be instanced", name));
+                }
+            }
+            prototypes[name] = proto;
+        }
+    }
+
+    set_surfaces( parse_surfaces( j.value("surfaces", json::array()), &prototypes ) );
+}
+
+std::shared_ptr<BVH> Scene::parse_surfaces( const json & jsurfaces,
+                                            const std::map<std::string, std::shared_ptr<const Surface>> * prototypes ) {
+    if( !jsurfaces.is_array() ) throw LutertParseException("surfaces should be an array");
+
+    auto bvh = std::make_shared<BVH>();
+    // Spheres that can go into a SphereSet
+    std::vector<std::shared_ptr<Sphere>> world_spheres;
+
+    for( const auto & jsurf : jsurfaces ) {
+        if( !jsurf.contains("type") ) throw LutertParseException("Surface found without type");
+        std::string type = jsurf["type"];
+        std::shared_ptr<Surface> surf = nullptr;
+        if( type == "sphere" ) {
+            auto sphere = std::make_shared<Sphere>(jsurf);
+            if( sphere->is_world_space() && !sphere->is_area_light() ) {
+                world_spheres.push_back(sphere);
+                continue;
+            }
+            surf = sphere;
+        } else if( type == "quad" ) {
+            surf = std::make_shared<Quad>(jsurf);
+        } else if( type == "mesh" ) {
+            surf = std::make_shared<Mesh>(jsurf);
+        } else if( type == "instance" ) {
+            if( !prototypes ) throw LutertParseException("Instances cannot be used inside a prototype");
+            std::string name = jsurf.value("prototype", std::string(""));
+            auto proto = prototypes->find(name);
+            if( proto == prototypes->end() ) throw LutertParseException(fmt::format("Prototype '{}' not found", name));
+            surf = std::make_shared<Instance>( proto->second, jsurf.value("transform", Transform()) );
+        } else {
+            throw LutertParseException(fmt::format("Surface type '{}' not recognized", type));
+        }
+        bvh->add(surf);
+    }
+
+    stats::ScopedPhase build_phase("build");
+    if( world_spheres.size() >= MIN_SPHERE_SET_SIZE ) {
+        auto sphere_set = std::make_shared<SphereSet>();
+        for( const auto & sphere : world_spheres ) {
+            sphere_set->add( sphere->get_center(), sphere->get_world_radius(), sphere->get_material() );
+        }
+        sphere_set->build();
+        bvh->add(sphere_set);
+    } else {
+        for( const auto & sphere : world_spheres ) bvh->add(sphere);
+    }
+
+    bvh->build();
+    return bvh;
+}
+
+void Scene::set_surfaces( const std::shared_ptr<BVH> & bvh ) {
+    surfaces = bvh;
+    lights.clear();
+    for( const auto & surf : bvh->get_surfaces() ) {
+        if( surf->is_area_light() ) lights.push_back(surf.get());
+    }
+}
+
+void Scene::parse_settings( const json & j ) {
     num_samples = j.value("num_samples", num_samples);
     background = j.value("background", background);
 
+    if( j.contains("adaptive") ) {
+        const json & jad = j["adaptive"];
+        min_samples = jad.value("min_samples", 16);
+        adaptive_threshold = jad.value("threshold", adaptive_threshold);
+        if( min_samples < 1 ) throw LutertParseException("adaptive min_samples must be at least 1");
+        if( adaptive_threshold <= 0.0f ) throw LutertParseException("adaptive threshold must be positive");
+    }
+
     if(! j.contains("camera") ) {
         throw LutertParseException("Scene must include a camera");
     }
 
+    if( j.contains("integrator") ) {
+        const json & jint = j["integrator"];
+        std::string type = jint.value("type", std::string("recursive"));
+        if( type == "recursive" ) {
+            integrator = Integrator::Recursive;
+        } else if( type == "path" ) {
+            integrator = Integrator::Path;
+        } else if( type == "wavefront" ) {
+            integrator = Integrator::Wavefront;
+        } else {
+            throw LutertParseException(fmt::format("Integrator type '{}' not recognized", type));
+        }
+        rr_depth = jint.value("rr_depth", rr_depth);
+        nee = jint.value("nee", nee);
+        sort_rays = jint.value("sort_rays", sort_rays);
+        if( rr_depth < 0 ) throw LutertParseException("rr_depth must not be negative");
+        if( sort_rays && integrator != Integrator::Wavefront ) {
+            throw LutertParseException(fmt::format("sort_rays needs the wavefront integrator, not '{}'", type));
+        }
+    }
+
     // Parse camera
     camera = std::make_shared<Camera>(j["camera"] );
 
     // Materials
     if( j.contains("materials") ) MaterialLib::load(j["materials"]);
-
-    // Surfaces
-    surfaces = std::make_shared<Group>();
-
-    if( j.contains("surfaces") ) {
-        if( !j["surfaces"].is_array() ) throw LutertParseException("surfaces should be an array");
-
-        for( const auto & jsurf : j["surfaces"] ) {
-            if( !jsurf.contains("type") ) throw LutertParseException("Surface found without type");
-            std::string type = jsurf["type"];
-            std::shared_ptr<Surface> surf = nullptr;
-            if( type == "sphere" ) {
-                surf = std::make_shared<Sphere>(jsurf);
-            } else if( type == "quad" ) {
-                surf = std::make_shared<Quad>(jsurf);
-            } else {
-                throw LutertParseException(fmt::format("Surface type '{}' not recognized", type));
-            }
-            surfaces->add(surf);
-        }
-    }
-}
\ No newline at end of file
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fmt/core.h>
 #include <vector>
 #include "progressbar.h"
@@ -51,7 +52,8 @@ void ProgressBar::run() {
                        pct * 100.0, time_str, remaining_size);
             std::fflush(stdout);
 
-            std::this_thread::sleep_for( sleep_time );
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for( lock, sleep_time, [this] { return done; } );
         }
     }
 
@@ -1,5 +1,6 @@
 #include "quad.h"
 #include "materiallib.h"
+#include "scene_cache.h"
 
 Quad::Quad(const json &j) {
     size = j.value("size", size);
@@ -7,29 +8,141 @@ Quad::Quad(const json &j) {
     if( j.contains("material") ) {
         material = MaterialLib::find(j.value("material", std::string("")));
     }
+    init();
 }
 
-std::optional<HitRecord> Quad::intersect(Ray &ray) const {
-    // Transform Ray into local space
-    Ray xray = xform.inverse().transform_ray(ray);
+void Quad::init() {
+    for( int i = 0; i < 3; i++ ) {
+        inv_rows[i] = xform.inverse_row(i);
+    }
+    normal = xform.transform_normal({0,0,1});
+    inv_area = 1.0f / (size.x * size.y * xform.area_scale({0,0,1}));
+}
+
+bool Quad::hit_local(const Ray &ray, float &t, Vec2f &xy) const {
+    // Local z of the ray direction and origin
+    Vec3f z_row = inv_rows[2].xyz();
+    float dz = dot(z_row, ray.d);
 
     // If z is 0.0, ray is parallel to quad's plane
-    if( std::fabs(xray.d.z) < 1e-5f ) {
-        return {};
+    if( std::fabs(dz) < 1e-5f ) {
+        return false;
     }
 
-    // Intersection of ray and x-y plane
-    float t = -xray.o.z / xray.d.z;
-    if( t < xray.mint || t > xray.maxt ) return {};
+    // Intersection of ray and local x-y plane, t is the same in local and world space
+    t = -(dot(z_row, ray.o) + inv_rows[2].w) / dz;
+    if( t < ray.mint || t > ray.maxt ) return false;
+
+    Vec3f p = ray.at(t);
+    float x = dot(inv_rows[0].xyz(), p) + inv_rows[0].w;
+    float y = dot(inv_rows[1].xyz(), p) + inv_rows[1].w;
+    if( std::fabs(x) > size.x * 0.5f || std::fabs(y) > size.y * 0.5f ) return false;
 
-    auto p = xray.at(t);
-    if( std::fabs(p.x) > size.x * 0.5f || std::fabs(p.y) > size.y * 0.5f ) return {};
+    xy = {x, y};
+    return true;
+}
+
+bool Quad::intersect_t(Ray &ray, PrimitiveHit &hit) const {
+    float t;
+    Vec2f xy;
+    if( !hit_local(ray, t, xy) ) return false;
 
     // We have a hit!
+    ray.maxt = t;
+    hit = { t, this, 0, xy };
+    return true;
+}
+
+bool Quad::occluded(const Ray &ray) const {
+    float t;
+    Vec2f xy;
+    return hit_local(ray, t, xy);
+}
+
+uint32_t Quad::intersect_packet(RayPacket &packet, PrimitiveHit *hits) const {
+    using simd::vfloat8;
+    vfloat8 o[3], d[3];
+    for( int i = 0; i < 3; i++ ) {
+        o[i] = vfloat8::load(packet.o[i]);
+        d[i] = vfloat8::load(packet.d[i]);
+    }
+
+    // Local coordinate `row` of the points o + t * d, as in intersect_t(...)
+    auto local = [&]( int row, vfloat8 t ) {
+        const Vec4f & r = inv_rows[row];
+        return vfloat8(r.x) * (o[0] + t * d[0]) + vfloat8(r.y) * (o[1] + t * d[1])
+             + vfloat8(r.z) * (o[2] + t * d[2]) + vfloat8(r.w);
+    };
+
+    const Vec4f & z_row = inv_rows[2];
+    vfloat8 dz = vfloat8(z_row.x) * d[0] + vfloat8(z_row.y) * d[1] + vfloat8(z_row.z) * d[2];
+    uint32_t mask = (simd::abs(dz) >= vfloat8(1e-5f)).bits() & packet.active;
+    if( mask == 0 ) return 0;
+
+    vfloat8 oz = vfloat8(z_row.x) * o[0] + vfloat8(z_row.y) * o[1] + vfloat8(z_row.z) * o[2] + vfloat8(z_row.w);
+    vfloat8 t = (vfloat8(0.0f) - oz) / dz;
+    mask &= ((t >= vfloat8::load(packet.mint)) & (t <= vfloat8::load(packet.maxt))).bits();
+    if( mask == 0 ) return 0;
+
+    vfloat8 x = local(0, t), y = local(1, t);
+    mask &= ((simd::abs(x) <= vfloat8(size.x * 0.5f)) & (simd::abs(y) <= vfloat8(size.y * 0.5f))).bits();
+    if( mask == 0 ) return 0;
+
+    alignas(32) float t_lanes[PACKET_SIZE], x_lanes[PACKET_SIZE], y_lanes[PACKET_SIZE];
+    t.store(t_lanes);
+    x.store(x_lanes);
+    y.store(y_lanes);
+    for( uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1 ) {
+        int lane = simd::first_lane(lanes);
+        packet.maxt[lane] = t_lanes[lane];
+        hits[lane] = { t_lanes[lane], this, 0, {x_lanes[lane], y_lanes[lane]} };
+    }
+    return mask;
+}
+
+HitRecord Quad::shade(const Ray &ray, const PrimitiveHit &prim) const {
     HitRecord hit;
-    hit.p = xform.transform_point(p);
-    hit.t = t;
-    hit.gn = hit.sn = xform.transform_normal({0,0,1});
+    hit.p = ray.at(prim.t);
+    hit.t = prim.t;
+    hit.gn = hit.sn = normal;
     hit.material = material;
+    hit.surface = this;
     return hit;
-}
\ No newline at end of file
+}
+
+Bounds3f Quad::bounds() const {
+    Vec3f half_size{ size.x * 0.5f, size.y * 0.5f, 0.0f };
+    return xform.transform_bounds( Bounds3f{ -half_size, half_size } );
+}
+
+bool Quad::is_area_light() const {
+    return material != nullptr && material->is_emissive();
+}
+
+AreaSample Quad::sample_area(const Vec2f &u) const {
+    AreaSample sample;
+    sample.p = xform.transform_point({ (u.x - 0.5f) * size.x, (u.y - 0.5f) * size.y, 0.0f });
+    sample.n = normal;
+    sample.pdf = inv_area;
+    sample.material = material;
+    return sample;
+}
+
+float Quad::pdf_area(const Vec3f &p) const {
+    return inv_area;
+}
+
+void Quad::save(SceneWriter &out) const {
+    out.write(SceneCache::QUAD);
+    out.write(size);
+    out.write(xform.m);
+    out.write(xform.m_inv);
+    out.write_material(material);
+}
+
+std::shared_ptr<Quad> Quad::load(SceneReader &in) {
+    Vec2f size = in.read<Vec2f>();
+    Mat4 m = in.read<Mat4>();
+    Mat4 m_inv = in.read<Mat4>();
+    return std::make_shared<Quad>( size, Transform(m, m_inv), in.read_material() );
+}
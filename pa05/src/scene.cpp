@@ -1,63 +1,270 @@
+#include <algorithm>
+
 #include "scene.h"
 #include "progressbar.h"
 #include "random.h"
 #include "material.h"
+#include "parallel.h"
+#include "stats.h"
 
-Image Scene::render() const {
-    // allocate an image of the proper size
-    auto image = Image(camera->get_resolution().x, camera->get_resolution().y);
+namespace {
+    /// Multiple importance sampling weight for a sample taken with density pdf_a, against a second strategy with pdf_b
+    float power_heuristic( float pdf_a, float pdf_b ) {
+        float a2 = pdf_a * pdf_a, b2 = pdf_b * pdf_b;
+        return a2 / (a2 + b2);
+    }
+}
+
+Image Scene::render( int num_threads, Image * spp_map ) const {
+    Accumulator acc( camera->get_resolution() );
+    render_samples( acc, num_samples, num_threads );
+    if( spp_map ) *spp_map = acc.spp_map();
+    return acc.image();
+}
+
+void Scene::render_samples( Accumulator & acc, int end_sample, int num_threads ) const {
+    Vec2i resolution = camera->get_resolution();
+    Vec2i frame_size = acc.get_frame_size();
+    if( frame_size.x != resolution.x || frame_size.y != resolution.y ) {
+        throw LutertException( fmt::format("Accumulator is for a {}x{} frame, but the camera resolution is {}x{}",
+                                           frame_size.x, frame_size.y, resolution.x, resolution.y) );
+    }
+    if( min_samples > 0 && acc.first_sample() > 0 ) {
+        throw LutertException("Adaptive sampling needs every sample of a pixel, it cannot render a range of samples from the middle");
+    }
+    int first_sample = acc.samples();
+    end_sample = std::min(end_sample, num_samples);
+    if( end_sample <= first_sample ) return;
+
+    // Split the accumulator's region into tiles, each tile is one unit of work for the thread pool
+    Vec2i region_min = acc.region_min();
+    Vec2i region_max = region_min + Vec2i{ acc.width(), acc.height() };
+    Vec2i num_tiles = (region_max - region_min + (TILE_SIZE - 1)) / TILE_SIZE;
 
     {
-        ProgressBar progress(image.width() * image.height());   // To provide render progress feedback
-
-        // =========================== TASK 8 =====================================================
-        // TODO: Render the image, similar to task 7, except that you will now compute a random
-        //   location within each pixel for each ray.
-        //
-        // Pseudo-code:
-        //
-        // foreach image row (go over image height)
-        //     foreach pixel in the row (go over image width)
-        //         init accumulated color to zero
-        //         repeat num_samples times:
-        //             compute a random point within the pixel (you can just add a random number between 0 and 1
-        //                                                      to the pixel coordinate. You can use next_float() for
-        //                                                      this)
-        //             compute camera ray
-        //             accumulate color raytraced with the ray (by calling recursive_color)
-        //         divide color by the number of pixel samples
-        //         write the average color to the image
-        //         update the progress bar (++progress)
-        //
-    }
-
-    // return the ray-traced image
-    return image;
-}
-
-Color3f Scene::recursive_color( Ray & ray, int depth ) const {
-    constexpr int max_depth = 64;
-  
-    // =========================== TASK 8 =====================================================
-    // TODO: Recursively raytrace the scene, similar to the code you wrote in task 7
-    //       The only difference is that you should also take into account surfaces 
-    //       that are self-emitting
-    //       To test for intersection against all objects in the scene, use the `surfaces`
-    //       variable, which is a Group of Surfaces, and will test the ray against all 
-    //       surfaces in the scene.
-    //
-    // Pseudo-code:
-    //
-    // if surfaces->intersect(..) is successful:
-    //      get emitted color (hint: you can use hit.material->emitted)
-    // 		if depth < max_depth and hit.material->scatter(....) is successful:
-    //			recursive_color = call this function recursively with the scattered ray and increased depth
-    //          return emitted color + attenuation * recursive_color
-    //		else
-    //			return emitted color;
-    // else:
-    // 		return background color (variable `background`)
-    //
-
-    return {0,0,0};  // Replace this
+        ProgressBar progress( uint64_t(acc.width()) * acc.height() );   // To provide render progress feedback
+
+        parallel_for( num_tiles.x * num_tiles.y, [&]( int tile ) {
+            Vec2i tile_min = region_min + Vec2i{ tile % num_tiles.x, tile / num_tiles.x } * TILE_SIZE;
+            Vec2i tile_max = linalg::min( tile_min + TILE_SIZE, region_max );
+            if( integrator == Integrator::Wavefront ) {
+                render_tile_wavefront( acc, tile_min, tile_max, first_sample, end_sample );
+                progress.step( uint64_t(tile_max.x - tile_min.x) * (tile_max.y - tile_min.y) );
+                return;
+            }
+
+            // Camera rays for a block of PACKET_W x PACKET_H pixels are traced together
+            for( int by = tile_min.y; by < tile_max.y; by += PACKET_H ) {
+                for( int bx = tile_min.x; bx < tile_max.x; bx += PACKET_W ) {
+                    Accumulator::Pixel stats[PACKET_SIZE];
+                    // Lanes of the pixels that still need samples
+                    uint32_t pending = 0;
+                    for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+                        int x = bx + lane % PACKET_W, y = by + lane / PACKET_W;
+                        if( x >= tile_max.x || y >= tile_max.y ) continue;
+                        stats[lane] = acc(x - region_min.x, y - region_min.y);
+                        if( !stats[lane].done ) pending |= 1u << lane;
+                    }
+
+                    for( int s = first_sample; s < end_sample && pending != 0; s++ ) {
+                        RayPacket packet;
+                        Sampler samplers[PACKET_SIZE];
+                        for( uint32_t lanes = pending; lanes != 0; lanes &= lanes - 1 ) {
+                            int lane = simd::first_lane(lanes);
+                            int x = bx + lane % PACKET_W, y = by + lane / PACKET_W;
+                            // Each pixel sample gets its own random streams, so the result does not
+                            // depend on which thread renders the tile, or on how the samples are split into passes
+                            samplers[lane] = Sampler( y * resolution.x + x, s );
+                            Vec2f sample = Vec2f{ float(x), float(y) } + samplers[lane].next_2d();
+                            packet.set( lane, camera->generate_ray(sample) );
+                        }
+                        PrimitiveHit hits[PACKET_SIZE];
+                        LUTERT_STAT( stats::local().add_rays( 0, simd::lane_count(packet.active) ) );
+                        uint32_t hit_mask = surfaces->intersect_packet(packet, hits);
+                        for( uint32_t lanes = packet.active; lanes != 0; lanes &= lanes - 1 ) {
+                            int lane = simd::first_lane(lanes);
+                            if( hit_mask & (1u << lane) ) {
+                                Ray ray = packet.get(lane);
+                                HitRecord hit = hits[lane].surface->shade(ray, hits[lane]);
+                                stats[lane].add( hit_color(ray, hit, 0, samplers[lane]) );
+                            } else {
+                                LUTERT_STAT( stats::local().escaped++ );
+                                stats[lane].add( background );
+                            }
+                        }
+
+                        // Stop sampling the pixels that have converged
+                        if( min_samples > 0 && s + 1 >= min_samples && (s + 1) % ADAPTIVE_INTERVAL == 0 ) {
+                            for( uint32_t lanes = pending; lanes != 0; lanes &= lanes - 1 ) {
+                                int lane = simd::first_lane(lanes);
+                                if( stats[lane].converged(adaptive_threshold) ) {
+                                    stats[lane].done = 1;
+                                    pending &= ~(1u << lane);
+                                }
+                            }
+                        }
+                    }
+
+                    for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+                        int x = bx + lane % PACKET_W, y = by + lane / PACKET_W;
+                        if( x < tile_max.x && y < tile_max.y ) acc(x - region_min.x, y - region_min.y) = stats[lane];
+                    }
+                }
+            }
+
+            progress.step( uint64_t(tile_max.x - tile_min.x) * (tile_max.y - tile_min.y) );
+        }, num_threads );
+    }
+
+    acc.set_samples(end_sample);
+}
+
+void Scene::render_passes( Accumulator & acc, int end_sample, int pass_samples, int num_threads,
+                           const std::function<void( const Accumulator & )> & after_pass ) const {
+    if( pass_samples < 1 ) throw LutertException("A pass must take at least one sample");
+    end_sample = std::min(end_sample, num_samples);
+    while( acc.samples() < end_sample ) {
+        render_samples( acc, std::min(acc.samples() + pass_samples, end_sample), num_threads );
+        if( acc.samples() < end_sample && after_pass ) after_pass(acc);
+    }
+}
+
+Color3f Scene::recursive_color( Ray & ray, int depth, Sampler & sampler ) const {
+    LUTERT_STAT( stats::local().add_rays(depth) );
+    std::optional<HitRecord> hit = surfaces->intersect(ray);
+    if( !hit ) {
+        LUTERT_STAT( stats::local().escaped++ );
+        return background;
+    }
+    return recursive_hit_color(ray, *hit, depth, sampler);
+}
+
+Color3f Scene::hit_color( const Ray & ray, const HitRecord & hit, int depth, Sampler & sampler ) const {
+    if( integrator == Integrator::Path ) return path_color(ray, hit, depth, sampler);
+    return recursive_hit_color(ray, hit, depth, sampler);
+}
+
+Color3f Scene::recursive_hit_color( const Ray & ray, const HitRecord & hit, int depth, Sampler & sampler ) const {
+    Color3f emitted = hit.material->emitted(ray, hit);
+    if( depth < MAX_DEPTH ) {
+        sampler.start_bounce(depth + 1);
+        std::optional<ScatterInfo> scatter = hit.material->scatter(ray, hit, sampler);
+        if( scatter ) {
+            return emitted + scatter->attenuation * recursive_color(scatter->scattered, depth + 1, sampler);
+        }
+        LUTERT_STAT( stats::local().absorbed++ );
+    } else {
+        LUTERT_STAT( stats::local().max_depth++ );
+    }
+    return emitted;
+}
+
+Color3f Scene::path_color( const Ray & camera_ray, const HitRecord & first_hit, int depth, Sampler & sampler ) const {
+    Color3f radiance{0, 0, 0};
+    Color3f throughput{1, 1, 1};
+    Ray ray = camera_ray;
+    HitRecord hit = first_hit;
+    // Density of the direction chosen at the previous bounce, 0 if light sampling was not used there
+    float scatter_pdf = 0.0f;
+
+    while( true ) {
+        radiance += throughput * emitted_light(ray, hit, scatter_pdf);
+        if( depth >= MAX_DEPTH ) {
+            LUTERT_STAT( stats::local().max_depth++ );
+            break;
+        }
+
+        sampler.start_bounce(depth + 1);
+        bool sample_light = nee && !lights.empty() && !hit.material->is_specular();
+        if( sample_light ) radiance += throughput * sample_lights(ray, hit, sampler);
+
+        std::optional<ScatterInfo> scatter = hit.material->scatter(ray, hit, sampler);
+        if( !scatter ) {
+            LUTERT_STAT( stats::local().absorbed++ );
+            break;
+        }
+        throughput *= scatter->attenuation;
+        scatter_pdf = sample_light ? hit.material->pdf(ray, hit, normalize(scatter->scattered.d)) : 0.0f;
+        depth++;
+
+        if( depth >= rr_depth ) {
+            float survive = std::min( linalg::maxelem(throughput), 0.95f );
+            if( sampler.next_float() >= survive ) {
+                LUTERT_STAT( stats::local().roulette++ );
+                break;
+            }
+            throughput /= survive;
+        }
+
+        ray = scatter->scattered;
+        LUTERT_STAT( stats::local().add_rays(depth) );
+        std::optional<HitRecord> next = surfaces->intersect(ray);
+        if( !next ) {
+            LUTERT_STAT( stats::local().escaped++ );
+            radiance += throughput * background;
+            break;
+        }
+        hit = *next;
+    }
+    return radiance;
+}
+
+Color3f Scene::emitted_light( const Ray & ray, const HitRecord & hit, float scatter_pdf ) const {
+    Color3f emitted = hit.material->emitted(ray, hit);
+    if( scatter_pdf > 0.0f && hit.surface->is_area_light() ) {
+        emitted *= power_heuristic( scatter_pdf, light_pdf(ray, hit) );
+    }
+    return emitted;
+}
+
+Color3f Scene::sample_lights( const Ray & ray, const HitRecord & hit, Sampler & sampler ) const {
+    Ray shadow_ray;
+    Color3f contribution;
+    if( !sample_light_ray(ray, hit, sampler, shadow_ray, contribution) ) return {0, 0, 0};
+
+    LUTERT_STAT( stats::local().shadow_rays++ );
+    if( surfaces->occluded(shadow_ray) ) return {0, 0, 0};
+    return contribution;
+}
+
+bool Scene::sample_light_ray( const Ray & ray, const HitRecord & hit, Sampler & sampler,
+                              Ray & shadow_ray, Color3f & contribution ) const {
+    int index = std::min( int(sampler.next_float() * lights.size()), int(lights.size()) - 1 );
+    AreaSample light = lights[index]->sample_area( sampler.next_2d() );
+
+    Vec3f to_light = light.p - hit.p;
+    float dist2 = length2(to_light);
+    if( dist2 <= 0.0f ) return false;
+    float dist = std::sqrt(dist2);
+    Vec3f dir = to_light / dist;
+    float cos_light = std::fabs( dot(light.n, dir) );
+    if( cos_light <= 0.0f ) return false;
+
+    Color3f f = hit.material->eval(ray, hit, dir);
+    if( linalg::maxelem(f) <= 0.0f ) return false;
+
+    HitRecord light_hit;
+    light_hit.t = dist;
+    light_hit.p = light.p;
+    light_hit.gn = light_hit.sn = light.n;
+    light_hit.material = light.material;
+    Color3f emitted = light.material->emitted( Ray(hit.p, dir), light_hit );
+    if( linalg::maxelem(emitted) <= 0.0f ) return false;
+
+    // Shadow ray, stopping just short of the light
+    shadow_ray = Ray(hit.p, dir, Ray::EPSILON, dist - Ray::EPSILON);
+
+    // Convert the area density to solid angle, including the choice of light
+    float pdf = light.pdf * dist2 / (cos_light * float(lights.size()));
+    float weight = power_heuristic( pdf, hit.material->pdf(ray, hit, dir) );
+    contribution = f * emitted * (weight / pdf);
+    return true;
+}
+
+float Scene::light_pdf( const Ray & ray, const HitRecord & light_hit ) const {
+    Vec3f to_light = light_hit.p - ray.o;
+    float dist2 = length2(to_light);
+    float cos_light = std::fabs( dot(light_hit.gn, to_light) ) / std::sqrt(dist2);
+    if( cos_light <= 0.0f ) return 0.0f;
+    return light_hit.surface->pdf_area(light_hit.p) * dist2 / (cos_light * float(lights.size()));
 }
@@ -0,0 +1,251 @@
+#include <cstdio>
+#include <filesystem>
+#include <fmt/core.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "scene_cache.h"
+#include "scene.h"
+#include "materiallib.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "quad.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "instance.h"
+
+namespace {
+    constexpr char CACHE_MAGIC[8] = {'L', 'U', 'T', 'E', 'R', 'T', 'S', 'C'};
+}
+
+namespace SceneCache {
+
+bool is_fresh( const std::string & cache_file, const std::string & json_file ) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+    auto cache_time = fs::last_write_time(cache_file, error);
+    if( error ) return false;
+
+    std::vector<std::string> dependencies;
+    try {
+        SceneReader in(cache_file);
+        in.read_header(&dependencies);
+    } catch( const LutertException & ) {
+        // Truncated, or written by another version: rebuild it from the JSON
+        return false;
+    }
+    dependencies.push_back(json_file);
+    for( const auto & file : dependencies ) {
+        auto time = fs::last_write_time(file, error);
+        if( error || time > cache_time ) return false;
+    }
+    return true;
+}
+
+std::string cache_name( const std::string & json_file ) {
+    return std::filesystem::path(json_file).replace_extension(".lsc").string();
+}
+
+}
+
+SceneWriter::SceneWriter( const std::string & filename ) :
+    filename(filename), temp_name(filename + ".tmp"), out(temp_name, std::ios::binary) {
+    if( !out ) throw LutertException( fmt::format("Unable to write scene cache: {}", temp_name) );
+}
+
+void SceneWriter::write_string( const std::string & s ) {
+    write( uint64_t(s.size()) );
+    out.write( s.data(), std::streamsize(s.size()) );
+}
+
+void SceneWriter::write_material( const Material * material ) {
+    write_string( material ? MaterialLib::name_of(material) : std::string() );
+}
+
+void SceneWriter::write_header( uint64_t scene_id, const std::vector<std::string> & dependencies ) {
+    SceneCache::Header header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = SceneCache::VERSION;
+    header.node_size = sizeof(BVHNode);
+    header.scene_id = scene_id;
+    write(header);
+    write( uint64_t(dependencies.size()) );
+    for( const auto & file : dependencies ) write_string(file);
+}
+
+void SceneWriter::write_surface( const Surface & surface ) {
+    surface.save(*this);
+}
+
+void SceneWriter::write_shared_surface( const Surface & surface ) {
+    auto found = shared_ids.find(&surface);
+    if( found != shared_ids.end() ) {
+        write(found->second);
+        return;
+    }
+    uint32_t id = uint32_t(shared_ids.size());
+    shared_ids[&surface] = id;
+    write(id);
+    write_surface(surface);
+}
+
+void SceneWriter::finish() {
+    out.close();
+    if( !out ) throw LutertException( fmt::format("Error writing scene cache: {}", temp_name) );
+    if( std::rename(temp_name.c_str(), filename.c_str()) != 0 ) {
+        throw LutertException( fmt::format("Error renaming scene cache {} to {}", temp_name, filename) );
+    }
+}
+
+SceneReader::SceneReader( const std::string & filename ) : filename(filename) {
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if( fd < 0 ) throw LutertException( fmt::format("Unable to open scene cache: {}", filename) );
+    struct stat st;
+    if( fstat(fd, &st) != 0 ) {
+        close(fd);
+        throw LutertException( fmt::format("Unable to read scene cache: {}", filename) );
+    }
+    size = size_t(st.st_size);
+    if( size > 0 ) {
+        void * mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if( mapping == MAP_FAILED ) {
+            close(fd);
+            throw LutertException( fmt::format("Unable to map scene cache: {}", filename) );
+        }
+        data = static_cast<const char *>(mapping);
+    }
+    close(fd);
+#else
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if( !in ) throw LutertException( fmt::format("Unable to open scene cache: {}", filename) );
+    buffer.resize( size_t(in.tellg()) );
+    in.seekg(0);
+    in.read(buffer.data(), std::streamsize(buffer.size()));
+    data = buffer.data();
+    size = buffer.size();
+#endif
+}
+
+SceneReader::~SceneReader() {
+#ifndef _WIN32
+    if( data ) munmap( const_cast<char *>(data), size );
+#endif
+}
+
+const char * SceneReader::take( size_t n ) {
+    if( n > remaining() ) fail();
+    const char * p = data + pos;
+    pos += n;
+    return p;
+}
+
+void SceneReader::fail() const {
+    throw LutertException( fmt::format("Scene cache {} is truncated or corrupt", filename) );
+}
+
+std::string SceneReader::read_string() {
+    uint64_t n = read<uint64_t>();
+    if( n > remaining() ) fail();
+    return std::string( take(n), n );
+}
+
+uint64_t SceneReader::read_header( std::vector<std::string> * dependencies ) {
+    auto header = read<SceneCache::Header>();
+    if( std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ) {
+        throw LutertException( fmt::format("Not a scene cache: {}", filename) );
+    }
+    if( header.version != SceneCache::VERSION || header.node_size != sizeof(BVHNode) ) {
+        throw LutertException( fmt::format("Scene cache {} was written by a different version of lutert", filename) );
+    }
+    uint64_t count = read<uint64_t>();
+    for( uint64_t i = 0; i < count; i++ ) {
+        std::string file = read_string();
+        if( dependencies ) dependencies->push_back(file);
+    }
+    return header.scene_id;
+}
+
+const Material * SceneReader::read_material() {
+    std::string name = read_string();
+    if( name.empty() ) return nullptr;
+    return MaterialLib::find(name);
+}
+
+std::shared_ptr<Surface> SceneReader::read_surface() {
+    auto tag = read<SceneCache::SurfaceTag>();
+    switch( tag ) {
+        case SceneCache::SPHERE: return Sphere::load(*this);
+        case SceneCache::QUAD: return Quad::load(*this);
+        case SceneCache::MESH: return Mesh::load(*this);
+        case SceneCache::SPHERE_SET: return SphereSet::load(*this);
+        case SceneCache::BVH: return BVH::load(*this);
+        case SceneCache::INSTANCE: return Instance::load(*this);
+    }
+    throw LutertException( fmt::format("Unknown surface type {} in scene cache {}", uint32_t(tag), filename) );
+}
+
+std::shared_ptr<Surface> SceneReader::read_shared_surface() {
+    uint32_t id = read<uint32_t>();
+    if( id < shared.size() ) {
+        // Null while the surface itself is being read, i.e. if it contained itself
+        if( !shared[id] ) fail();
+        return shared[id];
+    }
+    // A new shared surface is numbered in the order of first appearance
+    if( id != shared.size() ) fail();
+    shared.emplace_back();
+    auto surface = read_surface();
+    shared[id] = surface;
+    return surface;
+}
+
+void Scene::save_cache( const std::string & filename, const json & j, uint64_t scene_id ) const {
+    // The files the surfaces were loaded from, so that changing one makes the cache stale
+    std::vector<std::string> dependencies;
+    auto add_dependencies = [&]( const json & jsurfaces ) {
+        for( const auto & jsurf : jsurfaces ) {
+            if( jsurf.contains("filename") ) dependencies.push_back( jsurf["filename"].get<std::string>() );
+        }
+    };
+    json settings = j;
+    if( settings.contains("surfaces") ) {
+        add_dependencies( settings["surfaces"] );
+        settings.erase("surfaces");
+    }
+    if( settings.contains("prototypes") ) {
+        for( const auto & jproto : settings["prototypes"] ) add_dependencies( jproto.value("surfaces", json::array()) );
+        settings.erase("prototypes");
+    }
+
+    SceneWriter out(filename);
+    out.write_header(scene_id, dependencies);
+    out.write_string( settings.dump() );
+    out.write_surface(*surfaces);
+    out.finish();
+}
+
+Scene Scene::load_cache( const std::string & filename, uint64_t * scene_id ) {
+    SceneReader in(filename);
+    uint64_t id = in.read_header();
+    if( scene_id ) *scene_id = id;
+
+    Scene scene;
+    try {
+        scene.parse_settings( json::parse( in.read_string() ) );
+    } catch( const json::exception & e ) {
+        // A damaged settings block, reported like any other damage so that the caller can fall back to the JSON
+        throw LutertException( fmt::format("Scene cache {} is truncated or corrupt: {}", filename, e.what()) );
+    } catch( const LutertParseException & e ) {
+        throw LutertException( fmt::format("Scene cache {} is truncated or corrupt: {}", filename, e.what()) );
+    }
+    auto bvh = std::dynamic_pointer_cast<BVH>( in.read_surface() );
+    if( !bvh ) throw LutertException( fmt::format("Scene cache {} does not start with a BVH", filename) );
+    scene.set_surfaces(bvh);
+    return scene;
+}
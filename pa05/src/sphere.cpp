@@ -1,6 +1,8 @@
 #include "sphere.h"
 #include "json.h"
 #include "materiallib.h"
+#include "random.h"
+#include "scene_cache.h"
 
  Sphere::Sphere(const json &j) {
     radius = j.value("radius", radius);
@@ -8,41 +10,171 @@
     if( j.contains("material") ) {
         material = MaterialLib::find(j.value("material", std::string("")));
     }
+    init();
 }
 
-std::optional<HitRecord> Sphere::intersect( Ray &ray) const {
-    // ===================== TASK 5 =================================================
-    // TODO: Task 5 - implement Sphere::intersect
-    //   Implement ray-sphere intersection.  
-    //   Before computing the intersection, transform the ray into the object's local
-    //   system using the inverse of the transform (xform).  In the sphere's local coordinate
-    //   system it is centered at the origin, and the radius is stored in the field named
-    //   radius.
-    // 
-    //   If the ray misses the sphere, return {} (empty).
-    //   Otherwise, create a HitRecord struct, fill in all fields and return it.
-    //   Ray-Sphere intersection is covered in Chapter 6.1 - 6.3 in RIOW.  For this
-    //   application, we store two normals: a shading normal and a geometric normal.
-    //   For Spheres, they will both be the same.
-    //   
-    //   The values in HitRecord must be in world coordinates, so they will need to be
-    //   transformed back to world coordinates before returning.  The ray's parameter (t)
-    //   does not need to be transformed.
-    //
-    //   If the intersection distance must be within the Ray's [mint, maxt] range, otherwise,
-    //   this method should return false (and leave hit unmodified).
-    //
-    //   Note: unlike the text, we do not flip the normal when the ray hits the back side
-    //   of the object.
-
-
-    // You should only execute the code below if you successfully hit something
+void Sphere::init() {
+    std::optional<float> scale = xform.uniform_scale();
+    world_space = scale.has_value();
+    if( world_space ) {
+        center = xform.m[3].xyz();
+        world_radius = radius * *scale;
+    }
+    inv_local_area = 1.0f / (4.0f * M_PI * radius * radius);
+}
+
+std::optional<float> Sphere::hit_distance( const Ray &ray ) const {
+    // Translation and uniform scaling do not change the ray parameter t, so the
+    // intersection can be computed in world space against the transformed sphere.
+    Vec3f oc, d;
+    float r;
+    if( world_space ) {
+        oc = ray.o - center;
+        d = ray.d;
+        r = world_radius;
+    } else {
+        // Transform Ray into local space
+        Ray xray = xform.inverse_transform_ray(ray);
+        oc = xray.o;
+        d = xray.d;
+        r = radius;
+    }
+
+    float a = length2(d);
+    float half_b = dot(oc, d);
+    float c = length2(oc) - r * r;
+    float discriminant = half_b * half_b - a * c;
+    if( discriminant < 0 ) return {};
+
+    float sqrtd = std::sqrt(discriminant);
+    float t = (-half_b - sqrtd) / a;
+    if( t < ray.mint || t > ray.maxt ) {
+        t = (-half_b + sqrtd) / a;
+        if( t < ray.mint || t > ray.maxt ) return {};
+    }
+    return t;
+}
+
+bool Sphere::intersect_t( Ray &ray, PrimitiveHit &hit ) const {
+    std::optional<float> t = hit_distance(ray);
+    if( !t ) return false;
+
+    ray.maxt = *t;
+    hit = { *t, this };
+    return true;
+}
+
+bool Sphere::occluded( const Ray &ray ) const {
+    return hit_distance(ray).has_value();
+}
+
+uint32_t intersect_sphere_packet( const RayPacket &packet, uint32_t lanes, const Vec3f &center, float radius,
+                                  float *t_lanes ) {
+    using simd::vfloat8;
+    vfloat8 oc[3], d[3];
+    for( int i = 0; i < 3; i++ ) {
+        oc[i] = vfloat8::load(packet.o[i]) - vfloat8(center[i]);
+        d[i] = vfloat8::load(packet.d[i]);
+    }
+
+    // The same quadratic as Sphere::intersect_t(...), for all lanes at once
+    vfloat8 a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    vfloat8 half_b = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+    vfloat8 c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - vfloat8(radius * radius);
+    vfloat8 discriminant = half_b * half_b - a * c;
+    uint32_t mask = (discriminant >= vfloat8(0.0f)).bits() & lanes;
+    if( mask == 0 ) return 0;
+
+    vfloat8 mint = vfloat8::load(packet.mint), maxt = vfloat8::load(packet.maxt);
+    vfloat8 sqrtd = simd::sqrt(discriminant);
+    vfloat8 t_near = (vfloat8(0.0f) - half_b - sqrtd) / a;
+    vfloat8 t_far = (vfloat8(0.0f) - half_b + sqrtd) / a;
+    simd::vmask8 near_ok = (t_near >= mint) & (t_near <= maxt);
+    simd::vmask8 far_ok = (t_far >= mint) & (t_far <= maxt);
+    mask &= (near_ok | far_ok).bits();
+    if( mask == 0 ) return 0;
+
+    simd::select(near_ok, t_near, t_far).store(t_lanes);
+    return mask;
+}
+
+uint32_t Sphere::intersect_packet( RayPacket &packet, PrimitiveHit *hits ) const {
+    if( !world_space ) return Surface::intersect_packet(packet, hits);
+
+    alignas(32) float t_lanes[PACKET_SIZE];
+    uint32_t mask = intersect_sphere_packet(packet, packet.active, center, world_radius, t_lanes);
+    for( uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1 ) {
+        int lane = simd::first_lane(lanes);
+        packet.maxt[lane] = t_lanes[lane];
+        hits[lane] = { t_lanes[lane], this };
+    }
+    return mask;
+}
+
+HitRecord Sphere::shade( const Ray &ray, const PrimitiveHit &prim ) const {
     HitRecord hit;
-    // hit.t   = t;   // Ray t at the intersection
-    // hit.p   = p;   // The hit point
-    // hit.gn  = n;   // The geometric normal at the hit point
-    // hit.sn  = n;   // The shading normal at the hit point
+    hit.t = prim.t;
+    if( world_space ) {
+        hit.p = ray.at(prim.t);
+        hit.gn = hit.sn = (hit.p - center) / world_radius;
+    } else {
+        // Point on the sphere in local space
+        Ray xray = xform.inverse_transform_ray(ray);
+        Vec3f p = xray.o + prim.t * xray.d;
+        hit.p = xform.transform_point(p);
+        hit.gn = hit.sn = xform.transform_normal(p / radius);
+    }
     hit.material = material;
+    hit.surface = this;
 
     return hit;
 }
+
+Bounds3f Sphere::bounds() const {
+    // The sphere maps to an ellipsoid, whose half-width along world axis i is the
+    // radius times the length of row i of the linear part of the matrix.  This is
+    // tighter than transforming the sphere's local bounding cube whenever there is
+    // a rotation.
+    const Mat4 & m = xform.m;
+    Vec3f center = m[3].xyz();
+    Vec3f half_size;
+    for( int i = 0; i < 3; i++ ) {
+        half_size[i] = radius * std::sqrt( m[0][i] * m[0][i] + m[1][i] * m[1][i] + m[2][i] * m[2][i] );
+    }
+    return { center - half_size, center + half_size };
+}
+
+bool Sphere::is_area_light() const {
+    return material != nullptr && material->is_emissive();
+}
+
+AreaSample Sphere::sample_area( const Vec2f &u ) const {
+    // Uniform in local space, the density is then divided by the local area scaling of the transform
+    Vec3f n = square_to_unit_sphere(u);
+    AreaSample sample;
+    sample.p = xform.transform_point(radius * n);
+    sample.n = xform.transform_normal(n);
+    sample.pdf = inv_local_area / xform.area_scale(n);
+    sample.material = material;
+    return sample;
+}
+
+float Sphere::pdf_area( const Vec3f &p ) const {
+    Vec3f n = normalize( mul(xform.m_inv, Vec4f(p, 1.0f)).xyz() );
+    return inv_local_area / xform.area_scale(n);
+}
+
+void Sphere::save( SceneWriter &out ) const {
+    out.write(SceneCache::SPHERE);
+    out.write(radius);
+    out.write(xform.m);
+    out.write(xform.m_inv);
+    out.write_material(material);
+}
+
+std::shared_ptr<Sphere> Sphere::load( SceneReader &in ) {
+    float radius = in.read<float>();
+    Mat4 m = in.read<Mat4>();
+    Mat4 m_inv = in.read<Mat4>();
+    return std::make_shared<Sphere>( radius, Transform(m, m_inv), in.read_material() );
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cmath>
+
+#include "sphere_set.h"
+#include "sphere.h"
+#include "scene_cache.h"
+
+void SphereSet::add( const Vec3f & center, float r, const Material * material ) {
+    auto found = std::find(materials.begin(), materials.end(), material);
+    uint32_t id = uint32_t(found - materials.begin());
+    if( found == materials.end() ) materials.push_back(material);
+
+    cx.push_back(center.x);
+    cy.push_back(center.y);
+    cz.push_back(center.z);
+    radius.push_back(r);
+    material_ids.push_back(id);
+    num_spheres++;
+}
+
+void SphereSet::build() {
+    // Drop the padding of an earlier build
+    cx.resize(num_spheres);
+    cy.resize(num_spheres);
+    cz.resize(num_spheres);
+    radius.resize(num_spheres);
+
+    std::vector<Bounds3f> sphere_bounds(num_spheres);
+    for( size_t i = 0; i < num_spheres; i++ ) {
+        Vec3f c{ cx[i], cy[i], cz[i] };
+        sphere_bounds[i] = { c - radius[i], c + radius[i] };
+    }
+    tree.build(sphere_bounds, simd::WIDTH, simd::WIDTH);
+
+    // Sort the spheres into leaf order, after which a leaf's index range is its range of spheres
+    auto reorder = [&]( auto & values ) {
+        auto sorted = values;
+        for( size_t i = 0; i < num_spheres; i++ ) sorted[i] = values[ tree.indices[i] ];
+        values = std::move(sorted);
+    };
+    reorder(cx);
+    reorder(cy);
+    reorder(cz);
+    reorder(radius);
+    reorder(material_ids);
+    for( size_t i = 0; i < num_spheres; i++ ) tree.indices[i] = uint32_t(i);
+
+    // Padding, so that a leaf at the end can be loaded as a full vector
+    for( auto * values : {&cx, &cy, &cz, &radius} ) values->resize( num_spheres + simd::WIDTH - 1, 0.0f );
+}
+
+int SphereSet::intersect_leaf( const Ray & ray, uint32_t first, uint32_t count, float & t ) const {
+    if( count == 1 ) {
+        // A vector would be mostly empty, the scalar test is cheaper
+        Vec3f oc = ray.o - Vec3f{cx[first], cy[first], cz[first]};
+        float a = length2(ray.d);
+        float half_b = dot(oc, ray.d);
+        float c = length2(oc) - radius[first] * radius[first];
+        float discriminant = half_b * half_b - a * c;
+        if( discriminant < 0 ) return -1;
+
+        float sqrtd = std::sqrt(discriminant);
+        t = (-half_b - sqrtd) / a;
+        if( t < ray.mint || t > ray.maxt ) {
+            t = (-half_b + sqrtd) / a;
+            if( t < ray.mint || t > ray.maxt ) return -1;
+        }
+        return int(first);
+    }
+
+    using simd::vfloat8;
+    // The same quadratic as Sphere::intersect_t(...), for up to eight spheres at once
+    vfloat8 ocx = vfloat8(ray.o.x) - vfloat8::loadu(&cx[first]);
+    vfloat8 ocy = vfloat8(ray.o.y) - vfloat8::loadu(&cy[first]);
+    vfloat8 ocz = vfloat8(ray.o.z) - vfloat8::loadu(&cz[first]);
+    vfloat8 r = vfloat8::loadu(&radius[first]);
+    vfloat8 dx(ray.d.x), dy(ray.d.y), dz(ray.d.z);
+
+    vfloat8 a( length2(ray.d) );
+    vfloat8 half_b = ocx * dx + ocy * dy + ocz * dz;
+    vfloat8 c = ocx * ocx + ocy * ocy + ocz * ocz - r * r;
+    vfloat8 discriminant = half_b * half_b - a * c;
+    uint32_t mask = (discriminant >= vfloat8(0.0f)).bits() & ((1u << count) - 1);
+    if( mask == 0 ) return -1;
+
+    vfloat8 mint(ray.mint), maxt(ray.maxt);
+    vfloat8 sqrtd = simd::sqrt(discriminant);
+    vfloat8 t_near = (vfloat8(0.0f) - half_b - sqrtd) / a;
+    vfloat8 t_far = (vfloat8(0.0f) - half_b + sqrtd) / a;
+    simd::vmask8 near_ok = (t_near >= mint) & (t_near <= maxt);
+    simd::vmask8 far_ok = (t_far >= mint) & (t_far <= maxt);
+    mask &= (near_ok | far_ok).bits();
+    if( mask == 0 ) return -1;
+
+    alignas(32) float t_lanes[simd::WIDTH];
+    simd::select(near_ok, t_near, t_far).store(t_lanes);
+    int nearest = -1;
+    for( ; mask != 0; mask &= mask - 1 ) {
+        int lane = simd::first_lane(mask);
+        if( nearest < 0 || t_lanes[lane] < t ) {
+            nearest = lane;
+            t = t_lanes[lane];
+        }
+    }
+    return int(first) + nearest;
+}
+
+bool SphereSet::intersect_t( Ray & ray, PrimitiveHit & hit ) const {
+    return tree.traverse_leaves( ray, [&]( uint32_t first, uint32_t count ) {
+        float t;
+        int i = intersect_leaf(ray, first, count, t);
+        if( i < 0 ) return false;
+        ray.maxt = t;
+        hit = { t, this, uint32_t(i) };
+        return true;
+    });
+}
+
+bool SphereSet::occluded( const Ray & ray ) const {
+    return tree.traverse_any_leaves( ray, [&]( uint32_t first, uint32_t count ) {
+        float t;
+        return intersect_leaf(ray, first, count, t) >= 0;
+    });
+}
+
+uint32_t SphereSet::intersect_packet( RayPacket & packet, PrimitiveHit * hits ) const {
+    // The tree is traversed once for the whole packet.  A leaf is tested either a
+    // sphere at a time against all the rays, or a ray at a time against all the
+    // spheres, whichever takes fewer passes.
+    Ray rays[PACKET_SIZE];
+    for( uint32_t lanes = packet.active; lanes != 0; lanes &= lanes - 1 ) {
+        int lane = simd::first_lane(lanes);
+        rays[lane] = packet.get(lane);
+    }
+
+    return tree.traverse_packet_leaves( packet, [&]( uint32_t first, uint32_t count, uint32_t lanes ) {
+        uint32_t hit_mask = 0;
+        if( count <= uint32_t(simd::lane_count(lanes)) ) {
+            alignas(32) float t_lanes[PACKET_SIZE];
+            for( uint32_t i = first; i < first + count; i++ ) {
+                uint32_t mask = intersect_sphere_packet(packet, lanes, {cx[i], cy[i], cz[i]}, radius[i], t_lanes);
+                for( ; mask != 0; mask &= mask - 1 ) {
+                    int lane = simd::first_lane(mask);
+                    rays[lane].maxt = packet.maxt[lane] = t_lanes[lane];
+                    hits[lane] = { t_lanes[lane], this, i };
+                    hit_mask |= 1u << lane;
+                }
+            }
+        } else {
+            for( ; lanes != 0; lanes &= lanes - 1 ) {
+                int lane = simd::first_lane(lanes);
+                float t;
+                int i = intersect_leaf(rays[lane], first, count, t);
+                if( i < 0 ) continue;
+                rays[lane].maxt = packet.maxt[lane] = t;
+                hits[lane] = { t, this, uint32_t(i) };
+                hit_mask |= 1u << lane;
+            }
+        }
+        return hit_mask;
+    });
+}
+
+HitRecord SphereSet::shade( const Ray & ray, const PrimitiveHit & prim ) const {
+    uint32_t i = prim.prim_id;
+    HitRecord hit;
+    hit.t = prim.t;
+    hit.p = ray.at(prim.t);
+    hit.gn = hit.sn = (hit.p - Vec3f{cx[i], cy[i], cz[i]}) / radius[i];
+    hit.material = materials[ material_ids[i] ];
+    hit.surface = this;
+    return hit;
+}
+
+void SphereSet::save( SceneWriter & out ) const {
+    out.write(SceneCache::SPHERE_SET);
+    out.write( uint64_t(num_spheres) );
+    // The arrays are saved in leaf order with their padding, as build() left them
+    out.write_vector(cx);
+    out.write_vector(cy);
+    out.write_vector(cz);
+    out.write_vector(radius);
+    out.write_vector(material_ids);
+    out.write( uint64_t(materials.size()) );
+    for( const Material * material : materials ) out.write_material(material);
+    tree.save(out);
+}
+
+std::shared_ptr<SphereSet> SphereSet::load( SceneReader & in ) {
+    auto set = std::make_shared<SphereSet>();
+    set->num_spheres = size_t( in.read<uint64_t>() );
+    set->cx = in.read_vector<float>();
+    set->cy = in.read_vector<float>();
+    set->cz = in.read_vector<float>();
+    set->radius = in.read_vector<float>();
+    set->material_ids = in.read_vector<uint32_t>();
+    uint64_t num_materials = in.read<uint64_t>();
+    for( uint64_t i = 0; i < num_materials; i++ ) set->materials.push_back( in.read_material() );
+
+    size_t padded = set->num_spheres + simd::WIDTH - 1;
+    bool valid = set->cx.size() == padded && set->cy.size() == padded && set->cz.size() == padded &&
+                 set->radius.size() == padded && set->material_ids.size() == set->num_spheres;
+    for( uint32_t id : set->material_ids ) valid = valid && id < set->materials.size();
+    if( !valid ) throw LutertException("Invalid sphere set in scene cache");
+
+    set->tree.load(in, set->num_spheres);
+    return set;
+}
@@ -0,0 +1,177 @@
+#include <mutex>
+#include <fmt/core.h>
+
+#include "stats.h"
+
+namespace stats {
+
+const char * const MATERIAL_TYPE_NAMES[NUM_MATERIAL_TYPES] = { "lambertian", "metal", "dielectric" };
+
+namespace {
+    std::mutex mutex;
+    Counters retired;                  ///< Counters of threads that have exited, guarded by mutex
+    std::vector<PhaseTime> phase_times;  ///< Guarded by mutex
+
+    /// A thread's counters, which are added to the retired counters when the thread exits
+    struct ThreadCounters {
+        Counters counters;
+        ~ThreadCounters() {
+            std::lock_guard<std::mutex> lock(mutex);
+            retired += counters;
+        }
+    };
+    thread_local ThreadCounters thread_counters;
+
+    /// Line addresses held by the simulated node cache of touch_node(...), 0 for empty
+    constexpr size_t NODE_CACHE_LINES = 512;
+    thread_local uintptr_t node_cache[NODE_CACHE_LINES] = {};
+
+    /// The innermost phase running on this thread
+    thread_local ScopedPhase * current_phase = nullptr;
+
+    double per( uint64_t a, uint64_t b ) {
+        return b == 0 ? 0.0 : double(a) / double(b);
+    }
+}
+
+uint64_t Counters::total_rays() const {
+    uint64_t n = 0;
+    for( uint64_t r : rays ) n += r;
+    return n;
+}
+
+Counters & Counters::operator+=( const Counters & other ) {
+    for( int i = 0; i <= MAX_COUNTED_DEPTH; i++ ) rays[i] += other.rays[i];
+    shadow_rays += other.shadow_rays;
+    intersection_tests += other.intersection_tests;
+    bvh_nodes_visited += other.bvh_nodes_visited;
+    bvh_node_misses += other.bvh_node_misses;
+    for( int i = 0; i < NUM_MATERIAL_TYPES; i++ ) scatter_calls[i] += other.scatter_calls[i];
+    escaped += other.escaped;
+    absorbed += other.absorbed;
+    roulette += other.roulette;
+    max_depth += other.max_depth;
+    return *this;
+}
+
+Counters & local() {
+    return thread_counters.counters;
+}
+
+void touch_node( const void * node ) {
+    uintptr_t line = reinterpret_cast<uintptr_t>(node) >> 6;
+    uintptr_t & slot = node_cache[ line % NODE_CACHE_LINES ];
+    if( slot != line ) {
+        slot = line;
+        thread_counters.counters.bvh_node_misses++;
+    }
+}
+
+Counters totals() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Counters result = retired;
+    result += thread_counters.counters;
+    return result;
+}
+
+void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    retired = Counters{};
+    thread_counters.counters = Counters{};
+    phase_times.clear();
+}
+
+ScopedPhase::ScopedPhase( std::string name ) :
+    name(std::move(name)), parent(current_phase) {
+    current_phase = this;
+    {
+        // Listed from the start, so that phases are reported in the order they began
+        std::lock_guard<std::mutex> lock(mutex);
+        bool found = false;
+        for( const auto & phase : phase_times ) found = found || phase.name == this->name;
+        if( !found ) phase_times.push_back({ this->name, 0.0 });
+    }
+    start = std::chrono::steady_clock::now();
+}
+
+ScopedPhase::~ScopedPhase() {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    current_phase = parent;
+    if( parent ) parent->nested_seconds += seconds;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for( auto & phase : phase_times ) {
+        if( phase.name == name ) phase.seconds += seconds - nested_seconds;
+    }
+}
+
+std::vector<PhaseTime> phases() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return phase_times;
+}
+
+void print_summary() {
+    fmt::print("\nStatistics\n");
+    double total_seconds = 0.0;
+    for( const auto & phase : phases() ) {
+        fmt::print("  {:<30} {:10.3f} s\n", phase.name + " time", phase.seconds);
+        total_seconds += phase.seconds;
+    }
+    fmt::print("  {:<30} {:10.3f} s\n", "total time", total_seconds);
+
+    if( !ENABLED ) {
+        fmt::print("  (build with LUTERT_ENABLE_STATS for ray and intersection counters)\n");
+        return;
+    }
+
+    Counters c = totals();
+    uint64_t rays = c.total_rays();
+    uint64_t paths = c.escaped + c.absorbed + c.roulette + c.max_depth;
+    fmt::print("  {:<30} {:10}\n", "rays", rays);
+    for( int d = 0; d <= MAX_COUNTED_DEPTH; d++ ) {
+        if( c.rays[d] == 0 ) continue;
+        std::string label = d < MAX_COUNTED_DEPTH ? fmt::format("  depth {}", d) : fmt::format("  depth {}+", d);
+        fmt::print("  {:<30} {:10} ({:.1f}%)\n", label, c.rays[d], 100.0 * per(c.rays[d], rays));
+    }
+    fmt::print("  {:<30} {:10}\n", "shadow rays", c.shadow_rays);
+    fmt::print("  {:<30} {:10.2f}\n", "intersection tests per ray", per(c.intersection_tests, rays + c.shadow_rays));
+    fmt::print("  {:<30} {:10.2f}\n", "BVH nodes visited per ray", per(c.bvh_nodes_visited, rays + c.shadow_rays));
+    fmt::print("  {:<30} {:10.2f}\n", "BVH node cache misses per ray", per(c.bvh_node_misses, rays + c.shadow_rays));
+    for( int i = 0; i < NUM_MATERIAL_TYPES; i++ ) {
+        fmt::print("  {:<30} {:10}\n", fmt::format("{} scatter calls", MATERIAL_TYPE_NAMES[i]), c.scatter_calls[i]);
+    }
+    fmt::print("  {:<30} {:10}\n", "paths", paths);
+    fmt::print("  {:<30} {:10} ({:.1f}%)\n", "  escaped", c.escaped, 100.0 * per(c.escaped, paths));
+    fmt::print("  {:<30} {:10} ({:.1f}%)\n", "  absorbed", c.absorbed, 100.0 * per(c.absorbed, paths));
+    fmt::print("  {:<30} {:10} ({:.1f}%)\n", "  Russian roulette", c.roulette, 100.0 * per(c.roulette, paths));
+    fmt::print("  {:<30} {:10} ({:.1f}%)\n", "  maximum depth", c.max_depth, 100.0 * per(c.max_depth, paths));
+}
+
+json to_json() {
+    json j;
+    j["counters_enabled"] = ENABLED;
+    json jphases = json::object();
+    for( const auto & phase : phases() ) jphases[phase.name] = phase.seconds;
+    j["phase_seconds"] = jphases;
+    if( !ENABLED ) return j;
+
+    Counters c = totals();
+    j["rays_per_depth"] = std::vector<uint64_t>( std::begin(c.rays), std::end(c.rays) );
+    j["rays"] = c.total_rays();
+    j["shadow_rays"] = c.shadow_rays;
+    j["intersection_tests"] = c.intersection_tests;
+    j["bvh_nodes_visited"] = c.bvh_nodes_visited;
+    j["bvh_node_misses"] = c.bvh_node_misses;
+    json jscatter = json::object();
+    for( int i = 0; i < NUM_MATERIAL_TYPES; i++ ) jscatter[ MATERIAL_TYPE_NAMES[i] ] = c.scatter_calls[i];
+    j["scatter_calls"] = jscatter;
+    j["paths"] = {
+        {"escaped", c.escaped},
+        {"absorbed", c.absorbed},
+        {"roulette", c.roulette},
+        {"max_depth", c.max_depth}
+    };
+    return j;
+}
+
+}
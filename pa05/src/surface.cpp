@@ -1,16 +1,50 @@
 #include "surface.h"
+#include "stats.h"
 
-std::optional<HitRecord> Group::intersect(Ray &ray) const {
+uint32_t Surface::intersect_packet(RayPacket &packet, PrimitiveHit *hits) const {
+    uint32_t hit_mask = 0;
+    for( uint32_t lanes = packet.active; lanes != 0; lanes &= lanes - 1 ) {
+        int lane = simd::first_lane(lanes);
+        Ray ray = packet.get(lane);
+        if( intersect_t(ray, hits[lane]) ) {
+            packet.maxt[lane] = ray.maxt;
+            hit_mask |= 1u << lane;
+        }
+    }
+    return hit_mask;
+}
+
+bool Group::intersect_t(Ray &ray, PrimitiveHit &hit) const {
+    // Each hit shortens the ray, so a later hit is always closer
+    LUTERT_STAT( stats::local().intersection_tests += surfaces.size() );
     bool hit_something = false;
-    HitRecord hit;
     for( auto & surf : surfaces ) {
-        std::optional<HitRecord> hit_info = surf->intersect(ray);
-        if( hit_info ) {
-            hit_something = true;
-            hit = *hit_info;
-            ray.maxt = hit_info->t;
-        }
+        if( surf->intersect_t(ray, hit) ) hit_something = true;
+    }
+    return hit_something;
+}
+
+bool Group::occluded(const Ray &ray) const {
+    for( auto & surf : surfaces ) {
+        LUTERT_STAT( stats::local().intersection_tests++ );
+        if( surf->occluded(ray) ) return true;
+    }
+    return false;
+}
+
+uint32_t Group::intersect_packet(RayPacket &packet, PrimitiveHit *hits) const {
+    uint32_t hit_mask = 0;
+    LUTERT_STAT( stats::local().intersection_tests += surfaces.size() * simd::lane_count(packet.active) );
+    for( auto & surf : surfaces ) {
+        hit_mask |= surf->intersect_packet(packet, hits);
+    }
+    return hit_mask;
+}
+
+Bounds3f Group::bounds() const {
+    Bounds3f result;
+    for( auto & surf : surfaces ) {
+        result.extend( surf->bounds() );
     }
-    if( hit_something ) return {hit};
-    return {};
+    return result;
 }
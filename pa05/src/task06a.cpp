@@ -23,9 +23,10 @@ void test_scatter( const Vec3f & incoming_dir, const HitRecord & hit, const Mate
     bool nan_or_inf = false;
     int below_hemi_count = 0;
 
+    Sampler sampler;
     ProgressBar pb{uint64_t(samples)};
     for( int i = 0; i < samples; i++ ) {
-        std::optional<ScatterInfo> scat = material.scatter(incoming_ray, hit);
+        std::optional<ScatterInfo> scat = material.scatter(incoming_ray, hit, sampler);
         if(! scat ) continue;
 
         if( ! ( std::isfinite(scat->scattered.d.x) && std::isfinite(scat->scattered.d.y) && std::isfinite(scat->scattered.d.z) ) ) {
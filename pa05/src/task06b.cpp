@@ -15,9 +15,10 @@ TEST_CASE( "Entering a dielectric ior - 1.5" ) {
     hit.sn = hit.gn = {0,1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.5f} } );
-    hit.material = material;
+    hit.material = material.get();
     
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( scat.has_value() );
     Vec3f attenuation = scat->attenuation;
     Ray scattered = scat->scattered;
@@ -39,9 +40,10 @@ TEST_CASE( "Entering a dielectric ior - 1.3" ) {
     hit.sn = hit.gn = {0,1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.3f} } );
-    hit.material = material;
+    hit.material = material.get();
     
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( scat.has_value() );
     Vec3f attenuation = scat->attenuation;
     Ray scattered = scat->scattered;
@@ -63,9 +65,10 @@ TEST_CASE( "Exiting a dielectric ior - 1.5" ) {
     hit.sn = hit.gn = {0,-1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.5f} } );
-    hit.material = material;
+    hit.material = material.get();
 
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( scat.has_value() );
     Vec3f attenuation = scat->attenuation;
     Ray scattered = scat->scattered;
@@ -87,9 +90,10 @@ TEST_CASE( "Exiting a dielectric ior - 1.3" ) {
     hit.sn = hit.gn = {0,-1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.3f} } );
-    hit.material = material;
+    hit.material = material.get();
     
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( scat.has_value() );
     Vec3f attenuation = scat->attenuation;
     Ray scattered = scat->scattered;
@@ -111,9 +115,10 @@ TEST_CASE( "Exiting a dielectric - total internal reflection - ior 1.5" ) {
     hit.sn = hit.gn = {0,-1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.5f} } );
-    hit.material = material;
+    hit.material = material.get();
     
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( !scat.has_value() );
 }
 
@@ -125,9 +130,10 @@ TEST_CASE( "Exiting a dielectric - total internal reflection - ior 1.3" ) {
     hit.sn = hit.gn = {0,-1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.3f} } );
-    hit.material = material;
+    hit.material = material.get();
 
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( ! scat.has_value() );
 }
 
@@ -140,9 +146,10 @@ TEST_CASE( "Exiting a dielectric - total internal reflection near critical angle
     hit.sn = hit.gn = {0,-1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.333f} } );
-    hit.material = material;
+    hit.material = material.get();
     
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( ! scat.has_value() );
 }
 
@@ -155,9 +162,10 @@ TEST_CASE( "Exiting a dielectric ior - 1.333 - near critical angle" ) {
     hit.sn = hit.gn = {0,-1,0};
 
     std::shared_ptr<Material> material = std::make_shared<Dielectric>( json{ {"ior", 1.333f} } );
-    hit.material = material;
+    hit.material = material.get();
 
-    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit);
+    Sampler sampler;
+    std::optional<ScatterInfo> scat = material->scatter(test_ray, hit, sampler);
     REQUIRE( scat.has_value() );
     Vec3f attenuation = scat->attenuation;
     Ray scattered = scat->scattered;
@@ -30,13 +30,13 @@ void task07_render() {
 
     auto floor = std::make_shared<Sphere>( 1000.0f,
                                             Transform( linalg::translation_matrix( Vec3f{0, -1000.0f, 0} )),
-                                            ground );
+                                            ground.get() );
     auto shiny_sphere = std::make_shared<Sphere>( 1.0f,
         Transform( linalg::translation_matrix( Vec3f{0, 1.0f, 1} )),
-        shiny );
+        shiny.get() );
     auto matte_sphere = std::make_shared<Sphere>( 1.0f,
         Transform( linalg::translation_matrix( Vec3f{3.0f, 1.0f, 0} )),
-        matte );
+        matte.get() );
 
     Group scene;
     scene.add(floor);
@@ -0,0 +1,197 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <cstdio>
+#include "accumulator.h"
+#include "scene.h"
+
+/*
+ * Tests for accumulating a render over several passes and for checkpoints.
+ */
+namespace {
+    json box_scene( const std::string & prefix, int num_samples, const json & adaptive = nullptr ) {
+        std::string wall = prefix + "_wall", light = prefix + "_light";
+        auto quad = [&]( const json & transform, const std::string & material, float size ) {
+            return json{ {"type", "quad"}, {"size", {size, size}}, {"transform", transform}, {"material", material} };
+        };
+        json j = {
+            {"num_samples", num_samples},
+            {"background", {0.2f, 0.2f, 0.2f}},
+            {"camera", {
+                {"vfov", 45.0f},
+                {"resolution", {20, 12}},
+                {"transform", { {"from", {0, 0, 3.4}}, {"at", {0, 0, 0}}, {"up", {0, 1, 0}} }}
+            }},
+            {"integrator", { {"type", "path"} }},
+            {"materials", {
+                { {"name", wall}, {"type", "lambertian"}, {"albedo", {0.7f, 0.6f, 0.5f}} },
+                { {"name", light}, {"type", "light"}, {"power", {5, 5, 5}} }
+            }},
+            {"surfaces", {
+                quad( { {"translate", {0, 0, -1}} }, wall, 2 ),
+                quad( { {"rotate", {-90, 1, 0, 0}}, {"translate", {0, -1, 0}} }, wall, 2 ),
+                quad( { {"rotate", {90, 1, 0, 0}}, {"translate", {0, 0.99, 0}} }, light, 0.75f ),
+                { {"type", "sphere"}, {"radius", 0.35f}, {"material", wall} }
+            }}
+        };
+        if( !adaptive.is_null() ) j["adaptive"] = adaptive;
+        return j;
+    }
+
+    void require_same( const Accumulator & a, const Accumulator & b ) {
+        REQUIRE( a.samples() == b.samples() );
+        for( int y = 0; y < a.height(); y++ ) {
+            for( int x = 0; x < a.width(); x++ ) {
+                REQUIRE( a(x, y).count == b(x, y).count );
+                REQUIRE( a(x, y).done == b(x, y).done );
+                for( int c = 0; c < 3; c++ ) {
+                    REQUIRE_THAT( a(x, y).sum[c], Catch::Matchers::WithinRel(b(x, y).sum[c], 1e-9) );
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE( "Accumulator - passes give the same result as one render" ) {
+    Scene scene( box_scene("acc_box_a", 32) );
+    Accumulator whole( scene.get_camera().get_resolution() );
+    scene.render_samples( whole, 32, 1 );
+
+    // Passes that do not line up with the adaptive sampling interval, on several threads
+    Accumulator passes( scene.get_camera().get_resolution() );
+    for( int end : {3, 11, 12, 30, 40} ) scene.render_samples( passes, end, 4 );
+    require_same( whole, passes );
+}
+
+TEST_CASE( "Accumulator - passes with adaptive sampling" ) {
+    Scene scene( box_scene("acc_box_b", 64, { {"min_samples", 8}, {"threshold", 0.1f} }) );
+    Accumulator whole( scene.get_camera().get_resolution() );
+    scene.render_samples( whole, 64, 1 );
+
+    Accumulator passes( scene.get_camera().get_resolution() );
+    for( int end = 5; end < 64 + 5; end += 5 ) scene.render_samples( passes, end, 2 );
+    require_same( whole, passes );
+}
+
+TEST_CASE( "Accumulator - checkpoint round trip" ) {
+    Scene scene( box_scene("acc_box_c", 16) );
+    Accumulator acc( scene.get_camera().get_resolution(), 1234 );
+    scene.render_samples( acc, 7, 1 );
+
+    std::string filename = "test_accumulator.checkpoint";
+    acc.save(filename);
+    Accumulator loaded = Accumulator::load(filename, 1234);
+    require_same( acc, loaded );
+    REQUIRE_THROWS_AS( Accumulator::load(filename, 4321), LutertException );
+
+    // Resuming gives the same image as rendering without interruption
+    scene.render_samples( loaded, 16, 1 );
+    Accumulator whole( scene.get_camera().get_resolution() );
+    scene.render_samples( whole, 16, 1 );
+    require_same( whole, loaded );
+
+    std::remove( filename.c_str() );
+    REQUIRE_THROWS_AS( Accumulator::load(filename, 1234), LutertException );
+}
+
+TEST_CASE( "Accumulator - size must match the camera" ) {
+    Scene scene( box_scene("acc_box_d", 4) );
+    Accumulator acc( Vec2i{8, 8} );
+    REQUIRE_THROWS_AS( scene.render_samples(acc, 4), LutertException );
+}
+
+TEST_CASE( "Accumulator - merged partial renders match a single render" ) {
+    Scene scene( box_scene("acc_box_e", 24) );
+    Vec2i res = scene.get_camera().get_resolution();
+    Accumulator whole( res, 99 );
+    scene.render_samples( whole, 24, 1 );
+
+    // Two regions that split the frame unevenly, each rendered as two slices of the samples
+    std::vector<Accumulator> partials;
+    for( auto [region_min, region_max] : { std::pair<Vec2i, Vec2i>{ {0, 0}, {res.x, 5} },
+                                           std::pair<Vec2i, Vec2i>{ {0, 5}, res } } ) {
+        for( auto [s0, s1] : { std::pair<int, int>{0, 10}, std::pair<int, int>{10, 24} } ) {
+            Accumulator part( res, region_min, region_max, 99 );
+            part.start_at_sample(s0);
+            scene.render_samples( part, s1, 2 );
+            partials.push_back( std::move(part) );
+        }
+    }
+    // Merging must not depend on the order of the partials
+    std::swap( partials[0], partials[3] );
+
+    Accumulator merged = Accumulator::merge(partials);
+    require_same( whole, merged );
+    Image a = whole.image(), b = merged.image();
+    for( int y = 0; y < res.y; y++ ) {
+        for( int x = 0; x < res.x; x++ ) {
+            for( int c = 0; c < 3; c++ ) REQUIRE( a(x, y)[c] == b(x, y)[c] );
+        }
+    }
+}
+
+TEST_CASE( "Accumulator - sample ranges rendered in passes merge into a single render" ) {
+    Scene scene( box_scene("acc_box_h", 24) );
+    Vec2i res = scene.get_camera().get_resolution();
+    Accumulator whole( res, 5 );
+    scene.render_samples( whole, 24, 1 );
+
+    // Ranges that are not multiples of the pass size, as with --sample-range and --resume
+    std::vector<Accumulator> partials;
+    for( auto [s0, s1] : { std::pair<int, int>{0, 10}, std::pair<int, int>{10, 24} } ) {
+        Accumulator part( res, Vec2i{0, 0}, res, 5 );
+        part.start_at_sample(s0);
+        int passes = 0;
+        scene.render_passes( part, s1, 8, 2, [&]( const Accumulator & acc ) {
+            REQUIRE( acc.samples() < s1 );
+            passes++;
+        });
+        REQUIRE( part.samples() == s1 );
+        REQUIRE( passes == (s1 - s0 - 1) / 8 );
+        partials.push_back( std::move(part) );
+    }
+
+    Accumulator merged = Accumulator::merge(partials);
+    require_same( whole, merged );
+    REQUIRE_THROWS_AS( scene.render_passes( whole, 24, 0, 1 ), LutertException );
+}
+
+TEST_CASE( "Accumulator - partial render round trip" ) {
+    Scene scene( box_scene("acc_box_f", 8) );
+    Vec2i res = scene.get_camera().get_resolution();
+    Accumulator part( res, Vec2i{3, 2}, Vec2i{11, 9}, 7 );
+    part.start_at_sample(2);
+    scene.render_samples( part, 6, 1 );
+
+    std::string filename = "test_accumulator.partial";
+    part.save(filename);
+    Accumulator loaded = Accumulator::load(filename);
+    std::remove( filename.c_str() );
+    require_same( part, loaded );
+    REQUIRE( loaded.region_min() == Vec2i{3, 2} );
+    REQUIRE( loaded.get_frame_size() == res );
+    REQUIRE( loaded.first_sample() == 2 );
+    REQUIRE( loaded.get_scene_id() == 7 );
+}
+
+TEST_CASE( "Accumulator - merge rejects gaps and overlaps" ) {
+    Vec2i res{8, 4};
+    auto part = [&]( Vec2i region_min, Vec2i region_max, int s0, int s1, uint64_t scene_id = 0 ) {
+        Accumulator acc( res, region_min, region_max, scene_id );
+        acc.start_at_sample(s0);
+        acc.set_samples(s1);
+        return acc;
+    };
+    REQUIRE_NOTHROW( Accumulator::merge({ part({0, 0}, {8, 2}, 0, 4), part({0, 2}, {8, 4}, 0, 4) }) );
+    // A row missing
+    REQUIRE_THROWS_AS( Accumulator::merge({ part({0, 0}, {8, 2}, 0, 4), part({0, 2}, {8, 3}, 0, 4) }), LutertException );
+    // Overlapping regions
+    REQUIRE_THROWS_AS( Accumulator::merge({ part({0, 0}, {8, 3}, 0, 4), part({0, 2}, {8, 4}, 0, 4) }), LutertException );
+    // Missing samples [4, 6)
+    REQUIRE_THROWS_AS( Accumulator::merge({ part({0, 0}, {8, 4}, 0, 4), part({0, 0}, {8, 4}, 6, 8) }), LutertException );
+    // Different sample counts in different regions
+    REQUIRE_THROWS_AS( Accumulator::merge({ part({0, 0}, {8, 2}, 0, 4), part({0, 2}, {8, 4}, 0, 8) }), LutertException );
+    // Different scenes
+    REQUIRE_THROWS_AS( Accumulator::merge({ part({0, 0}, {8, 2}, 0, 4), part({0, 2}, {8, 4}, 0, 4, 1) }), LutertException );
+    // Regions outside the frame
+    REQUIRE_THROWS_AS( part({4, 0}, {9, 4}, 0, 4), LutertException );
+}
@@ -0,0 +1,51 @@
+#include <catch2/catch_test_macros.hpp>
+#include "matchers.h"
+#include "sphere.h"
+#include "quad.h"
+
+/*
+ * Tests for Surface::bounds().
+ */
+TEST_CASE( "Bounds - translated and scaled sphere" ) {
+    Mat4 m = mul( linalg::translation_matrix(Vec3f{1, 2, 3}), linalg::scaling_matrix(Vec3f{2, 1, 3}) );
+    Sphere s{ 0.5f, Transform(m) };
+    Bounds3f b = s.bounds();
+
+    REQUIRE_THAT( b.min, ApproxEqualsVec(Vec3f{0.0f, 1.5f, 1.5f}, 0.0001f) );
+    REQUIRE_THAT( b.max, ApproxEqualsVec(Vec3f{2.0f, 2.5f, 4.5f}, 0.0001f) );
+}
+
+TEST_CASE( "Bounds - rotated sphere is tight" ) {
+    // A rotated sphere must not grow, unlike the rotated bounding cube
+    Mat4 m = linalg::rotation_matrix(linalg::rotation_quat(normalize(Vec3f{1, 1, 0}), 0.7f));
+    Sphere s{ 2.0f, Transform(m) };
+    Bounds3f b = s.bounds();
+
+    REQUIRE_THAT( b.min, ApproxEqualsVec(Vec3f{-2.0f}, 0.0001f) );
+    REQUIRE_THAT( b.max, ApproxEqualsVec(Vec3f{2.0f}, 0.0001f) );
+}
+
+TEST_CASE( "Bounds - rotated quad" ) {
+    Mat4 m = mul( linalg::translation_matrix(Vec3f{0, 1, 0}),
+                  linalg::rotation_matrix(linalg::rotation_quat(Vec3f{1, 0, 0}, M_PI / 2)) );
+    Quad q{ {2.0f, 4.0f}, Transform(m) };
+    Bounds3f b = q.bounds();
+
+    REQUIRE_THAT( b.min, ApproxEqualsVec(Vec3f{-1.0f, 1.0f, -2.0f}, 0.0001f) );
+    REQUIRE_THAT( b.max, ApproxEqualsVec(Vec3f{1.0f, 1.0f, 2.0f}, 0.0001f) );
+}
+
+TEST_CASE( "Bounds - group is the union of its children" ) {
+    Group g;
+    g.add( std::make_shared<Sphere>(1.0f, Transform(linalg::translation_matrix(Vec3f{-3, 0, 0}))) );
+    g.add( std::make_shared<Sphere>(0.5f, Transform(linalg::translation_matrix(Vec3f{0, 4, 1}))) );
+    Bounds3f b = g.bounds();
+
+    REQUIRE_THAT( b.min, ApproxEqualsVec(Vec3f{-4.0f, -1.0f, -1.0f}, 0.0001f) );
+    REQUIRE_THAT( b.max, ApproxEqualsVec(Vec3f{0.5f, 4.5f, 1.5f}, 0.0001f) );
+}
+
+TEST_CASE( "Bounds - empty group" ) {
+    Group g;
+    REQUIRE( g.bounds().is_empty() );
+}
@@ -0,0 +1,138 @@
+#include <catch2/catch_test_macros.hpp>
+#include <pcg32.h>
+#include "matchers.h"
+#include "bvh.h"
+#include "quad.h"
+
+/*
+ * Tests for the bounding volume hierarchy.  The BVH must find exactly the same
+ * closest hits as a Group containing the same surfaces.
+ */
+namespace {
+    Vec3f random_vec( pcg32 & rng, float lo, float hi ) {
+        return Vec3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * (hi - lo) + lo;
+    }
+
+    std::shared_ptr<Surface> random_quad( pcg32 & rng ) {
+        Vec3f axis = normalize( random_vec(rng, -1.f, 1.f) + Vec3f{0.f, 0.f, 1e-3f} );
+        Mat4 m = mul( linalg::translation_matrix( random_vec(rng, -10.f, 10.f) ),
+                      linalg::rotation_matrix( linalg::rotation_quat(axis, rng.nextFloat() * 2 * M_PI) ) );
+        Vec2f size{ 0.1f + rng.nextFloat(), 0.1f + rng.nextFloat() };
+        return std::make_shared<Quad>( size, Transform(m) );
+    }
+
+    /// A thin slab so large that the surface area of its bounds overflows to infinity, and which is never hit
+    class HugeSlab : public Surface {
+    public:
+        explicit HugeSlab( float x ) : x(x) {}
+        bool intersect_t( Ray & ray, PrimitiveHit & hit ) const override { return false; }
+        Bounds3f bounds() const override { return Bounds3f( Vec3f{x, -1e30f, -1e30f}, Vec3f{x + 0.5f, 1e30f, 1e30f} ); }
+    private:
+        float x;
+    };
+}
+
+TEST_CASE( "BVH - bounds contain the surfaces" ) {
+    pcg32 rng;
+    BVH bvh;
+    Bounds3f expected;
+    for( int i = 0; i < 200; i++ ) {
+        auto quad = random_quad(rng);
+        bvh.add(quad);
+        expected.extend( quad->bounds() );
+    }
+    bvh.build();
+
+    REQUIRE_THAT( bvh.bounds().min, ApproxEqualsVec(expected.min, 0.0001f) );
+    REQUIRE_THAT( bvh.bounds().max, ApproxEqualsVec(expected.max, 0.0001f) );
+}
+
+TEST_CASE( "BVH - same closest hits as Group" ) {
+    pcg32 rng;
+    BVH bvh;
+    Group group;
+    for( int i = 0; i < 2000; i++ ) {
+        auto quad = random_quad(rng);
+        bvh.add(quad);
+        group.add(quad);
+    }
+    bvh.build();
+
+    int num_hits = 0;
+    for( int i = 0; i < 10000; i++ ) {
+        Vec3f o = random_vec(rng, -15.f, 15.f);
+        Vec3f d = normalize( random_vec(rng, -1.f, 1.f) );
+        Ray r1{o, d}, r2{o, d};
+
+        std::optional<HitRecord> expected = group.intersect(r1);
+        std::optional<HitRecord> hit = bvh.intersect(r2);
+
+        REQUIRE( hit.has_value() == expected.has_value() );
+        if( expected ) {
+            num_hits++;
+            REQUIRE( hit->t == expected->t );
+            REQUIRE_THAT( hit->p, ApproxEqualsVec(expected->p, 0.0001f) );
+        }
+    }
+    CHECK( num_hits > 100 );
+}
+
+TEST_CASE( "BVH - occluded agrees with intersect" ) {
+    pcg32 rng;
+    BVH bvh;
+    Group group;
+    for( int i = 0; i < 2000; i++ ) {
+        auto quad = random_quad(rng);
+        bvh.add(quad);
+        group.add(quad);
+    }
+    bvh.build();
+
+    int num_occluded = 0;
+    for( int i = 0; i < 10000; i++ ) {
+        // Finite segments, so that some are blocked and some are not
+        Ray ray{ random_vec(rng, -15.f, 15.f), normalize( random_vec(rng, -1.f, 1.f) ), Ray::EPSILON, 10.0f * rng.nextFloat() };
+        Ray r = ray;
+        bool expected = group.intersect(r).has_value();
+
+        REQUIRE( bvh.occluded(ray) == expected );
+        REQUIRE( group.occluded(ray) == expected );
+        if( expected ) num_occluded++;
+    }
+    CHECK( num_occluded > 100 );
+    CHECK( num_occluded < 9900 );
+}
+
+TEST_CASE( "BVH - empty hierarchy" ) {
+    BVH bvh;
+    bvh.build();
+    Ray r{ {0, 0, 0}, {0, 0, -1} };
+    REQUIRE( !bvh.intersect(r).has_value() );
+}
+
+TEST_CASE( "BVH - surfaces with infinite bound areas" ) {
+    // Every SAH split has an infinite cost, so the build falls back to median splits
+    pcg32 rng;
+    BVH bvh;
+    Group group;
+    for( int i = 0; i < 40; i++ ) {
+        auto slab = std::make_shared<HugeSlab>( float(i) );
+        bvh.add(slab);
+        group.add(slab);
+    }
+    for( int i = 0; i < 20; i++ ) {
+        auto quad = random_quad(rng);
+        bvh.add(quad);
+        group.add(quad);
+    }
+    bvh.build();
+
+    for( int i = 0; i < 500; i++ ) {
+        Vec3f o = random_vec(rng, -15.f, 15.f);
+        Ray r1{ o, normalize( random_vec(rng, -10.f, 10.f) - o ) }, r2 = r1;
+        std::optional<HitRecord> expected = group.intersect(r1);
+        std::optional<HitRecord> hit = bvh.intersect(r2);
+        REQUIRE( hit.has_value() == expected.has_value() );
+        if( hit ) REQUIRE( hit->t == expected->t );
+    }
+}
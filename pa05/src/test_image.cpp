@@ -0,0 +1,262 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <pcg32.h>
+// For its zlib decoder, to read back ZIP compressed EXR blocks
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#include "image.h"
+
+/*
+ * Tests for the conversion to 8-bit sRGB and for the linear float image writers.
+ */
+namespace {
+    Image test_image() {
+        Image image(37, 21);
+        for( int y = 0; y < image.height(); y++ ) {
+            for( int x = 0; x < image.width(); x++ ) {
+                image(x, y) = Color3f{ float(x) * 0.25f, float(y) * 10.0f, float(x * y) * 1e-3f };
+            }
+        }
+        return image;
+    }
+
+    // The nearest 8-bit code, computed directly from to_sRGB
+    int reference_srgb8( float v ) {
+        if( !std::isfinite(v) ) return -1;
+        float s = 255.0f * to_sRGB( Color3f{ std::min(std::max(v, 0.0f), 1.0f) } ).x;
+        float k = std::floor(s);
+        return int(k) + (s >= k + 0.5f);
+    }
+
+    std::string read_file( const std::string & filename ) {
+        std::ifstream in(filename, std::ios::binary);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+
+    template <class T>
+    T read_at( const std::string & data, size_t offset ) {
+        T value;
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        return value;
+    }
+
+    /// @returns the position of the offset table of an EXR file written by Image::save_exr
+    size_t exr_offset_table( const std::string & data ) {
+        // The header ends with an empty attribute name, after screenWindowWidth
+        size_t header_end = data.find("screenWindowWidth");
+        REQUIRE( header_end != std::string::npos );
+        header_end += std::strlen("screenWindowWidth") + 1 + std::strlen("float") + 1 + 4 + 4;
+        REQUIRE( data[header_end] == '\0' );
+        return header_end + 1;
+    }
+}
+
+TEST_CASE( "Image - sRGB conversion matches to_sRGB" ) {
+    pcg32 rng;
+    Image image(131, 67);
+    for( int y = 0; y < image.height(); y++ ) {
+        for( int x = 0; x < image.width(); x++ ) {
+            // Mostly dark values, where sRGB is steepest, and some out of range
+            for( int c = 0; c < 3; c++ ) {
+                float u = rng.nextFloat();
+                image(x, y)[c] = u * u * u * 1.2f - 0.05f;
+            }
+        }
+    }
+    image(3, 5) = Color3f{ 0.5f, NAN, 0.5f };
+    image(130, 66) = Color3f{ INFINITY, 0.0f, 0.0f };
+    image(0, 0) = Color3f{ 1.0f, 0.0f, 0.0031308f };
+
+    for( float bias : {1.0f, 2.5f} ) {
+        std::vector<uint8_t> out( 3 * image.width() * image.height() );
+        image.to_srgb8(out.data(), bias);
+        for( int y = 0; y < image.height(); y++ ) {
+            for( int x = 0; x < image.width(); x++ ) {
+                const uint8_t * rgb = &out[ 3 * image.index_1(x, y) ];
+                Color3f c = image(x, y) * bias;
+                if( !std::isfinite(c.x) || !std::isfinite(c.y) || !std::isfinite(c.z) ) {
+                    REQUIRE( (rgb[0] == 255 && rgb[1] == 0 && rgb[2] == 255) );
+                    continue;
+                }
+                for( int i = 0; i < 3; i++ ) REQUIRE( int(rgb[i]) == reference_srgb8(c[i]) );
+            }
+        }
+    }
+}
+
+TEST_CASE( "Image - sRGB conversion of every float in [0, 1]" ) {
+    // Every 97th float, so the table boundaries are crossed many times
+    Image image(1 << 12, 1);
+    std::vector<uint8_t> out( 3 * image.width() );
+    for( uint32_t bits = 0; bits <= 0x3f800000u; bits += 97 * uint32_t(image.width()) ) {
+        for( int x = 0; x < image.width(); x++ ) {
+            uint32_t b = std::min( bits + 97 * uint32_t(x), 0x3f800000u );
+            float v;
+            std::memcpy(&v, &b, sizeof(v));
+            image(x, 0) = Color3f{v};
+        }
+        image.to_srgb8(out.data());
+        for( int x = 0; x < image.width(); x++ ) {
+            REQUIRE( int(out[3 * x]) == reference_srgb8(image(x, 0).x) );
+        }
+    }
+}
+
+TEST_CASE( "Image - dithering preserves the mean" ) {
+    // A constant value between two codes is dithered to a mix of both
+    Image image(64, 64);
+    float value = 0.2f;
+    for( int y = 0; y < image.height(); y++ ) {
+        for( int x = 0; x < image.width(); x++ ) image(x, y) = Color3f{value};
+    }
+    std::vector<uint8_t> out( 3 * image.width() * image.height() );
+    image.to_srgb8(out.data(), 1.0f, true);
+
+    double sum = 0.0;
+    int lo = 255, hi = 0;
+    for( uint8_t code : out ) {
+        sum += code;
+        lo = std::min(lo, int(code));
+        hi = std::max(hi, int(code));
+    }
+    float expected = 255.0f * to_sRGB( Color3f{value} ).x;
+    REQUIRE( hi - lo == 1 );
+    REQUIRE( std::abs( sum / out.size() - expected ) < 0.01 );
+}
+
+TEST_CASE( "Image - PFM round trip" ) {
+    Image image = test_image();
+    std::string filename = "test_image.pfm";
+    image.save(filename);
+
+    std::ifstream in(filename, std::ios::binary);
+    std::string magic;
+    int width, height;
+    float scale;
+    in >> magic >> width >> height >> scale;
+    in.get();
+    REQUIRE( magic == "PF" );
+    REQUIRE( width == image.width() );
+    REQUIRE( height == image.height() );
+    REQUIRE( scale == -1.0f );
+
+    // Bottom row first
+    for( int y = height - 1; y >= 0; y-- ) {
+        for( int x = 0; x < width; x++ ) {
+            float rgb[3];
+            in.read( reinterpret_cast<char *>(rgb), sizeof(rgb) );
+            REQUIRE( rgb[0] == image(x, y).x );
+            REQUIRE( rgb[1] == image(x, y).y );
+            REQUIRE( rgb[2] == image(x, y).z );
+        }
+    }
+    REQUIRE( in );
+    in.close();
+    std::remove( filename.c_str() );
+}
+
+TEST_CASE( "Image - uncompressed EXR round trip" ) {
+    Image image = test_image();
+    std::string filename = "test_image.exr";
+    image.save_exr(filename, Image::ExrCompression::None);
+    std::string data = read_file(filename);
+    std::remove( filename.c_str() );
+
+    REQUIRE( read_at<uint32_t>(data, 0) == 20000630u );
+    REQUIRE( read_at<uint32_t>(data, 4) == 2u );
+
+    // One offset per scan line
+    size_t table = exr_offset_table(data);
+
+    for( int y = 0; y < image.height(); y++ ) {
+        uint64_t offset = read_at<uint64_t>(data, table + 8 * y);
+        REQUIRE( read_at<int32_t>(data, offset) == y );
+        REQUIRE( read_at<int32_t>(data, offset + 4) == int32_t(3 * 4 * image.width()) );
+        size_t pixels = offset + 8;
+        for( int x = 0; x < image.width(); x++ ) {
+            // Channels in alphabetical order: B, G, R
+            REQUIRE( read_at<float>(data, pixels + 4 * x) == image(x, y).z );
+            REQUIRE( read_at<float>(data, pixels + 4 * (image.width() + x)) == image(x, y).y );
+            REQUIRE( read_at<float>(data, pixels + 4 * (2 * image.width() + x)) == image(x, y).x );
+        }
+    }
+}
+
+TEST_CASE( "Image - ZIP compressed EXR" ) {
+    Image image(64, 40);
+    std::string filename = "test_image_zip.exr";
+    image.save(filename);
+    std::string compressed = read_file(filename);
+    image.save_exr(filename, Image::ExrCompression::None);
+    std::string uncompressed = read_file(filename);
+    std::remove( filename.c_str() );
+
+    // A black image compresses well
+    REQUIRE( read_at<uint32_t>(compressed, 0) == 20000630u );
+    REQUIRE( compressed.size() * 10 < uncompressed.size() );
+}
+
+TEST_CASE( "Image - ZIP compressed EXR round trip" ) {
+    Image image = test_image();
+    std::string filename = "test_image_zip_rt.exr";
+    image.save_exr(filename, Image::ExrCompression::Zip);
+    std::string data = read_file(filename);
+    std::remove( filename.c_str() );
+
+    size_t compression = data.find("compression");
+    REQUIRE( compression != std::string::npos );
+    REQUIRE( data[compression + 2 * std::strlen("compression") + 2 + 4] == 3 );   // ZIP_COMPRESSION
+
+    // One offset per block of 16 scan lines, the last block is shorter
+    size_t table = exr_offset_table(data);
+    int num_blocks = (image.height() + 15) / 16;
+    int compressed_blocks = 0;
+    for( int b = 0; b < num_blocks; b++ ) {
+        uint64_t offset = read_at<uint64_t>(data, table + 8 * b);
+        int y0 = 16 * b;
+        int lines = std::min(16, image.height() - y0);
+        size_t block_size = size_t(lines) * 3 * 4 * image.width();
+        REQUIRE( read_at<int32_t>(data, offset) == y0 );
+        int32_t data_size = read_at<int32_t>(data, offset + 4);
+        REQUIRE( (data_size > 0 && size_t(data_size) <= block_size) );
+
+        // A block that did not shrink is stored as it is
+        std::string block = data.substr(offset + 8, data_size);
+        if( size_t(data_size) < block_size ) {
+            compressed_blocks++;
+            std::string predicted(block_size, '\0');
+            REQUIRE( stbi_zlib_decode_buffer(&predicted[0], int(block_size), block.data(), data_size) == int(block_size) );
+            // Undo the differences, then put the two halves back at the even and odd offsets
+            for( size_t i = 1; i < block_size; i++ ) {
+                predicted[i] = char( uint8_t(predicted[i - 1]) + uint8_t(predicted[i]) - 128 );
+            }
+            size_t half = (block_size + 1) / 2;
+            block.resize(block_size);
+            for( size_t i = 0; i < block_size; i++ ) {
+                block[i] = predicted[ (i % 2 == 0) ? i / 2 : half + i / 2 ];
+            }
+        }
+
+        for( int line = 0; line < lines; line++ ) {
+            int y = y0 + line;
+            size_t pixels = size_t(line) * 3 * 4 * image.width();
+            for( int x = 0; x < image.width(); x++ ) {
+                // Channels in alphabetical order: B, G, R
+                REQUIRE( read_at<float>(block, pixels + 4 * x) == image(x, y).z );
+                REQUIRE( read_at<float>(block, pixels + 4 * (image.width() + x)) == image(x, y).y );
+                REQUIRE( read_at<float>(block, pixels + 4 * (2 * image.width() + x)) == image(x, y).x );
+            }
+        }
+    }
+    REQUIRE( compressed_blocks > 0 );
+}
+
+TEST_CASE( "Image - unknown extension" ) {
+    REQUIRE_THROWS( Image(2, 2).save("test_image.xyz") );
+}
@@ -0,0 +1,167 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <pcg32.h>
+#include "matchers.h"
+#include "instance.h"
+#include "sphere.h"
+#include "quad.h"
+#include "bvh.h"
+#include "scene.h"
+#include "materiallib.h"
+
+/*
+ * Tests for instances.  An instance of a prototype must be hit like a copy of the
+ * prototype's geometry with the instance transform applied.
+ */
+namespace {
+    Vec3f random_vec( pcg32 & rng, float lo, float hi ) {
+        return Vec3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * (hi - lo) + lo;
+    }
+
+    Transform random_transform( pcg32 & rng ) {
+        Vec3f axis = normalize( random_vec(rng, -1.f, 1.f) + Vec3f{0.f, 0.f, 1e-3f} );
+        Mat4 m = mul( linalg::translation_matrix( random_vec(rng, -8.f, 8.f) ),
+                      mul( linalg::rotation_matrix( linalg::rotation_quat(axis, rng.nextFloat() * 6.0f) ),
+                           linalg::scaling_matrix( random_vec(rng, 0.5f, 1.5f) ) ) );
+        return Transform(m);
+    }
+
+    /// A prototype with a sphere and a quad in its own space
+    std::shared_ptr<BVH> make_prototype() {
+        auto proto = std::make_shared<BVH>();
+        proto->add( std::make_shared<Sphere>( 0.5f, Transform( linalg::translation_matrix(Vec3f{0, 0.5f, 0}) ) ) );
+        proto->add( std::make_shared<Quad>( Vec2f{1, 1}, Transform( linalg::rotation_matrix(
+                                                  linalg::rotation_quat(Vec3f{1, 0, 0}, float(-M_PI / 2)) ) ) ) );
+        proto->build();
+        return proto;
+    }
+
+    struct Scenes {
+        BVH instances;  ///< Instances of one prototype
+        BVH copies;     ///< The same geometry, each with its own transform
+    };
+
+    void random_instances( pcg32 & rng, int n, Scenes & scenes ) {
+        auto proto = make_prototype();
+        for( int i = 0; i < n; i++ ) {
+            Transform t = random_transform(rng);
+            scenes.instances.add( std::make_shared<Instance>(proto, t) );
+            Transform sphere_t = t * Transform( linalg::translation_matrix(Vec3f{0, 0.5f, 0}) );
+            Transform quad_t = t * Transform( linalg::rotation_matrix(
+                                       linalg::rotation_quat(Vec3f{1, 0, 0}, float(-M_PI / 2)) ) );
+            scenes.copies.add( std::make_shared<Sphere>(0.5f, sphere_t) );
+            scenes.copies.add( std::make_shared<Quad>(Vec2f{1, 1}, quad_t) );
+        }
+        scenes.instances.build();
+        scenes.copies.build();
+    }
+}
+
+TEST_CASE( "Instance - same closest hits as transformed copies" ) {
+    pcg32 rng;
+    Scenes scenes;
+    random_instances(rng, 200, scenes);
+    // The instance bounds are the transformed bounds of the prototype, so they may be looser
+    for( int i = 0; i < 3; i++ ) {
+        REQUIRE( scenes.instances.bounds().min[i] <= scenes.copies.bounds().min[i] + 1e-4f );
+        REQUIRE( scenes.instances.bounds().max[i] >= scenes.copies.bounds().max[i] - 1e-4f );
+    }
+
+    int num_hits = 0;
+    for( int i = 0; i < 5000; i++ ) {
+        Vec3f o = random_vec(rng, -12.f, 12.f);
+        Vec3f d = normalize( random_vec(rng, -1.f, 1.f) );
+        Ray r1{o, d}, r2{o, d};
+
+        std::optional<HitRecord> expected = scenes.copies.intersect(r1);
+        std::optional<HitRecord> hit = scenes.instances.intersect(r2);
+        REQUIRE( hit.has_value() == expected.has_value() );
+        REQUIRE( scenes.instances.occluded(Ray{o, d}) == expected.has_value() );
+        if( !hit ) continue;
+
+        num_hits++;
+        REQUIRE_THAT( hit->t, Catch::Matchers::WithinRel(expected->t, 1e-4f) );
+        REQUIRE_THAT( hit->p, ApproxEqualsVec(expected->p, 1e-3f) );
+        REQUIRE_THAT( hit->gn, ApproxEqualsVec(expected->gn, 1e-3f) );
+        REQUIRE_THAT( hit->sn, ApproxEqualsVec(expected->sn, 1e-3f) );
+        REQUIRE( dynamic_cast<const Instance *>(hit->surface) != nullptr );
+        REQUIRE( r2.maxt == hit->t );
+    }
+    REQUIRE( num_hits > 500 );
+}
+
+TEST_CASE( "Instance - packets find the same hits as single rays" ) {
+    pcg32 rng;
+    Scenes scenes;
+    random_instances(rng, 100, scenes);
+
+    for( int i = 0; i < 1000; i++ ) {
+        RayPacket packet;
+        Vec3f o = random_vec(rng, -12.f, 12.f);
+        Vec3f dir = normalize( random_vec(rng, -1.f, 1.f) );
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            if( rng.nextFloat() < 0.2f ) continue;
+            packet.set( lane, Ray{ o, dir + random_vec(rng, -0.1f, 0.1f) } );
+        }
+
+        RayPacket traced = packet;
+        PrimitiveHit hits[PACKET_SIZE];
+        uint32_t hit_mask = scenes.instances.intersect_packet(traced, hits);
+        REQUIRE( (hit_mask & ~packet.active) == 0 );
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            if( !(packet.active & (1u << lane)) ) continue;
+            Ray ray = packet.get(lane);
+            PrimitiveHit expected;
+            bool found = scenes.instances.intersect_t(ray, expected);
+            REQUIRE( bool(hit_mask & (1u << lane)) == found );
+            if( found ) {
+                REQUIRE( hits[lane].surface == expected.surface );
+                REQUIRE( hits[lane].instanced == expected.instanced );
+                REQUIRE( hits[lane].t == expected.t );
+                REQUIRE( traced.maxt[lane] == expected.t );
+            }
+        }
+    }
+}
+
+TEST_CASE( "Instance - scene prototypes" ) {
+    auto scene_json = []( const json & prototypes, const json & surfaces ) {
+        return json{
+            {"camera", { {"resolution", {8, 8}} }},
+            {"background", {1, 1, 1}},
+            {"materials", {
+                { {"name", "inst_gray"}, {"type", "lambertian"}, {"albedo", {0.5f, 0.5f, 0.5f}} },
+                { {"name", "inst_light"}, {"type", "light"}, {"power", {5, 5, 5}} }
+            }},
+            {"prototypes", prototypes},
+            {"surfaces", surfaces}
+        };
+    };
+    json ball = { {"name", "ball"}, {"surfaces", { { {"type", "sphere"}, {"material", "inst_gray"} } }} };
+    json instance = { {"type", "instance"}, {"prototype", "ball"}, {"transform", { {"translate", {0, 0, -3}} }} };
+
+    MaterialLib::clear_names();
+    Scene scene( scene_json(json::array({ball}), json::array({instance, instance})) );
+    Accumulator acc( scene.get_camera().get_resolution() );
+    scene.render_samples(acc, 1, 1);
+    // The ball is in the middle of the image, in front of the white background
+    REQUIRE( acc.image()(4, 4).x > 0.0f );
+    REQUIRE( acc.image()(4, 4).x < 0.9f );
+    REQUIRE( acc.image()(0, 0).x == 1.0f );
+
+    MaterialLib::clear_names();
+    json missing = instance;
+    missing["prototype"] = "cube";
+    REQUIRE_THROWS_AS( Scene( scene_json(json::array({ball}), json::array({missing})) ), LutertParseException );
+
+    MaterialLib::clear_names();
+    json nested = { {"name", "nested"}, {"surfaces", json::array({instance})} };
+    REQUIRE_THROWS_AS( Scene( scene_json(json::array({ball, nested}), json::array()) ), LutertParseException );
+
+    MaterialLib::clear_names();
+    json lamp = { {"name", "lamp"}, {"surfaces", { { {"type", "quad"}, {"material", "inst_light"} } }} };
+    REQUIRE_THROWS_AS( Scene( scene_json(json::array({lamp}), json::array()) ), LutertParseException );
+
+    MaterialLib::clear_names();
+    REQUIRE_THROWS_AS( Scene( scene_json(json::array({ball, ball}), json::array()) ), LutertParseException );
+}
@@ -0,0 +1,187 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include "scene.h"
+
+/*
+ * Tests for the integrators.  Material names must be unique across the test
+ * cases, because all scenes share the global MaterialLib.
+ */
+namespace {
+    // A camera looking straight down at a large white floor, lit only by the background
+    json floor_scene( const std::string & material, const json & integrator ) {
+        return {
+            {"num_samples", 16},
+            {"background", {1, 1, 1}},
+            {"camera", {
+                {"vfov", 30.0f},
+                {"resolution", {32, 32}},
+                {"transform", { {"from", {0, 1, 0}}, {"at", {0, 0, 0}}, {"up", {0, 0, -1}} }}
+            }},
+            {"integrator", integrator},
+            {"materials", { { {"name", material}, {"type", "lambertian"}, {"albedo", {0.5f, 0.5f, 0.5f}} } }},
+            {"surfaces", {
+                { {"type", "quad"}, {"size", {100, 100}}, {"transform", { {"rotate", {-90, 1, 0, 0}} }}, {"material", material} }
+            }}
+        };
+    }
+
+    // An open box with a light and a sphere inside, so that paths bounce several times
+    json box_scene( const std::string & prefix, const json & integrator, int num_samples = 4 ) {
+        std::string wall = prefix + "_wall", light = prefix + "_light";
+        auto quad = [&]( const json & transform, const std::string & material, float size ) {
+            return json{ {"type", "quad"}, {"size", {size, size}}, {"transform", transform}, {"material", material} };
+        };
+        return {
+            {"num_samples", num_samples},
+            {"camera", {
+                {"vfov", 45.0f},
+                {"resolution", {24, 24}},
+                {"transform", { {"from", {0, 0, 3.4}}, {"at", {0, 0, 0}}, {"up", {0, 1, 0}} }}
+            }},
+            {"integrator", integrator},
+            {"materials", {
+                { {"name", wall}, {"type", "lambertian"}, {"albedo", {0.7f, 0.6f, 0.5f}} },
+                { {"name", light}, {"type", "light"}, {"power", {5, 5, 5}} }
+            }},
+            {"surfaces", {
+                quad( { {"translate", {0, 0, -1}} }, wall, 2 ),
+                quad( { {"rotate", {90, 0, 1, 0}}, {"translate", {-1, 0, 0}} }, wall, 2 ),
+                quad( { {"rotate", {-90, 0, 1, 0}}, {"translate", {1, 0, 0}} }, wall, 2 ),
+                quad( { {"rotate", {-90, 1, 0, 0}}, {"translate", {0, -1, 0}} }, wall, 2 ),
+                quad( { {"rotate", {90, 1, 0, 0}}, {"translate", {0, 0.99, 0}} }, light, 0.75f ),
+                { {"type", "sphere"}, {"radius", 0.35f}, {"material", wall} }
+            }}
+        };
+    }
+
+    float mean( Image & image ) {
+        double sum = 0.0;
+        for( int y = 0; y < image.height(); y++ ) {
+            for( int x = 0; x < image.width(); x++ ) {
+                sum += image(x, y).x + image(x, y).y + image(x, y).z;
+            }
+        }
+        return float( sum / (3.0 * image.width() * image.height()) );
+    }
+}
+
+TEST_CASE( "Integrator - unknown type" ) {
+    REQUIRE_THROWS_AS( Scene( floor_scene("int_floor_a", { {"type", "bidirectional"} }) ), LutertParseException );
+    // Only the wavefront integrator sorts its rays
+    REQUIRE_THROWS_AS( Scene( floor_scene("int_floor_sort_a", { {"type", "path"}, {"sort_rays", true} }) ), LutertParseException );
+    REQUIRE_NOTHROW( Scene( floor_scene("int_floor_sort_b", { {"type", "path"}, {"sort_rays", false} }) ) );
+}
+
+TEST_CASE( "Integrator - Russian roulette is unbiased" ) {
+    // Every camera ray hits the floor and scatters up into the background, so the
+    // expected value of every sample is the albedo.
+    Scene recursive( floor_scene("int_floor_b", { {"type", "recursive"} }) );
+    Image image = recursive.render(1);
+    REQUIRE_THAT( mean(image), Catch::Matchers::WithinAbs(0.5f, 1e-4f) );
+
+    // Roulette from the first bounce: half of the paths survive, with twice the weight
+    Scene path( floor_scene("int_floor_c", { {"type", "path"}, {"rr_depth", 0} }) );
+    image = path.render(1);
+    REQUIRE_THAT( mean(image), Catch::Matchers::WithinAbs(0.5f, 0.02f) );
+}
+
+TEST_CASE( "Integrator - path without roulette matches recursive" ) {
+    Scene recursive( box_scene("int_box_a", { {"type", "recursive"} }) );
+    Scene path( box_scene("int_box_b", { {"type", "path"}, {"rr_depth", 1000}, {"nee", false} }) );
+    Image a = recursive.render(1);
+    Image b = path.render(1);
+
+    for( int y = 0; y < a.height(); y++ ) {
+        for( int x = 0; x < a.width(); x++ ) {
+            for( int c = 0; c < 3; c++ ) {
+                REQUIRE_THAT( b(x, y)[c], Catch::Matchers::WithinAbs(a(x, y)[c], 1e-3f * std::max(1.0f, a(x, y)[c])) );
+            }
+        }
+    }
+}
+
+TEST_CASE( "Integrator - next-event estimation gives the same expected image" ) {
+    Scene path( box_scene("int_box_c", { {"type", "path"}, {"nee", false} }, 256) );
+    Scene nee( box_scene("int_box_d", { {"type", "path"}, {"nee", true} }, 256) );
+    Image a = path.render(1);
+    Image b = nee.render(1);
+    float expected = mean(a);
+    REQUIRE( expected > 0.05f );
+    REQUIRE_THAT( mean(b), Catch::Matchers::WithinRel(expected, 0.03f) );
+}
+
+TEST_CASE( "Integrator - adaptive sampling" ) {
+    json j = box_scene("int_box_e", { {"type", "path"} }, 256);
+    j["adaptive"] = { {"min_samples", 16}, {"threshold", 0.05f} };
+    j["background"] = {0.25f, 0.25f, 0.25f};
+    Scene adaptive(j);
+    Image spp;
+    Image image = adaptive.render(1, &spp);
+
+    // Pixels that only see the background have no variance and stop at min_samples,
+    // noisy pixels keep sampling
+    int min_spp = 256, max_spp = 0;
+    for( int y = 0; y < spp.height(); y++ ) {
+        for( int x = 0; x < spp.width(); x++ ) {
+            int n = int(spp(x, y).x);
+            REQUIRE( n >= 16 );
+            REQUIRE( n <= 256 );
+            min_spp = std::min(min_spp, n);
+            max_spp = std::max(max_spp, n);
+        }
+    }
+    REQUIRE( min_spp == 16 );
+    REQUIRE( max_spp > 16 );
+    REQUIRE_THAT( image(0, 0).x, Catch::Matchers::WithinAbs(0.25f, 1e-6f) );
+
+    // The result converges to the same image as uniform sampling
+    json k = box_scene("int_box_f", { {"type", "path"} }, 256);
+    k["background"] = j["background"];
+    Scene uniform(k);
+    Image reference = uniform.render(1);
+    float expected = mean(reference);
+    REQUIRE_THAT( mean(image), Catch::Matchers::WithinRel(expected, 0.03f) );
+
+    j["adaptive"]["min_samples"] = 0;
+    REQUIRE_THROWS_AS( Scene(j), LutertParseException );
+}
+
+TEST_CASE( "Integrator - wavefront renders the same image as path" ) {
+    // Each wavefront path uses the same random numbers as the path integrator, so the
+    // images are identical, with and without next-event estimation, adaptive sampling
+    // and sorting of the rays
+    int scene_index = 0;
+    auto render = [&]( json integrator, bool adaptive ) {
+        std::string prefix = fmt::format("int_wave_{}", scene_index++);
+        integrator["rr_depth"] = 2;
+        json j = box_scene(prefix, integrator, 32);
+        j["background"] = {0.25f, 0.25f, 0.25f};
+        // Every material type, so that all of the wavefront's material queues are used
+        j["materials"].push_back({ {"name", prefix + "_metal"}, {"type", "metal"}, {"albedo", {0.9f, 0.9f, 0.9f}}, {"roughness", 0.2f} });
+        j["materials"].push_back({ {"name", prefix + "_glass"}, {"type", "dielectric"}, {"ior", 1.5f} });
+        j["surfaces"].push_back({ {"type", "sphere"}, {"radius", 0.25f}, {"material", prefix + "_metal"},
+                                  {"transform", { {"translate", {-0.6, -0.7, 0.2}} }} });
+        j["surfaces"].push_back({ {"type", "sphere"}, {"radius", 0.25f}, {"material", prefix + "_glass"},
+                                  {"transform", { {"translate", {0.6, -0.7, 0.4}} }} });
+        if( adaptive ) j["adaptive"] = { {"min_samples", 8}, {"threshold", 0.05f} };
+        Scene scene(j);
+        Accumulator acc( scene.get_camera().get_resolution() );
+        scene.render_samples(acc, 32, 2);
+        return acc;
+    };
+
+    for( bool nee : {false, true} ) {
+        for( bool adaptive : {false, true} ) {
+            Accumulator expected = render( { {"type", "path"}, {"nee", nee} }, adaptive );
+            for( bool sort_rays : {false, true} ) {
+                Accumulator acc = render( { {"type", "wavefront"}, {"nee", nee}, {"sort_rays", sort_rays} }, adaptive );
+                for( int y = 0; y < acc.height(); y++ ) {
+                    for( int x = 0; x < acc.width(); x++ ) {
+                        REQUIRE( acc(x, y).count == expected(x, y).count );
+                        for( int c = 0; c < 3; c++ ) REQUIRE( acc(x, y).sum[c] == expected(x, y).sum[c] );
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <pcg32.h>
+#include "matchers.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+
+/*
+ * Tests for sampling points on surfaces, as used for light sampling.
+ */
+namespace {
+    // Check that samples lie on the surface, that the reported density matches pdf_area(...),
+    // and that the density integrates to one (the mean of 1/pdf is the area).
+    void check_sampling( const Surface & surface, float expected_area, float tolerance ) {
+        pcg32 rng;
+        double area = 0.0;
+        const int n = 20000;
+        for( int i = 0; i < n; i++ ) {
+            AreaSample s = surface.sample_area( Vec2f{rng.nextFloat(), rng.nextFloat()} );
+            REQUIRE( s.pdf > 0.0f );
+            REQUIRE_THAT( surface.pdf_area(s.p), Catch::Matchers::WithinRel(s.pdf, 1e-3f) );
+            REQUIRE_THAT( length(s.n), Catch::Matchers::WithinAbs(1.0f, 1e-4f) );
+
+            // A ray toward the sample along its normal must hit the surface at the sample
+            Ray ray{ s.p + 0.5f * s.n, -s.n };
+            std::optional<HitRecord> hit = surface.intersect(ray);
+            REQUIRE( hit.has_value() );
+            REQUIRE_THAT( hit->p, ApproxEqualsVec(s.p, 1e-3f) );
+            area += 1.0 / s.pdf;
+        }
+        REQUIRE_THAT( area / n, Catch::Matchers::WithinRel(expected_area, tolerance) );
+    }
+}
+
+TEST_CASE( "Lights - quad area sampling" ) {
+    Mat4 m = mul( linalg::translation_matrix( Vec3f{1, 2, 3} ),
+                  mul( linalg::rotation_matrix( linalg::rotation_quat( normalize(Vec3f{1, 1, 0}), 0.7f ) ),
+                       linalg::scaling_matrix( Vec3f{2, 1, 5} ) ) );
+    Quad quad( Vec2f{2, 3}, Transform(m) );
+    check_sampling( quad, 12.0f, 1e-4f );
+}
+
+TEST_CASE( "Lights - sphere area sampling" ) {
+    Sphere sphere( 1.5f, Transform( mul( linalg::translation_matrix( Vec3f{0, 1, 0} ), linalg::scaling_matrix( Vec3f{2, 2, 2} ) ) ) );
+    check_sampling( sphere, 4.0f * M_PI * 9.0f, 1e-4f );
+}
+
+TEST_CASE( "Lights - ellipsoid area sampling" ) {
+    // Spheroid with semi-axes a = a = 1 and c = 2, area 2 pi a^2 (1 + c / (a e) asin(e)), e^2 = 1 - a^2 / c^2
+    Sphere sphere( 1.0f, Transform( linalg::scaling_matrix( Vec3f{1, 1, 2} ) ) );
+    float e = std::sqrt(1.0f - 1.0f / 4.0f);
+    float area = 2.0f * M_PI * (1.0f + 2.0f / e * std::asin(e));
+    check_sampling( sphere, area, 0.02f );
+}
+
+TEST_CASE( "Lights - only emissive surfaces are lights" ) {
+    Light light;
+    Lambertian diffuse;
+    REQUIRE( Quad( Vec2f{1, 1}, Transform(), &light ).is_area_light() );
+    REQUIRE( Sphere( 1.0f, Transform(), &light ).is_area_light() );
+    REQUIRE( !Quad( Vec2f{1, 1}, Transform(), &diffuse ).is_area_light() );
+    REQUIRE( !Sphere( 1.0f, Transform() ).is_area_light() );
+}
+
+TEST_CASE( "Lights - Lambertian eval and pdf agree with scatter" ) {
+    Lambertian diffuse( json{ {"albedo", {0.2f, 0.4f, 0.8f}} } );
+    HitRecord hit;
+    hit.p = {0, 0, 0};
+    hit.gn = hit.sn = normalize(Vec3f{0.3f, 1.0f, -0.2f});
+    Ray ray{ {0, 1, 1}, {0, -1, -1} };
+
+    Sampler sampler;
+    for( int i = 0; i < 100; i++ ) {
+        std::optional<ScatterInfo> scatter = diffuse.scatter(ray, hit, sampler);
+        REQUIRE( scatter.has_value() );
+        Vec3f dir = normalize(scatter->scattered.d);
+        float pdf = diffuse.pdf(ray, hit, dir);
+        REQUIRE( pdf > 0.0f );
+        REQUIRE_THAT( diffuse.eval(ray, hit, dir) / pdf, ApproxEqualsVec(scatter->attenuation, 1e-4f) );
+    }
+    REQUIRE( diffuse.pdf(ray, hit, -hit.sn) == 0.0f );
+}
@@ -0,0 +1,120 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <cstdio>
+#include <fstream>
+#include <pcg32.h>
+#include "matchers.h"
+#include "mesh.h"
+
+/*
+ * Tests for triangle meshes loaded from OBJ files.
+ */
+namespace {
+    // A cube from -1 to 1, each face split into two triangles, faces point outward
+    const char * CUBE_OBJ = R"(
+v -1 -1 -1
+v  1 -1 -1
+v  1  1 -1
+v -1  1 -1
+v -1 -1  1
+v  1 -1  1
+v  1  1  1
+v -1  1  1
+f 1 4 3 2
+f 5 6 7 8
+f 1 2 6 5
+f 4 8 7 3
+f 1 5 8 4
+f 2 3 7 6
+)";
+
+    // A unit quad in the x-y plane with per-vertex normals
+    const char * QUAD_OBJ = R"(
+v -1 -1 0
+v  1 -1 0
+v  1  1 0
+v -1  1 0
+vn 0 0 1
+f 1//1 2//1 3//1
+f 1//1 3//1 4//1
+)";
+
+    std::string write_temp_obj( const std::string & name, const char * contents ) {
+        std::string path = name + ".obj";
+        std::ofstream out(path);
+        out << contents;
+        return path;
+    }
+}
+
+TEST_CASE( "Mesh - load OBJ" ) {
+    std::string path = write_temp_obj("test_mesh_cube", CUBE_OBJ);
+    auto data = Mesh::load_obj(path);
+    std::remove(path.c_str());
+
+    REQUIRE( data->num_triangles() == 12 );
+    REQUIRE( data->positions.size() == 8 );
+    REQUIRE( data->normals.empty() );
+}
+
+TEST_CASE( "Mesh - load OBJ with transform" ) {
+    std::string path = write_temp_obj("test_mesh_cube_xform", CUBE_OBJ);
+    auto data = Mesh::load_obj(path, Transform(linalg::translation_matrix(Vec3f{0, 10, 0})));
+    std::remove(path.c_str());
+    Mesh mesh(data);
+
+    REQUIRE_THAT( mesh.bounds().min, ApproxEqualsVec(Vec3f{-1, 9, -1}, 0.0001f) );
+    REQUIRE_THAT( mesh.bounds().max, ApproxEqualsVec(Vec3f{1, 11, 1}, 0.0001f) );
+}
+
+TEST_CASE( "Mesh - hit with interpolated normal" ) {
+    std::string path = write_temp_obj("test_mesh_quad", QUAD_OBJ);
+    Mesh mesh( Mesh::load_obj(path) );
+    std::remove(path.c_str());
+
+    Ray ray{ {0.25f, 0.5f, 2.0f}, {0, 0, -1} };
+    std::optional<HitRecord> hit = mesh.intersect(ray);
+    REQUIRE( hit.has_value() );
+    REQUIRE_THAT( hit->t, Catch::Matchers::WithinAbs(2.0f, 0.0001f) );
+    REQUIRE_THAT( hit->p, ApproxEqualsVec(Vec3f{0.25f, 0.5f, 0.0f}, 0.0001f) );
+    REQUIRE_THAT( hit->sn, ApproxEqualsVec(Vec3f{0, 0, 1}, 0.0001f) );
+
+    Ray miss{ {1.5f, 0.5f, 2.0f}, {0, 0, -1} };
+    REQUIRE( !mesh.intersect(miss).has_value() );
+
+    Ray too_short{ {0.25f, 0.5f, 2.0f}, {0, 0, -1}, Ray::EPSILON, 1.5f };
+    REQUIRE( !mesh.intersect(too_short).has_value() );
+
+    REQUIRE( mesh.occluded( Ray{ {0.25f, 0.5f, 2.0f}, {0, 0, -1} } ) );
+    REQUIRE( !mesh.occluded(miss) );
+    REQUIRE( !mesh.occluded(too_short) );
+}
+
+TEST_CASE( "Mesh - rays through the shared edge are not lost" ) {
+    std::string path = write_temp_obj("test_mesh_edge", QUAD_OBJ);
+    Mesh mesh( Mesh::load_obj(path) );
+    std::remove(path.c_str());
+
+    // Every point on the diagonal is on the edge shared by both triangles
+    Vec3f d = normalize( Vec3f{0.1f, -0.2f, -1.0f} );
+    for( int i = 0; i <= 100; i++ ) {
+        float s = -0.99f + 1.98f * i / 100.0f;
+        Ray ray{ Vec3f{s, s, 0.0f} - d * 3.0f, d };
+        REQUIRE( mesh.intersect(ray).has_value() );
+    }
+}
+
+TEST_CASE( "Mesh - closed cube is watertight" ) {
+    std::string path = write_temp_obj("test_mesh_closed", CUBE_OBJ);
+    Mesh mesh( Mesh::load_obj(path) );
+    std::remove(path.c_str());
+
+    // Every ray starting inside a closed mesh must hit it
+    pcg32 rng;
+    for( int i = 0; i < 20000; i++ ) {
+        Vec3f o = Vec3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * 1.8f - 0.9f;
+        Vec3f d = normalize( Vec3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * 2.0f - 1.0f );
+        Ray ray{o, d};
+        REQUIRE( mesh.intersect(ray).has_value() );
+    }
+}
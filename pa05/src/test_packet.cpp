@@ -0,0 +1,145 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <pcg32.h>
+#include "bvh.h"
+#include "mesh.h"
+#include "quad.h"
+#include "sphere.h"
+
+/*
+ * Tests for ray packets.  Tracing a packet must find the same closest hits as
+ * tracing each of its rays on its own.
+ */
+namespace {
+    Vec3f random_vec( pcg32 & rng, float lo, float hi ) {
+        return Vec3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * (hi - lo) + lo;
+    }
+
+    Mat4 random_rotation( pcg32 & rng ) {
+        Vec3f axis = normalize( random_vec(rng, -1.f, 1.f) + Vec3f{0.f, 0.f, 1e-3f} );
+        return linalg::rotation_matrix( linalg::rotation_quat(axis, rng.nextFloat() * 2 * M_PI) );
+    }
+
+    // A bumpy grid of triangles in the x-z plane
+    std::shared_ptr<MeshData> grid_mesh( pcg32 & rng, int n ) {
+        auto data = std::make_shared<MeshData>();
+        for( int z = 0; z <= n; z++ ) {
+            for( int x = 0; x <= n; x++ ) {
+                data->positions.push_back( Vec3f{ float(x) / n * 20.f - 10.f, rng.nextFloat() - 8.f, float(z) / n * 20.f - 10.f } );
+            }
+        }
+        for( uint32_t z = 0; z < uint32_t(n); z++ ) {
+            for( uint32_t x = 0; x < uint32_t(n); x++ ) {
+                uint32_t i = z * (n + 1) + x;
+                data->indices.insert( data->indices.end(), { i, i + 1, i + n + 2, i, i + n + 2, i + n + 1 } );
+            }
+        }
+        return data;
+    }
+
+    // Spheres (with uniform and non-uniform scales), quads and a mesh
+    std::shared_ptr<BVH> random_scene( pcg32 & rng ) {
+        auto bvh = std::make_shared<BVH>();
+        for( int i = 0; i < 200; i++ ) {
+            Mat4 m = mul( linalg::translation_matrix( random_vec(rng, -10.f, 10.f) ), random_rotation(rng) );
+            switch( i % 3 ) {
+                case 0:
+                    bvh->add( std::make_shared<Sphere>( 0.1f + rng.nextFloat(), Transform(m) ) );
+                    break;
+                case 1:
+                    m = mul( m, linalg::scaling_matrix( random_vec(rng, 0.2f, 1.5f) ) );
+                    bvh->add( std::make_shared<Sphere>( 0.5f, Transform(m) ) );
+                    break;
+                default:
+                    bvh->add( std::make_shared<Quad>( Vec2f{ 0.1f + rng.nextFloat(), 0.1f + rng.nextFloat() }, Transform(m) ) );
+            }
+        }
+        bvh->add( std::make_shared<Mesh>( grid_mesh(rng, 16) ) );
+        bvh->build();
+        return bvh;
+    }
+
+    void require_same_hits( const Surface & surface, const RayPacket & packet ) {
+        RayPacket traced = packet;
+        PrimitiveHit hits[PACKET_SIZE];
+        uint32_t hit_mask = surface.intersect_packet(traced, hits);
+        REQUIRE( (hit_mask & ~packet.active) == 0 );
+
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            if( !(packet.active & (1u << lane)) ) continue;
+            Ray ray = packet.get(lane);
+            PrimitiveHit expected;
+            bool found = surface.intersect_t(ray, expected);
+
+            REQUIRE( bool(hit_mask & (1u << lane)) == found );
+            if( found ) {
+                REQUIRE( hits[lane].surface == expected.surface );
+                REQUIRE( hits[lane].prim_id == expected.prim_id );
+                REQUIRE_THAT( hits[lane].t, Catch::Matchers::WithinRel(expected.t, 1e-4f) );
+                REQUIRE( traced.maxt[lane] == hits[lane].t );
+            }
+        }
+    }
+}
+
+TEST_CASE( "Packet - set and get round trip" ) {
+    RayPacket packet;
+    Ray ray{ {1, 2, 3}, {0.5f, -0.25f, 2.0f}, 0.5f, 10.0f };
+    packet.set(3, ray);
+    REQUIRE( packet.active == (1u << 3) );
+
+    Ray r = packet.get(3);
+    REQUIRE( r.o == ray.o );
+    REQUIRE( r.d == ray.d );
+    REQUIRE( r.mint == ray.mint );
+    REQUIRE( r.maxt == ray.maxt );
+}
+
+TEST_CASE( "Packet - bounds test matches the single ray test" ) {
+    pcg32 rng;
+    Bounds3f box{ {-1, -1, -1}, {1, 2, 3} };
+    for( int i = 0; i < 1000; i++ ) {
+        RayPacket packet;
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            Vec3f d = random_vec(rng, -1.f, 1.f);
+            // Rays parallel to an axis exercise the 0 * inf case
+            if( lane == 0 ) d.x = 0.0f;
+            packet.set( lane, Ray{ random_vec(rng, -5.f, 5.f), d, 0.001f, 1.0f + 10.f * rng.nextFloat() } );
+        }
+        uint32_t mask = packet.intersect(box);
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            Ray ray = packet.get(lane);
+            REQUIRE( bool(mask & (1u << lane)) == box.intersect(ray, Vec3f{1.0f} / ray.d) );
+        }
+    }
+}
+
+TEST_CASE( "Packet - coherent rays find the same hits as single rays" ) {
+    pcg32 rng;
+    auto scene = random_scene(rng);
+
+    for( int i = 0; i < 2000; i++ ) {
+        // Rays from one origin through a small patch, like neighbouring camera rays
+        Vec3f o = random_vec(rng, -15.f, 15.f);
+        Vec3f dir = normalize( random_vec(rng, -1.f, 1.f) );
+        RayPacket packet;
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            packet.set( lane, Ray{ o, dir + random_vec(rng, -0.05f, 0.05f) } );
+        }
+        require_same_hits( *scene, packet );
+    }
+}
+
+TEST_CASE( "Packet - incoherent and partially filled packets" ) {
+    pcg32 rng;
+    auto scene = random_scene(rng);
+
+    for( int i = 0; i < 2000; i++ ) {
+        RayPacket packet;
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            if( rng.nextFloat() < 0.3f ) continue;
+            packet.set( lane, Ray{ random_vec(rng, -15.f, 15.f), normalize( random_vec(rng, -1.f, 1.f) ) } );
+        }
+        require_same_hits( *scene, packet );
+    }
+}
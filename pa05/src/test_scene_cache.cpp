@@ -0,0 +1,253 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include "bvh.h"
+#include "scene.h"
+#include "scene_cache.h"
+#include "materiallib.h"
+
+/*
+ * Tests for the binary scene cache.  A scene loaded from its cache must render
+ * exactly like the scene parsed from JSON.
+ */
+namespace {
+    // A tetrahedron
+    const char * TETRA_OBJ = R"(
+v 0 0 0
+v 1 0 0
+v 0 1 0
+v 0 0 1
+f 1 3 2
+f 1 2 4
+f 1 4 3
+f 2 3 4
+)";
+
+    /// A scene with every kind of surface: quads, a light, a transformed sphere, a sphere set, a mesh and instances
+    json cache_scene( const std::string & obj_path ) {
+        auto quad = [&]( const json & transform, const std::string & material, float size ) {
+            return json{ {"type", "quad"}, {"size", {size, size}}, {"transform", transform}, {"material", material} };
+        };
+        json surfaces = {
+            quad( { {"translate", {0, 0, -1}} }, "cache_wall", 2 ),
+            quad( { {"rotate", {-90, 1, 0, 0}}, {"translate", {0, -1, 0}} }, "cache_wall", 2 ),
+            quad( { {"rotate", {90, 1, 0, 0}}, {"translate", {0, 0.99, 0}} }, "cache_light", 0.75f ),
+            { {"type", "sphere"}, {"radius", 0.2f}, {"material", "cache_metal"},
+              {"transform", { {"scale", {1.5, 0.5, 1}}, {"translate", {-0.5, 0.5, 0}} }} },
+            { {"type", "mesh"}, {"filename", obj_path}, {"material", "cache_glass"},
+              {"transform", { {"scale", 0.4}, {"translate", {0.3, -0.4, 0.2}} }} }
+        };
+        // Instances of a prototype, which is stored once
+        for( int i = 0; i < 3; i++ ) {
+            surfaces.push_back({ {"type", "instance"}, {"prototype", "cache_post"},
+                                 {"transform", { {"rotate", {30 * i, 0, 1, 0}}, {"translate", {0.5 * i - 0.5, -0.6, -0.5}} }} });
+        }
+        // Enough world-space spheres to be gathered into a SphereSet
+        for( int i = 0; i < 12; i++ ) {
+            surfaces.push_back({ {"type", "sphere"}, {"radius", 0.08f},
+                                 {"material", i % 2 ? "cache_wall" : "cache_metal"},
+                                 {"transform", { {"translate", {-0.8 + 0.14 * i, -0.9, 0.1 * (i % 3)}} }} });
+        }
+        return {
+            {"num_samples", 8},
+            {"background", {0.2f, 0.2f, 0.2f}},
+            {"camera", {
+                {"vfov", 45.0f},
+                {"resolution", {24, 16}},
+                {"transform", { {"from", {0, 0, 3.4}}, {"at", {0, 0, 0}}, {"up", {0, 1, 0}} }}
+            }},
+            {"integrator", { {"type", "path"} }},
+            {"materials", {
+                { {"name", "cache_wall"}, {"type", "lambertian"}, {"albedo", {0.7f, 0.6f, 0.5f}} },
+                { {"name", "cache_metal"}, {"type", "metal"}, {"albedo", {0.9f, 0.9f, 0.9f}}, {"roughness", 0.1f} },
+                { {"name", "cache_glass"}, {"type", "dielectric"}, {"ior", 1.5f} },
+                { {"name", "cache_light"}, {"type", "light"}, {"power", {5, 5, 5}} }
+            }},
+            {"prototypes", {
+                { {"name", "cache_post"}, {"surfaces", {
+                    quad( { {"rotate", {-90, 1, 0, 0}} }, "cache_metal", 0.2f ),
+                    { {"type", "sphere"}, {"radius", 0.1f}, {"material", "cache_wall"},
+                      {"transform", { {"scale", {0.5, 2, 0.5}}, {"translate", {0, 0.2, 0}} }} }
+                }} }
+            }},
+            {"surfaces", surfaces}
+        };
+    }
+
+    std::string write_file( const std::string & path, const std::string & contents ) {
+        std::ofstream out(path);
+        out << contents;
+        return path;
+    }
+}
+
+TEST_CASE( "SceneCache - a cached scene renders like the parsed scene" ) {
+    std::string obj_path = write_file("test_scene_cache.obj", TETRA_OBJ);
+    json j = cache_scene(obj_path);
+    std::string cache_path = "test_scene_cache.lsc";
+
+    MaterialLib::clear_names();
+    Scene parsed(j);
+    parsed.save_cache(cache_path, j, 1234);
+    Accumulator expected( parsed.get_camera().get_resolution() );
+    parsed.render_samples( expected, 8, 1 );
+
+    // The materials are loaded again from the cache
+    MaterialLib::clear_names();
+    uint64_t scene_id = 0;
+    Scene cached = Scene::load_cache(cache_path, &scene_id);
+    REQUIRE( scene_id == 1234 );
+    REQUIRE( cached.samples() == parsed.samples() );
+    Accumulator acc( cached.get_camera().get_resolution() );
+    cached.render_samples( acc, 8, 1 );
+
+    for( int y = 0; y < acc.height(); y++ ) {
+        for( int x = 0; x < acc.width(); x++ ) {
+            for( int c = 0; c < 3; c++ ) REQUIRE( acc(x, y).sum[c] == expected(x, y).sum[c] );
+        }
+    }
+
+    std::remove( cache_path.c_str() );
+    std::remove( obj_path.c_str() );
+}
+
+TEST_CASE( "SceneCache - truncated, damaged and missing caches are rejected" ) {
+    std::string obj_path = write_file("test_scene_cache_trunc.obj", TETRA_OBJ);
+    std::string json_path = "test_scene_cache_trunc.json";
+    std::string cache_path = SceneCache::cache_name(json_path);
+    REQUIRE( cache_path == "test_scene_cache_trunc.lsc" );
+    json j = cache_scene(obj_path);
+    write_file(json_path, j.dump());
+
+    MaterialLib::clear_names();
+    Scene(j).save_cache(cache_path, j, 1);
+    std::string contents;
+    {
+        std::ifstream in(cache_path, std::ios::binary);
+        contents.assign( std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() );
+    }
+
+    // Cut off in the header, and in the surfaces
+    for( size_t size : { size_t(10), contents.size() / 2, contents.size() - 1 } ) {
+        write_file( cache_path, contents.substr(0, size) );
+        MaterialLib::clear_names();
+        REQUIRE_THROWS_AS( Scene::load_cache(cache_path), LutertException );
+    }
+    // Damaged settings JSON
+    std::string damaged = contents;
+    size_t settings = damaged.find("{\"");
+    REQUIRE( settings != std::string::npos );
+    damaged[settings] = '#';
+    write_file( cache_path, damaged );
+    MaterialLib::clear_names();
+    REQUIRE_THROWS_AS( Scene::load_cache(cache_path), LutertException );
+
+    write_file( cache_path, contents.substr(0, 10) );
+    REQUIRE_FALSE( SceneCache::is_fresh(cache_path, json_path) );
+
+    std::remove( cache_path.c_str() );
+    REQUIRE_THROWS_AS( Scene::load_cache(cache_path), LutertException );
+    REQUIRE_FALSE( SceneCache::is_fresh(cache_path, json_path) );
+
+    std::remove( json_path.c_str() );
+    std::remove( obj_path.c_str() );
+}
+
+TEST_CASE( "SceneCache - BVH nodes that would misdirect traversal are rejected" ) {
+    std::vector<Bounds3f> prim_bounds;
+    for( int i = 0; i < 32; i++ ) {
+        prim_bounds.push_back( Bounds3f( Vec3f{float(i), 0, 0}, Vec3f{float(i) + 0.5f, 1, 1} ) );
+    }
+    BVHTree tree;
+    tree.build(prim_bounds, 2);
+    std::string cache_path = "test_scene_cache_bvh.lsc";
+    auto save_and_load = [&]( const BVHTree & saved, size_t num_prims ) {
+        SceneWriter out(cache_path);
+        saved.save(out);
+        out.finish();
+        SceneReader in(cache_path);
+        BVHTree loaded;
+        loaded.load(in, num_prims);
+        return loaded;
+    };
+    REQUIRE( save_and_load(tree, prim_bounds.size()).nodes.size() == tree.nodes.size() );
+
+    size_t interior = 1;
+    while( tree.nodes[interior].is_leaf() ) interior++;
+    REQUIRE( interior + 1 < tree.nodes.size() );
+
+    // A second child at or before its parent would make a cycle
+    for( uint32_t offset : { uint32_t(0), uint32_t(interior) } ) {
+        BVHTree damaged = tree;
+        damaged.nodes[interior].offset = offset;
+        REQUIRE_THROWS_AS( save_and_load(damaged, prim_bounds.size()), LutertException );
+    }
+    // An interior node at the end, whose first child would be past the end
+    {
+        BVHTree damaged = tree;
+        damaged.nodes.back().count = 0;
+        REQUIRE_THROWS_AS( save_and_load(damaged, prim_bounds.size()), LutertException );
+    }
+    // A split axis that is not an axis
+    {
+        BVHTree damaged = tree;
+        damaged.nodes[0].axis = 3;
+        REQUIRE_THROWS_AS( save_and_load(damaged, prim_bounds.size()), LutertException );
+    }
+    // A chain of interior nodes deeper than the traversal stack, each with the last node
+    // as its second child
+    {
+        BVHTree deep;
+        int num_nodes = BVHTree::STACK_SIZE + 2;
+        for( int i = 0; i < num_nodes; i++ ) {
+            BVHNode node;
+            node.bounds = prim_bounds[0];
+            node.offset = uint32_t(num_nodes - 1);
+            deep.nodes.push_back(node);
+        }
+        deep.nodes.back().offset = 0;
+        deep.nodes.back().count = 1;
+        deep.indices = {0};
+        REQUIRE_THROWS_AS( save_and_load(deep, 1), LutertException );
+        // One node less, and the deepest interior node fills the stack exactly
+        deep.nodes.erase( deep.nodes.begin() );
+        for( BVHNode & node : deep.nodes ) {
+            if( !node.is_leaf() ) node.offset -= 1;
+        }
+        REQUIRE( save_and_load(deep, 1).nodes.size() == deep.nodes.size() );
+    }
+    // An empty tree is only valid without primitives
+    REQUIRE( save_and_load(BVHTree(), 0).nodes.empty() );
+    REQUIRE_THROWS_AS( save_and_load(BVHTree(), 1), LutertException );
+
+    std::remove( cache_path.c_str() );
+}
+
+TEST_CASE( "SceneCache - the cache is stale when the scene or its meshes change" ) {
+    namespace fs = std::filesystem;
+    std::string obj_path = write_file("test_scene_cache_fresh.obj", TETRA_OBJ);
+    std::string json_path = "test_scene_cache_fresh.json";
+    std::string cache_path = SceneCache::cache_name(json_path);
+    json j = cache_scene(obj_path);
+    write_file(json_path, j.dump());
+
+    MaterialLib::clear_names();
+    Scene(j).save_cache(cache_path, j, 1);
+    // Set the times explicitly, file system timestamps may be coarse
+    auto written = fs::last_write_time(cache_path);
+    fs::last_write_time( json_path, written - std::chrono::seconds(10) );
+    fs::last_write_time( obj_path, written - std::chrono::seconds(10) );
+    REQUIRE( SceneCache::is_fresh(cache_path, json_path) );
+
+    fs::last_write_time( obj_path, written + std::chrono::seconds(10) );
+    REQUIRE_FALSE( SceneCache::is_fresh(cache_path, json_path) );
+
+    fs::last_write_time( obj_path, written - std::chrono::seconds(10) );
+    fs::last_write_time( json_path, written + std::chrono::seconds(10) );
+    REQUIRE_FALSE( SceneCache::is_fresh(cache_path, json_path) );
+
+    std::remove( cache_path.c_str() );
+    std::remove( json_path.c_str() );
+    std::remove( obj_path.c_str() );
+}
@@ -0,0 +1,128 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <pcg32.h>
+#include "matchers.h"
+#include "sphere_set.h"
+#include "sphere.h"
+#include "material.h"
+
+/*
+ * Tests for SphereSet.  It must find the same closest hits as a BVH containing
+ * one Sphere per sphere of the set.
+ */
+namespace {
+    Vec3f random_vec( pcg32 & rng, float lo, float hi ) {
+        return Vec3f{ rng.nextFloat(), rng.nextFloat(), rng.nextFloat() } * (hi - lo) + lo;
+    }
+
+    struct Scenes {
+        SphereSet set;
+        BVH bvh;
+        std::vector<std::unique_ptr<Lambertian>> materials;
+    };
+
+    // Spheres of varying size, some overlapping, with a few different materials
+    void random_spheres( pcg32 & rng, int n, Scenes & scenes ) {
+        for( int i = 0; i < 3; i++ ) scenes.materials.push_back( std::make_unique<Lambertian>() );
+        for( int i = 0; i < n; i++ ) {
+            Vec3f center = random_vec(rng, -10.f, 10.f);
+            float radius = 0.05f + 0.6f * rng.nextFloat();
+            const Material * material = scenes.materials[i % 3].get();
+            scenes.set.add(center, radius, material);
+            Transform xform( linalg::translation_matrix(center) );
+            scenes.bvh.add( std::make_shared<Sphere>(radius, xform, material) );
+        }
+        scenes.set.build();
+        scenes.bvh.build();
+    }
+}
+
+TEST_CASE( "SphereSet - same closest hits as separate spheres" ) {
+    pcg32 rng;
+    Scenes scenes;
+    random_spheres(rng, 1000, scenes);
+    REQUIRE( scenes.set.size() == 1000 );
+    REQUIRE_THAT( scenes.set.bounds().min, ApproxEqualsVec(scenes.bvh.bounds().min, 1e-4f) );
+    REQUIRE_THAT( scenes.set.bounds().max, ApproxEqualsVec(scenes.bvh.bounds().max, 1e-4f) );
+
+    int num_hits = 0;
+    for( int i = 0; i < 20000; i++ ) {
+        // Some rays start inside a sphere
+        Vec3f o = random_vec(rng, -12.f, 12.f);
+        Vec3f d = normalize( random_vec(rng, -1.f, 1.f) );
+        Ray r1{o, d}, r2{o, d};
+
+        std::optional<HitRecord> expected = scenes.bvh.intersect(r1);
+        std::optional<HitRecord> hit = scenes.set.intersect(r2);
+        REQUIRE( hit.has_value() == expected.has_value() );
+        REQUIRE( scenes.set.occluded(Ray{o, d}) == expected.has_value() );
+        if( !hit ) continue;
+
+        num_hits++;
+        REQUIRE_THAT( hit->t, Catch::Matchers::WithinRel(expected->t, 1e-5f) );
+        REQUIRE_THAT( hit->p, ApproxEqualsVec(expected->p, 1e-4f) );
+        REQUIRE_THAT( hit->gn, ApproxEqualsVec(expected->gn, 1e-3f) );
+        REQUIRE( hit->material == expected->material );
+        REQUIRE( hit->surface == &scenes.set );
+        REQUIRE( r2.maxt == hit->t );
+
+        // A segment ending before the hit is not occluded
+        Ray shorter{o, d};
+        shorter.maxt = hit->t * 0.999f;
+        REQUIRE( !scenes.set.occluded(shorter) );
+    }
+    REQUIRE( num_hits > 1000 );
+}
+
+TEST_CASE( "SphereSet - packets find the same hits as single rays" ) {
+    pcg32 rng;
+    Scenes scenes;
+    random_spheres(rng, 500, scenes);
+
+    for( int i = 0; i < 2000; i++ ) {
+        RayPacket packet;
+        Vec3f o = random_vec(rng, -15.f, 15.f);
+        Vec3f dir = normalize( random_vec(rng, -1.f, 1.f) );
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            if( rng.nextFloat() < 0.2f ) continue;
+            packet.set( lane, Ray{ o, dir + random_vec(rng, -0.1f, 0.1f) } );
+        }
+
+        RayPacket traced = packet;
+        PrimitiveHit hits[PACKET_SIZE];
+        uint32_t hit_mask = scenes.set.intersect_packet(traced, hits);
+        REQUIRE( (hit_mask & ~packet.active) == 0 );
+        for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+            if( !(packet.active & (1u << lane)) ) continue;
+            Ray ray = packet.get(lane);
+            PrimitiveHit expected;
+            bool found = scenes.set.intersect_t(ray, expected);
+            REQUIRE( bool(hit_mask & (1u << lane)) == found );
+            if( found ) {
+                REQUIRE( hits[lane].prim_id == expected.prim_id );
+                REQUIRE( hits[lane].t == expected.t );
+                REQUIRE( traced.maxt[lane] == expected.t );
+            }
+        }
+    }
+}
+
+TEST_CASE( "SphereSet - empty and small sets" ) {
+    SphereSet empty;
+    empty.build();
+    Ray ray{ {0, 0, -5}, {0, 0, 1} };
+    PrimitiveHit hit;
+    REQUIRE( !empty.intersect_t(ray, hit) );
+    REQUIRE( !empty.occluded(ray) );
+
+    // Fewer spheres than a SIMD vector, read through the padding
+    SphereSet set;
+    set.add( {0, 0, 0}, 1.0f, nullptr );
+    set.add( {0, 0, 3}, 0.5f, nullptr );
+    set.build();
+    REQUIRE( set.intersect_t(ray, hit) );
+    REQUIRE_THAT( hit.t, Catch::Matchers::WithinAbs(4.0f, 1e-5f) );
+    Ray back{ {0, 0, 10}, {0, 0, -1} };
+    REQUIRE( set.intersect_t(back, hit) );
+    REQUIRE_THAT( hit.t, Catch::Matchers::WithinAbs(6.5f, 1e-5f) );
+}
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <array>
+
+#include "scene.h"
+#include "random.h"
+#include "material.h"
+#include "stats.h"
+
+namespace {
+    /// Identifies a concrete material class to the generic scatter stage of render_tile_wavefront(...)
+    template <class M>
+    struct MaterialTag { using type = M; };
+
+    constexpr size_t NUM_MATERIAL_TYPES = size_t(Material::Type::Light) + 1;
+
+    /**
+     * The state of a batch of paths, kept as one array per field, indexed by path.  The
+     * fields that every stage reads, the ray and the throughput, are split further into
+     * one float array per component.
+     */
+    struct Wave {
+        // The ray that reached the current hit, then the scattered ray
+        std::vector<float> ox, oy, oz;
+        std::vector<float> dx, dy, dz;
+        std::vector<float> mint, maxt;
+        std::vector<float> tr, tg, tb;     ///< Throughput
+        std::vector<float> scatter_pdf;    ///< As in Scene::path_color(...)
+        std::vector<HitRecord> hits;       ///< The current hit
+        std::vector<Sampler> samplers;
+        std::vector<Color3f> radiance;
+
+        void resize( size_t n ) {
+            for( auto * v : { &ox, &oy, &oz, &dx, &dy, &dz, &mint, &maxt, &tr, &tg, &tb, &scatter_pdf } ) v->resize(n);
+            hits.resize(n);
+            samplers.resize(n);
+            radiance.resize(n);
+        }
+
+        Ray ray( uint32_t i ) const {
+            return Ray( Vec3f{ox[i], oy[i], oz[i]}, Vec3f{dx[i], dy[i], dz[i]}, mint[i], maxt[i] );
+        }
+        void set_ray( uint32_t i, const Ray & r ) {
+            ox[i] = r.o.x; oy[i] = r.o.y; oz[i] = r.o.z;
+            dx[i] = r.d.x; dy[i] = r.d.y; dz[i] = r.d.z;
+            mint[i] = r.mint; maxt[i] = r.maxt;
+        }
+
+        Color3f throughput( uint32_t i ) const { return Color3f{tr[i], tg[i], tb[i]}; }
+        void set_throughput( uint32_t i, const Color3f & t ) {
+            tr[i] = t.x; tg[i] = t.y; tb[i] = t.z;
+        }
+    };
+
+    /// Spread the low 10 bits of v apart, with two zero bits after each, for a 3D Morton code
+    uint32_t spread_bits( uint32_t v ) {
+        v &= 0x3ff;
+        v = (v | v << 16) & 0x030000ff;
+        v = (v | v << 8) & 0x0300f00f;
+        v = (v | v << 4) & 0x030c30c3;
+        v = (v | v << 2) & 0x09249249;
+        return v;
+    }
+
+    /// Morton code of p, with each coordinate in [0, 1) quantized to the given number of bits (at most 10)
+    uint64_t morton_code( const Vec3f & p, int bits ) {
+        float scale = float(1 << bits);
+        uint32_t max_cell = (1u << bits) - 1;
+        uint32_t cell[3];
+        for( int i = 0; i < 3; i++ ) {
+            // Written so that NaN goes to cell 0
+            float c = p[i] * scale;
+            cell[i] = c > 0.0f ? std::min( uint32_t(std::min(c, scale)), max_cell ) : 0;
+        }
+        return uint64_t( spread_bits(cell[0]) | spread_bits(cell[1]) << 1 | spread_bits(cell[2]) << 2 );
+    }
+
+    /**
+     * The key of a ray for Scene::sort_rays: the octant of its direction in the top
+     * bits, then a 30-bit Morton code of its origin within the scene bounds, then a
+     * 21-bit Morton code of its direction.
+     */
+    uint64_t ray_sort_key( const Ray & ray, const Vec3f & bounds_min, const Vec3f & inv_extent ) {
+        uint64_t octant = uint64_t(ray.d.x < 0.0f) | uint64_t(ray.d.y < 0.0f) << 1 | uint64_t(ray.d.z < 0.0f) << 2;
+        uint64_t origin = morton_code( (ray.o - bounds_min) * inv_extent, 10 );
+        uint64_t direction = morton_code( normalize(ray.d) * 0.5f + 0.5f, 7 );
+        return octant << 51 | origin << 21 | direction;
+    }
+
+    /// A shadow ray of next-event estimation, and the radiance it adds to its path if it is not occluded
+    struct ShadowQuery {
+        uint32_t path;
+        Ray ray;
+        Color3f contribution;
+    };
+}
+
+void Scene::render_tile_wavefront( Accumulator & acc, const Vec2i & tile_min, const Vec2i & tile_max,
+                                   int first_sample, int end_sample ) const {
+    Vec2i region_min = acc.region_min();
+    Vec2i resolution = camera->get_resolution();
+
+    // The pixels of the tile, grouped into the blocks of PACKET_W x PACKET_H traced as camera packets
+    std::vector<Vec2i> pixels;
+    std::vector<uint32_t> blocks;
+    std::vector<Accumulator::Pixel> pixel_stats;
+    uint32_t num_blocks = 0;
+    for( int by = tile_min.y; by < tile_max.y; by += PACKET_H ) {
+        for( int bx = tile_min.x; bx < tile_max.x; bx += PACKET_W ) {
+            for( int lane = 0; lane < PACKET_SIZE; lane++ ) {
+                int x = bx + lane % PACKET_W, y = by + lane / PACKET_W;
+                if( x >= tile_max.x || y >= tile_max.y ) continue;
+                pixels.push_back( Vec2i{x, y} );
+                blocks.push_back( num_blocks );
+                pixel_stats.push_back( acc(x - region_min.x, y - region_min.y) );
+            }
+            num_blocks++;
+        }
+    }
+
+    Wave wave;
+    std::vector<uint32_t> pending;   // Pixels that still need samples
+    std::vector<uint32_t> active;    // Paths with a hit to shade at the current depth
+    std::vector<uint32_t> next;      // Paths with a scattered ray to trace
+    std::array<std::vector<uint32_t>, NUM_MATERIAL_TYPES> queues;  // Paths to scatter, by material type
+    std::vector<ShadowQuery> shadow_queries;
+    std::vector<std::pair<uint64_t, uint32_t>> sort_keys;  // Key and path of each scattered ray, for sort_rays
+
+    Bounds3f scene_bounds = surfaces->bounds();
+    Vec3f inv_extent = 1.0f / linalg::max( scene_bounds.extent(), Vec3f(1e-6f) );
+
+    for( int s = first_sample; s < end_sample; ) {
+        pending.clear();
+        for( uint32_t i = 0; i < pixels.size(); i++ ) {
+            if( !pixel_stats[i].done ) pending.push_back(i);
+        }
+        if( pending.empty() ) break;
+
+        // As many samples of each pending pixel as fit in a wave, stopping at each convergence test
+        int count = std::max( 1, int(WAVE_SIZE / pending.size()) );
+        count = std::min( count, end_sample - s );
+        if( min_samples > 0 ) count = std::min( count, ADAPTIVE_INTERVAL - s % ADAPTIVE_INTERVAL );
+        size_t num_paths = size_t(count) * pending.size();
+        wave.resize(num_paths);
+
+        // Camera rays: path k * pending.size() + j is sample s + k of pixel pending[j].  They
+        // are traced in the same packets as in render_samples(...), one per pixel block and
+        // sample, because the packet traversal order can decide between hits at the same distance.
+        active.clear();
+        for( int k = 0; k < count; k++ ) {
+            for( size_t j = 0; j < pending.size(); ) {
+                uint32_t block = blocks[ pending[j] ];
+                uint32_t paths[PACKET_SIZE];
+                int n = 0;
+                RayPacket packet;
+                for( ; j < pending.size() && blocks[ pending[j] ] == block; j++, n++ ) {
+                    uint32_t path = uint32_t(k * pending.size() + j);
+                    Vec2i pixel = pixels[ pending[j] ];
+                    // The same random streams as render_samples(...) uses for this pixel sample
+                    wave.samplers[path] = Sampler( pixel.y * resolution.x + pixel.x, uint32_t(s + k) );
+                    Vec2f sample = Vec2f{ float(pixel.x), float(pixel.y) } + wave.samplers[path].next_2d();
+                    packet.set( n, camera->generate_ray(sample) );
+                    paths[n] = path;
+                }
+                PrimitiveHit hits[PACKET_SIZE];
+                LUTERT_STAT( stats::local().add_rays( 0, n ) );
+                uint32_t hit_mask = surfaces->intersect_packet(packet, hits);
+                for( int lane = 0; lane < n; lane++ ) {
+                    uint32_t path = paths[lane];
+                    wave.set_throughput( path, Color3f{1, 1, 1} );
+                    wave.scatter_pdf[path] = 0.0f;
+                    if( hit_mask & (1u << lane) ) {
+                        Ray ray = packet.get(lane);
+                        wave.set_ray(path, ray);
+                        wave.hits[path] = hits[lane].surface->shade(ray, hits[lane]);
+                        wave.radiance[path] = {0, 0, 0};
+                        active.push_back(path);
+                    } else {
+                        LUTERT_STAT( stats::local().escaped++ );
+                        wave.radiance[path] = background;
+                    }
+                }
+            }
+        }
+
+        // All live paths are at the same depth, each pass of this loop takes them one bounce further
+        for( int depth = 0; !active.empty(); depth++ ) {
+            // Light emitted at the hits, and sort the paths that go on by material type
+            for( auto & queue : queues ) queue.clear();
+            for( uint32_t path : active ) {
+                const HitRecord & hit = wave.hits[path];
+                wave.radiance[path] += wave.throughput(path) * emitted_light(wave.ray(path), hit, wave.scatter_pdf[path]);
+                if( depth >= MAX_DEPTH ) {
+                    LUTERT_STAT( stats::local().max_depth++ );
+                    continue;
+                }
+                queues[ size_t(hit.material->get_type()) ].push_back(path);
+            }
+
+            // Scatter the paths of one material type, calling its scatter(...) directly
+            next.clear();
+            shadow_queries.clear();
+            auto scatter_queue = [&]( auto tag ) {
+                using M = typename decltype(tag)::type;
+                for( uint32_t path : queues[ size_t(M::TYPE) ] ) {
+                    const HitRecord & hit = wave.hits[path];
+                    Sampler & sampler = wave.samplers[path];
+                    Ray ray = wave.ray(path);
+                    Color3f throughput = wave.throughput(path);
+                    sampler.start_bounce(depth + 1);
+
+                    bool sample_light = nee && !lights.empty() && !hit.material->is_specular();
+                    if( sample_light ) {
+                        Ray shadow_ray;
+                        Color3f contribution;
+                        if( sample_light_ray(ray, hit, sampler, shadow_ray, contribution) ) {
+                            shadow_queries.push_back( ShadowQuery{ path, shadow_ray, throughput * contribution } );
+                        }
+                    }
+
+                    std::optional<ScatterInfo> scatter = static_cast<const M *>(hit.material)->scatter(ray, hit, sampler);
+                    if( !scatter ) {
+                        LUTERT_STAT( stats::local().absorbed++ );
+                        continue;
+                    }
+                    throughput *= scatter->attenuation;
+                    wave.scatter_pdf[path] = sample_light ? hit.material->pdf(ray, hit, normalize(scatter->scattered.d)) : 0.0f;
+
+                    if( depth + 1 >= rr_depth ) {
+                        float survive = std::min( linalg::maxelem(throughput), 0.95f );
+                        if( sampler.next_float() >= survive ) {
+                            LUTERT_STAT( stats::local().roulette++ );
+                            continue;
+                        }
+                        throughput /= survive;
+                    }
+                    wave.set_throughput(path, throughput);
+                    wave.set_ray(path, scatter->scattered);
+                    next.push_back(path);
+                }
+            };
+            scatter_queue( MaterialTag<Lambertian>{} );
+            scatter_queue( MaterialTag<Metal>{} );
+            scatter_queue( MaterialTag<Dielectric>{} );
+            // Lights do not scatter, and their light samples would all be zero
+            LUTERT_STAT( stats::local().absorbed += queues[ size_t(Material::Type::Light) ].size() );
+
+            // Next-event estimation: the shadow rays of all the paths
+            for( const ShadowQuery & query : shadow_queries ) {
+                LUTERT_STAT( stats::local().shadow_rays++ );
+                if( !surfaces->occluded(query.ray) ) wave.radiance[query.path] += query.contribution;
+            }
+
+            // The scattered rays, in the order of their sort keys if sort_rays is set
+            if( sort_rays ) {
+                sort_keys.clear();
+                for( uint32_t path : next ) {
+                    sort_keys.emplace_back( ray_sort_key(wave.ray(path), scene_bounds.min, inv_extent), path );
+                }
+                std::sort( sort_keys.begin(), sort_keys.end() );
+                for( size_t i = 0; i < next.size(); i++ ) next[i] = sort_keys[i].second;
+            }
+            active.clear();
+            for( uint32_t path : next ) {
+                Ray ray = wave.ray(path);
+                LUTERT_STAT( stats::local().add_rays(depth + 1) );
+                PrimitiveHit hit;
+                if( !surfaces->intersect_t(ray, hit) ) {
+                    LUTERT_STAT( stats::local().escaped++ );
+                    wave.radiance[path] += wave.throughput(path) * background;
+                    continue;
+                }
+                wave.set_ray(path, ray);
+                wave.hits[path] = hit.surface->shade(ray, hit);
+                active.push_back(path);
+            }
+        }
+
+        // Add the samples to the pixels in sample order
+        for( int k = 0; k < count; k++ ) {
+            for( size_t j = 0; j < pending.size(); j++ ) {
+                pixel_stats[ pending[j] ].add( wave.radiance[k * pending.size() + j] );
+            }
+        }
+        s += count;
+
+        // Stop sampling the pixels that have converged
+        if( min_samples > 0 && s >= min_samples && s % ADAPTIVE_INTERVAL == 0 ) {
+            for( uint32_t i : pending ) {
+                if( pixel_stats[i].converged(adaptive_threshold) ) pixel_stats[i].done = 1;
+            }
+        }
+    }
+
+    for( size_t i = 0; i < pixels.size(); i++ ) {
+        acc(pixels[i].x - region_min.x, pixels[i].y - region_min.y) = pixel_stats[i];
+    }
+}